@@ -0,0 +1,58 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include <nes/thread_pool.hpp>
+#include <nes/parallel_algorithm.hpp>
+
+using hrc = std::chrono::high_resolution_clock;
+
+template<typename Func>
+static double measure(Func&& func)
+{
+    const auto tp1{hrc::now()};
+    func();
+    const auto tp2{hrc::now()};
+
+    return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(tp2 - tp1).count();
+}
+
+int main()
+{
+    nes::thread_pool thread_pool{};
+
+    std::mt19937_64 rng{42};
+    std::uniform_int_distribution<std::uint64_t> dist{};
+
+    std::cout << "Threads: " << thread_pool.thread_count() << "\n";
+    std::cout << std::setw(12) << "size" << std::setw(16) << "std::sort (ms)" << std::setw(20) << "parallel_sort (ms)" << std::setw(10) << "speedup" << "\n";
+
+    for(std::size_t size : {std::size_t{1} << 14, std::size_t{1} << 17, std::size_t{1} << 20, std::size_t{1} << 23, std::size_t{1} << 25})
+    {
+        std::vector<std::uint64_t> input(size);
+        std::generate(std::begin(input), std::end(input), [&rng, &dist]{ return dist(rng); });
+
+        auto reference{input};
+        const double reference_time{measure([&reference]
+        {
+            std::sort(std::begin(reference), std::end(reference));
+        })};
+
+        auto values{input};
+        const double parallel_time{measure([&thread_pool, &values]
+        {
+            nes::parallel_sort(thread_pool, std::begin(values), std::end(values));
+        })};
+
+        if(values != reference)
+        {
+            std::cerr << "parallel_sort produced a wrong result for size " << size << std::endl;
+            return 1;
+        }
+
+        std::cout << std::setw(12) << size << std::setw(16) << std::fixed << std::setprecision(2) << reference_time << std::setw(20) << parallel_time << std::setw(10) << reference_time / parallel_time << "\n";
+    }
+}
@@ -0,0 +1,69 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <array>
+#include <thread>
+#include <chrono>
+
+#include <nes/pipe.hpp>
+
+using hrc = std::chrono::high_resolution_clock;
+
+static constexpr std::size_t total_size{std::size_t{256} << 20};
+static constexpr std::size_t record_size{64};
+
+//Streams total_size bytes through an anonymous pipe in record_size writes and reads, returns the throughput in MiB/s
+static double measure(const nes::pipe_options& options)
+{
+    auto [is, os] = nes::make_anonymous_pipe(options);
+
+    const auto tp1{hrc::now()};
+
+    std::thread writer{[&os = os]()
+    {
+        std::array<char, record_size> record{};
+
+        for(std::size_t i{}; i < total_size / record_size; ++i)
+        {
+            os.write(std::data(record), record_size);
+        }
+
+        os.close();
+    }};
+
+    std::array<char, record_size> record{};
+    std::size_t received{};
+
+    while(is.read(std::data(record), record_size))
+    {
+        received += record_size;
+    }
+
+    writer.join();
+
+    const auto tp2{hrc::now()};
+
+    if(received != total_size)
+    {
+        std::cerr << "Received " << received << " bytes instead of " << total_size << std::endl;
+        std::exit(1);
+    }
+
+    return static_cast<double>(total_size >> 20) / std::chrono::duration_cast<std::chrono::duration<double>>(tp2 - tp1).count();
+}
+
+int main()
+{
+    std::cout << "Streaming " << (total_size >> 20) << " MiB in " << record_size << " bytes records\n";
+    std::cout << std::setw(14) << "buffer size" << std::setw(16) << "pipe capacity" << std::setw(14) << "MiB/s" << "\n";
+
+    for(std::size_t pipe_capacity : {std::size_t{}, std::size_t{1} << 20})
+    {
+        for(std::size_t buffer_size : {std::size_t{1} << 10, std::size_t{1} << 12, std::size_t{1} << 16, std::size_t{1} << 20})
+        {
+            const double throughput{measure(nes::pipe_options{buffer_size, pipe_capacity})};
+
+            std::cout << std::setw(14) << buffer_size << std::setw(16) << (pipe_capacity != 0 ? std::to_string(pipe_capacity) : std::string{"default"}) << std::setw(14) << std::fixed << std::setprecision(1) << throughput << "\n";
+        }
+    }
+}
@@ -0,0 +1,599 @@
+///////////////////////////////////////////////////////////
+/// Copyright 2020 Alexy Pellegrini
+///
+/// Permission is hereby granted, free of charge,
+/// to any person obtaining a copy of this software
+/// and associated documentation files (the "Software"),
+/// to deal in the Software without restriction,
+/// including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense,
+/// and/or sell copies of the Software, and to permit
+/// persons to whom the Software is furnished to do so,
+/// subject to the following conditions:
+///
+/// The above copyright notice and this permission notice
+/// shall be included in all copies or substantial portions
+/// of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+/// ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+/// TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+/// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+/// SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+/// ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+/// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+///////////////////////////////////////////////////////////
+
+#ifndef NOT_ENOUGH_STANDARDS_CHANNEL
+#define NOT_ENOUGH_STANDARDS_CHANNEL
+
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+namespace nes
+{
+
+namespace impl
+{
+
+template<typename T>
+class channel_handler_base
+{
+public:
+    channel_handler_base() = default;
+    virtual ~channel_handler_base() = default;
+    channel_handler_base(const channel_handler_base&) = delete;
+    channel_handler_base& operator=(const channel_handler_base&) = delete;
+    channel_handler_base(channel_handler_base&&) = delete;
+    channel_handler_base& operator=(channel_handler_base&&) = delete;
+
+    virtual void execute(std::optional<T> value) = 0;
+};
+
+template<typename T, typename Func>
+class channel_handler final : public channel_handler_base<T>
+{
+public:
+    template<typename F>
+    explicit channel_handler(F&& func)
+    :m_func{std::forward<F>(func)}
+    {
+
+    }
+
+    ~channel_handler() = default;
+    channel_handler(const channel_handler&) = delete;
+    channel_handler& operator=(const channel_handler&) = delete;
+    channel_handler(channel_handler&&) = delete;
+    channel_handler& operator=(channel_handler&&) = delete;
+
+    void execute(std::optional<T> value) override
+    {
+        std::invoke(m_func, std::move(value));
+    }
+
+private:
+    Func m_func;
+};
+
+}
+
+//Bounded multi-producer multi-consumer channel.
+//try_send and try_recv are lock-free (bounded ring of sequenced cells); the mutex is only taken to park or wake
+//blocked senders, blocked receivers and pending async receives, and only when one of them is actually waiting.
+template<typename T>
+class channel
+{
+public:
+    using value_type = T;
+
+public:
+    explicit channel(std::size_t capacity)
+    :m_capacity{std::bit_ceil(std::max<std::size_t>(capacity, 2))}
+    ,m_cells{std::make_unique<cell[]>(m_capacity)}
+    {
+        for(std::size_t i{}; i < m_capacity; ++i)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~channel()
+    {
+        while(try_recv())
+        {
+
+        }
+    }
+
+    channel(const channel&) = delete;
+    channel& operator=(const channel&) = delete;
+    channel(channel&&) = delete;
+    channel& operator=(channel&&) = delete;
+
+    template<typename U = T>
+    bool try_send(U&& value)
+    {
+        if(!push(std::forward<U>(value)))
+        {
+            return false;
+        }
+
+        notify_receivers(1);
+
+        return true;
+    }
+
+    template<typename U = T>
+    bool send(U&& value)
+    {
+        while(!push(std::forward<U>(value)))
+        {
+            if(!wait_for_slot())
+            {
+                return false;
+            }
+        }
+
+        notify_receivers(1);
+
+        return true;
+    }
+
+    //Sends values from [first, last) until the range is exhausted or the channel is closed, blocking while it is full.
+    //Returns the number of values sent; receivers are notified once per batch rather than once per value.
+    template<typename InputIt>
+    std::size_t send_batch(InputIt first, InputIt last)
+    {
+        std::size_t count{};
+        std::size_t pending{};
+
+        while(first != last)
+        {
+            if(push(*first))
+            {
+                ++first;
+                ++count;
+                ++pending;
+            }
+            else
+            {
+                notify_receivers(std::exchange(pending, 0));
+
+                if(!wait_for_slot())
+                {
+                    break;
+                }
+            }
+        }
+
+        notify_receivers(pending);
+
+        return count;
+    }
+
+    std::optional<T> try_recv()
+    {
+        auto output{pop()};
+
+        if(output)
+        {
+            notify_senders(1);
+        }
+
+        return output;
+    }
+
+    //Returns an empty optional once the channel is closed and drained.
+    std::optional<T> recv()
+    {
+        while(true)
+        {
+            auto output{pop()};
+
+            if(output)
+            {
+                notify_senders(1);
+
+                return output;
+            }
+
+            if(!wait_for_value())
+            {
+                return std::nullopt;
+            }
+        }
+    }
+
+    //Blocks until at least one value is available, then receives up to max_count values.
+    //Returns the number of values received, 0 meaning the channel is closed and drained.
+    template<typename OutputIt>
+    std::size_t recv_batch(OutputIt output, std::size_t max_count)
+    {
+        std::size_t count{};
+
+        while(count == 0 && max_count != 0)
+        {
+            while(count < max_count)
+            {
+                auto value{pop()};
+                if(!value)
+                {
+                    break;
+                }
+
+                *output++ = std::move(*value);
+                ++count;
+            }
+
+            if(count == 0 && !wait_for_value())
+            {
+                break;
+            }
+        }
+
+        notify_senders(count);
+
+        return count;
+    }
+
+    //Calls handler(std::optional<T>) on a worker of pool once a value is available, or with an empty optional if the channel is closed before.
+    //The handler is executed through thread_pool::execute, never under the channel's lock, so it may call async_recv again.
+    //Like any task, it runs on the calling thread when the pool does so: a full pool with caller_runs, or a full pool's own worker.
+    template<typename Func>
+    void async_recv(thread_pool& pool, Func&& handler)
+    {
+        std::unique_lock lock{m_mutex};
+
+        m_async_waiters.fetch_add(1, std::memory_order_seq_cst);
+
+        auto value{pop()};
+        if(value || m_closed.load(std::memory_order_seq_cst))
+        {
+            m_async_waiters.fetch_sub(1, std::memory_order_relaxed);
+            lock.unlock();
+
+            if(value)
+            {
+                notify_senders(1);
+            }
+
+            pool.execute([handler = std::forward<Func>(handler), value = std::move(value)]() mutable
+            {
+                std::invoke(handler, std::move(value));
+            });
+
+            return;
+        }
+
+        m_handlers.emplace_back(&pool, std::make_unique<impl::channel_handler<T, std::decay_t<Func>>>(std::forward<Func>(handler)));
+    }
+
+    //Wakes every blocked sender and receiver. Sends fail from now on; values already in the channel can still be received.
+    void close()
+    {
+        std::vector<ready_handler> ready{};
+        std::deque<pending_handler> handlers{};
+
+        {
+            std::lock_guard lock{m_mutex};
+
+            m_closed.store(true, std::memory_order_seq_cst);
+
+            while(!std::empty(m_handlers))
+            {
+                auto value{pop()};
+                if(!value)
+                {
+                    break;
+                }
+
+                ready.emplace_back(std::move(m_handlers.front()), std::move(value));
+                m_handlers.pop_front();
+            }
+
+            handlers = std::move(m_handlers);
+            m_handlers.clear();
+            m_async_waiters.store(0, std::memory_order_relaxed);
+        }
+
+        m_send_condition.notify_all();
+        m_recv_condition.notify_all();
+
+        for(auto& [handler, value] : ready)
+        {
+            dispatch(std::move(handler), std::move(value));
+        }
+
+        for(auto& handler : handlers)
+        {
+            dispatch(std::move(handler), std::nullopt);
+        }
+    }
+
+    bool is_closed() const noexcept
+    {
+        return m_closed.load(std::memory_order_acquire);
+    }
+
+    std::size_t capacity() const noexcept
+    {
+        return m_capacity;
+    }
+
+    //Approximate when other threads are sending or receiving.
+    std::size_t size() const noexcept
+    {
+        const std::size_t dequeue_pos{m_dequeue_pos.value.load(std::memory_order_acquire)};
+        const std::size_t enqueue_pos{m_enqueue_pos.value.load(std::memory_order_acquire)};
+
+        return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+    }
+
+private:
+    struct cell
+    {
+        std::atomic<std::size_t> sequence{};
+        alignas(T) std::byte storage[sizeof(T)];
+    };
+
+    struct pending_handler
+    {
+        pending_handler(thread_pool* pool, std::unique_ptr<impl::channel_handler_base<T>> handler)
+        :pool{pool}
+        ,handler{std::move(handler)}
+        {
+
+        }
+
+        thread_pool* pool{};
+        std::unique_ptr<impl::channel_handler_base<T>> handler{};
+    };
+
+    using ready_handler = std::pair<pending_handler, std::optional<T>>;
+
+private:
+    template<typename U>
+    bool push(U&& value)
+    {
+        if(m_closed.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        std::size_t position{m_enqueue_pos.value.load(std::memory_order_relaxed)};
+
+        while(true)
+        {
+            cell& current{m_cells[position & (m_capacity - 1)]};
+
+            const std::size_t sequence{current.sequence.load(std::memory_order_acquire)};
+            const auto difference{static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position)};
+
+            if(difference == 0)
+            {
+                if(m_enqueue_pos.value.compare_exchange_weak(position, position + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    ::new(static_cast<void*>(current.storage)) T(std::forward<U>(value));
+                    current.sequence.store(position + 1, std::memory_order_release);
+
+                    return true;
+                }
+            }
+            else if(difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = m_enqueue_pos.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::optional<T> pop()
+    {
+        std::size_t position{m_dequeue_pos.value.load(std::memory_order_relaxed)};
+
+        while(true)
+        {
+            cell& current{m_cells[position & (m_capacity - 1)]};
+
+            const std::size_t sequence{current.sequence.load(std::memory_order_acquire)};
+            const auto difference{static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1)};
+
+            if(difference == 0)
+            {
+                if(m_dequeue_pos.value.compare_exchange_weak(position, position + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    T* const value{std::launder(reinterpret_cast<T*>(current.storage))};
+
+                    std::optional<T> output{std::move(*value)};
+                    value->~T();
+
+                    current.sequence.store(position + m_capacity, std::memory_order_release);
+
+                    return output;
+                }
+            }
+            else if(difference < 0)
+            {
+                return std::nullopt;
+            }
+            else
+            {
+                position = m_dequeue_pos.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool has_slot() const noexcept
+    {
+        const std::size_t position{m_enqueue_pos.value.load(std::memory_order_seq_cst)};
+
+        return m_cells[position & (m_capacity - 1)].sequence.load(std::memory_order_seq_cst) == position;
+    }
+
+    bool has_value() const noexcept
+    {
+        const std::size_t position{m_dequeue_pos.value.load(std::memory_order_seq_cst)};
+
+        return m_cells[position & (m_capacity - 1)].sequence.load(std::memory_order_seq_cst) == position + 1;
+    }
+
+    bool wait_for_slot()
+    {
+        std::unique_lock lock{m_mutex};
+
+        m_send_waiters.fetch_add(1, std::memory_order_seq_cst);
+        m_send_condition.wait(lock, [this]()
+        {
+            return m_closed.load(std::memory_order_seq_cst) || has_slot();
+        });
+        m_send_waiters.fetch_sub(1, std::memory_order_relaxed);
+
+        return !m_closed.load(std::memory_order_relaxed);
+    }
+
+    bool wait_for_value()
+    {
+        std::unique_lock lock{m_mutex};
+
+        m_recv_waiters.fetch_add(1, std::memory_order_seq_cst);
+        m_recv_condition.wait(lock, [this]()
+        {
+            return m_closed.load(std::memory_order_seq_cst) || has_value();
+        });
+        m_recv_waiters.fetch_sub(1, std::memory_order_relaxed);
+
+        return has_value();
+    }
+
+    void notify_senders(std::size_t count)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if(count != 0 && m_send_waiters.load(std::memory_order_seq_cst) != 0)
+        {
+            {
+                std::lock_guard lock{m_mutex};
+            }
+
+            notify(m_send_condition, count);
+        }
+    }
+
+    void notify_receivers(std::size_t count)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if(count == 0)
+        {
+            return;
+        }
+
+        if(m_async_waiters.load(std::memory_order_seq_cst) != 0)
+        {
+            count -= dispatch_async(count);
+        }
+
+        if(count != 0 && m_recv_waiters.load(std::memory_order_seq_cst) != 0)
+        {
+            {
+                std::lock_guard lock{m_mutex};
+            }
+
+            notify(m_recv_condition, count);
+        }
+    }
+
+    //Handlers are paired with their value under the lock, but executed after it is released:
+    //thread_pool::execute may run them inline or wait for room, and they may call async_recv.
+    std::size_t dispatch_async(std::size_t count)
+    {
+        std::vector<ready_handler> ready{};
+
+        std::unique_lock lock{m_mutex};
+
+        while(std::size(ready) < count && !std::empty(m_handlers))
+        {
+            auto value{pop()};
+            if(!value)
+            {
+                break;
+            }
+
+            ready.emplace_back(std::move(m_handlers.front()), std::move(value));
+            m_handlers.pop_front();
+            m_async_waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        lock.unlock();
+
+        const std::size_t dispatched{std::size(ready)};
+        notify_senders(dispatched);
+
+        for(auto& [handler, value] : ready)
+        {
+            dispatch(std::move(handler), std::move(value));
+        }
+
+        return dispatched;
+    }
+
+    static void dispatch(pending_handler handler, std::optional<T> value)
+    {
+        handler.pool->execute([handler = std::move(handler.handler), value = std::move(value)]() mutable
+        {
+            handler->execute(std::move(value));
+        });
+    }
+
+    static void notify(std::condition_variable& condition, std::size_t count)
+    {
+        if(count == 1)
+        {
+            condition.notify_one();
+        }
+        else
+        {
+            condition.notify_all();
+        }
+    }
+
+private:
+    std::size_t m_capacity{};
+    std::unique_ptr<cell[]> m_cells{};
+
+    impl::padded_value<std::atomic<std::size_t>> m_enqueue_pos{};
+    impl::padded_value<std::atomic<std::size_t>> m_dequeue_pos{};
+
+    std::atomic<bool> m_closed{};
+    std::atomic<std::size_t> m_send_waiters{};
+    std::atomic<std::size_t> m_recv_waiters{};
+    std::atomic<std::size_t> m_async_waiters{};
+
+    std::mutex m_mutex{};
+    std::condition_variable m_send_condition{};
+    std::condition_variable m_recv_condition{};
+    std::deque<pending_handler> m_handlers{};
+};
+
+}
+
+#endif
@@ -0,0 +1,368 @@
+///////////////////////////////////////////////////////////
+/// Copyright 2020 Alexy Pellegrini
+///
+/// Permission is hereby granted, free of charge,
+/// to any person obtaining a copy of this software
+/// and associated documentation files (the "Software"),
+/// to deal in the Software without restriction,
+/// including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense,
+/// and/or sell copies of the Software, and to permit
+/// persons to whom the Software is furnished to do so,
+/// subject to the following conditions:
+///
+/// The above copyright notice and this permission notice
+/// shall be included in all copies or substantial portions
+/// of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+/// ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+/// TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+/// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+/// SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+/// ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+/// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+///////////////////////////////////////////////////////////
+
+#ifndef NOT_ENOUGH_STANDARDS_EXECUTION
+#define NOT_ENOUGH_STANDARDS_EXECUTION
+
+#if __has_include(<stdexec/execution.hpp>)
+    #define NES_EXECUTION_STDEXEC_EXTENSION
+    #include <stdexec/execution.hpp>
+#endif
+
+#include <atomic>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+#include "thread_pool.hpp"
+
+namespace nes
+{
+
+//Sender/receiver (P2300) adapters for nes::thread_pool.
+//Senders, operation states and schedulers follow the member-function shape of std::execution:
+//receivers must provide `set_value() && noexcept` and `set_error(std::exception_ptr) && noexcept`.
+//When stdexec is available the types also declare their concepts and completion signatures,
+//so they can be plugged directly in stdexec pipelines.
+
+namespace impl
+{
+
+template<typename Receiver>
+void execution_set_value(Receiver&& receiver) noexcept
+{
+#if defined(NES_EXECUTION_STDEXEC_EXTENSION)
+    stdexec::set_value(std::move(receiver));
+#else
+    std::move(receiver).set_value();
+#endif
+}
+
+template<typename Receiver>
+void execution_set_error(Receiver&& receiver, std::exception_ptr error) noexcept
+{
+#if defined(NES_EXECUTION_STDEXEC_EXTENSION)
+    stdexec::set_error(std::move(receiver), std::move(error));
+#else
+    std::move(receiver).set_error(std::move(error));
+#endif
+}
+
+}
+
+class thread_pool_scheduler;
+
+#if defined(NES_EXECUTION_STDEXEC_EXTENSION)
+class thread_pool_sender_env
+{
+public:
+    explicit thread_pool_sender_env(thread_pool& pool) noexcept
+    :m_pool{&pool}
+    {
+
+    }
+
+    template<typename CPO>
+    thread_pool_scheduler query(stdexec::get_completion_scheduler_t<CPO>) const noexcept;
+
+private:
+    thread_pool* m_pool{};
+};
+#endif
+
+template<typename Receiver>
+class thread_pool_schedule_operation
+{
+public:
+#if defined(NES_EXECUTION_STDEXEC_EXTENSION)
+    using operation_state_concept = stdexec::operation_state_t;
+#endif
+
+public:
+    thread_pool_schedule_operation(thread_pool& pool, Receiver receiver)
+    :m_pool{&pool}
+    ,m_receiver{std::move(receiver)}
+    {
+
+    }
+
+    ~thread_pool_schedule_operation() = default;
+    thread_pool_schedule_operation(const thread_pool_schedule_operation&) = delete;
+    thread_pool_schedule_operation& operator=(const thread_pool_schedule_operation&) = delete;
+    thread_pool_schedule_operation(thread_pool_schedule_operation&&) = delete;
+    thread_pool_schedule_operation& operator=(thread_pool_schedule_operation&&) = delete;
+
+    void start() & noexcept
+    {
+        try
+        {
+            m_pool->execute([this]()
+            {
+                impl::execution_set_value(std::move(m_receiver));
+            });
+        }
+        catch(...)
+        {
+            impl::execution_set_error(std::move(m_receiver), std::current_exception());
+        }
+    }
+
+private:
+    thread_pool* m_pool{};
+    Receiver m_receiver;
+};
+
+class thread_pool_schedule_sender
+{
+public:
+#if defined(NES_EXECUTION_STDEXEC_EXTENSION)
+    using sender_concept = stdexec::sender_t;
+    using completion_signatures = stdexec::completion_signatures<stdexec::set_value_t(), stdexec::set_error_t(std::exception_ptr)>;
+#endif
+
+public:
+    explicit thread_pool_schedule_sender(thread_pool& pool) noexcept
+    :m_pool{&pool}
+    {
+
+    }
+
+    template<typename Receiver>
+    thread_pool_schedule_operation<std::decay_t<Receiver>> connect(Receiver&& receiver) const
+    {
+        return thread_pool_schedule_operation<std::decay_t<Receiver>>{*m_pool, std::forward<Receiver>(receiver)};
+    }
+
+#if defined(NES_EXECUTION_STDEXEC_EXTENSION)
+    thread_pool_sender_env get_env() const noexcept
+    {
+        return thread_pool_sender_env{*m_pool};
+    }
+#endif
+
+private:
+    thread_pool* m_pool{};
+};
+
+//Runs func(index) for every index in [0, shape), split in at most one chunk per worker like task_builder::dispatch,
+//then completes on the worker that ran the last chunk. If any call throws, the first exception is sent to set_error.
+template<typename Receiver, typename Shape, typename Func>
+class thread_pool_bulk_operation
+{
+public:
+#if defined(NES_EXECUTION_STDEXEC_EXTENSION)
+    using operation_state_concept = stdexec::operation_state_t;
+#endif
+
+public:
+    thread_pool_bulk_operation(thread_pool& pool, Shape shape, Func func, Receiver receiver)
+    :m_pool{&pool}
+    ,m_shape{shape}
+    ,m_func{std::move(func)}
+    ,m_receiver{std::move(receiver)}
+    {
+
+    }
+
+    ~thread_pool_bulk_operation() = default;
+    thread_pool_bulk_operation(const thread_pool_bulk_operation&) = delete;
+    thread_pool_bulk_operation& operator=(const thread_pool_bulk_operation&) = delete;
+    thread_pool_bulk_operation(thread_pool_bulk_operation&&) = delete;
+    thread_pool_bulk_operation& operator=(thread_pool_bulk_operation&&) = delete;
+
+    void start() & noexcept
+    {
+        const auto total{static_cast<std::size_t>(m_shape)};
+        const std::size_t chunk_count{std::max<std::size_t>(1, std::min(total, m_pool->thread_count()))};
+
+        m_remaining.store(chunk_count, std::memory_order_relaxed);
+
+        for(std::size_t chunk{}; chunk < chunk_count; ++chunk)
+        {
+            const std::size_t begin{total * chunk / chunk_count};
+            const std::size_t end  {total * (chunk + 1) / chunk_count};
+
+            try
+            {
+                m_pool->execute([this, begin, end]()
+                {
+                    run(begin, end);
+                    count_down(1);
+                });
+            }
+            catch(...)
+            {
+                store_error(std::current_exception());
+                count_down(chunk_count - chunk);
+
+                return;
+            }
+        }
+    }
+
+private:
+    void run(std::size_t begin, std::size_t end) noexcept
+    {
+        try
+        {
+            for(std::size_t i{begin}; i < end; ++i)
+            {
+                std::invoke(m_func, static_cast<Shape>(i));
+            }
+        }
+        catch(...)
+        {
+            store_error(std::current_exception());
+        }
+    }
+
+    void store_error(std::exception_ptr error) noexcept
+    {
+        if(!m_has_error.test_and_set(std::memory_order_relaxed))
+        {
+            m_error = std::move(error);
+        }
+    }
+
+    void count_down(std::size_t count) noexcept
+    {
+        if(m_remaining.fetch_sub(count, std::memory_order_acq_rel) == count)
+        {
+            if(m_error)
+            {
+                impl::execution_set_error(std::move(m_receiver), std::move(m_error));
+            }
+            else
+            {
+                impl::execution_set_value(std::move(m_receiver));
+            }
+        }
+    }
+
+private:
+    thread_pool* m_pool{};
+    Shape m_shape{};
+    Func m_func;
+    Receiver m_receiver;
+    std::atomic<std::size_t> m_remaining{};
+    std::atomic_flag m_has_error{};
+    std::exception_ptr m_error{};
+};
+
+template<typename Shape, typename Func>
+class thread_pool_bulk_sender
+{
+public:
+#if defined(NES_EXECUTION_STDEXEC_EXTENSION)
+    using sender_concept = stdexec::sender_t;
+    using completion_signatures = stdexec::completion_signatures<stdexec::set_value_t(), stdexec::set_error_t(std::exception_ptr)>;
+#endif
+
+public:
+    thread_pool_bulk_sender(thread_pool& pool, Shape shape, Func func)
+    :m_pool{&pool}
+    ,m_shape{shape}
+    ,m_func{std::move(func)}
+    {
+
+    }
+
+    template<typename Receiver>
+    thread_pool_bulk_operation<std::decay_t<Receiver>, Shape, Func> connect(Receiver&& receiver) const&
+    {
+        return thread_pool_bulk_operation<std::decay_t<Receiver>, Shape, Func>{*m_pool, m_shape, m_func, std::forward<Receiver>(receiver)};
+    }
+
+    template<typename Receiver>
+    thread_pool_bulk_operation<std::decay_t<Receiver>, Shape, Func> connect(Receiver&& receiver) &&
+    {
+        return thread_pool_bulk_operation<std::decay_t<Receiver>, Shape, Func>{*m_pool, m_shape, std::move(m_func), std::forward<Receiver>(receiver)};
+    }
+
+#if defined(NES_EXECUTION_STDEXEC_EXTENSION)
+    thread_pool_sender_env get_env() const noexcept
+    {
+        return thread_pool_sender_env{*m_pool};
+    }
+#endif
+
+private:
+    thread_pool* m_pool{};
+    Shape m_shape{};
+    Func m_func;
+};
+
+class thread_pool_scheduler
+{
+public:
+#if defined(NES_EXECUTION_STDEXEC_EXTENSION)
+    using scheduler_concept = stdexec::scheduler_t;
+#endif
+
+public:
+    explicit thread_pool_scheduler(thread_pool& pool) noexcept
+    :m_pool{&pool}
+    {
+
+    }
+
+    thread_pool_schedule_sender schedule() const noexcept
+    {
+        return thread_pool_schedule_sender{*m_pool};
+    }
+
+    template<typename Shape, typename Func>
+    thread_pool_bulk_sender<Shape, std::decay_t<Func>> schedule_bulk(Shape shape, Func&& func) const
+    {
+        static_assert(std::is_integral_v<Shape>, "nes::thread_pool_scheduler::schedule_bulk requires an integral shape.");
+
+        return thread_pool_bulk_sender<Shape, std::decay_t<Func>>{*m_pool, shape, std::forward<Func>(func)};
+    }
+
+    thread_pool& pool() const noexcept
+    {
+        return *m_pool;
+    }
+
+    friend bool operator==(const thread_pool_scheduler&, const thread_pool_scheduler&) noexcept = default;
+
+private:
+    thread_pool* m_pool{};
+};
+
+#if defined(NES_EXECUTION_STDEXEC_EXTENSION)
+template<typename CPO>
+thread_pool_scheduler thread_pool_sender_env::query(stdexec::get_completion_scheduler_t<CPO>) const noexcept
+{
+    return thread_pool_scheduler{*m_pool};
+}
+#endif
+
+}
+
+#endif
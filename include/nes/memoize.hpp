@@ -0,0 +1,304 @@
+///////////////////////////////////////////////////////////
+/// Copyright 2020 Alexy Pellegrini
+///
+/// Permission is hereby granted, free of charge,
+/// to any person obtaining a copy of this software
+/// and associated documentation files (the "Software"),
+/// to deal in the Software without restriction,
+/// including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense,
+/// and/or sell copies of the Software, and to permit
+/// persons to whom the Software is furnished to do so,
+/// subject to the following conditions:
+///
+/// The above copyright notice and this permission notice
+/// shall be included in all copies or substantial portions
+/// of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+/// ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+/// TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+/// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+/// SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+/// ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+/// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+///////////////////////////////////////////////////////////
+
+#ifndef NOT_ENOUGH_STANDARDS_MEMOIZE
+#define NOT_ENOUGH_STANDARDS_MEMOIZE
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+#include "hash.hpp"
+#include "thread_pool.hpp"
+
+namespace nes
+{
+
+struct memo_statistics
+{
+    std::uint64_t hits{};
+    std::uint64_t misses{};
+    std::uint64_t coalesced{};
+};
+
+//Results of a pure function, keyed by its arguments hashed with nes::hash.
+//Holds at most capacity finished results and evicts the least recently used one first, calls still running are never evicted.
+//The function is bound at construction, so a cache can not mix the results of different functions.
+//It may be called concurrently from the pool's workers. A cache must outlive the calls made through it.
+template<typename Ret, typename... Args>
+class memo_cache
+{
+    static_assert(!std::is_void_v<Ret>, "nes::memo_cache can not memoize functions returning void");
+
+    template<typename CacheRet, typename... CacheArgs, typename... CallArgs>
+    friend std::shared_future<CacheRet> invoke_memoized(thread_pool& pool, memo_cache<CacheRet, CacheArgs...>& cache, CallArgs&&... args);
+
+public:
+    using key_type = std::tuple<std::decay_t<Args>...>;
+    using result_type = Ret;
+    using function_type = std::function<Ret(const std::decay_t<Args>&...)>;
+
+public:
+    template<typename Func>
+    memo_cache(std::size_t capacity, Func&& func)
+    :m_capacity{capacity}
+    ,m_func{std::forward<Func>(func)}
+    {
+        static_assert(std::is_convertible_v<std::invoke_result_t<std::decay_t<Func>&, const std::decay_t<Args>&...>, Ret>, "nes::memo_cache function does not match its signature");
+
+        assert(capacity != 0 && "nes::memo_cache created with capacity == 0");
+    }
+
+    //Waits for the calls still running, helping their pools meanwhile.
+    ~memo_cache()
+    {
+        m_pending.wait([this]()
+        {
+            std::unique_lock lock{m_mutex};
+            auto* pool{m_last_pool};
+            lock.unlock();
+
+            return pool && impl::run_pending_task(*pool);
+        });
+    }
+
+    memo_cache(const memo_cache&) = delete;
+    memo_cache& operator=(const memo_cache&) = delete;
+    memo_cache(memo_cache&&) = delete;
+    memo_cache& operator=(memo_cache&&) = delete;
+
+    memo_statistics statistics() const
+    {
+        std::lock_guard lock{m_mutex};
+
+        return m_statistics;
+    }
+
+    //Number of finished results held
+    std::size_t size() const
+    {
+        std::lock_guard lock{m_mutex};
+
+        return std::size(m_lru);
+    }
+
+    std::size_t capacity() const noexcept
+    {
+        return m_capacity;
+    }
+
+    //Forgets the finished results, calls still running are kept so they can still be coalesced.
+    void clear()
+    {
+        std::lock_guard lock{m_mutex};
+
+        for(const auto* key : m_lru)
+        {
+            m_entries.erase(m_entries.find(*key));
+        }
+
+        m_lru.clear();
+    }
+
+private:
+    struct key_hash
+    {
+        std::size_t operator()(const key_type& key) const noexcept
+        {
+            using kernel_type = hash_kernels::fnv_1a;
+
+            return std::apply([](const auto&... values)
+            {
+                kernel_hash_value_t<kernel_type> output{};
+                ((output = hash_combine<kernel_type>(output, hash<std::decay_t<decltype(values)>, kernel_type>{}(values))), ...);
+
+                return static_cast<std::size_t>(output[0]);
+            }, key);
+        }
+    };
+
+    struct entry
+    {
+        std::shared_future<Ret> future{};
+        typename std::list<const key_type*>::iterator lru_position{};
+        bool ready{};
+    };
+
+    using map_type = std::unordered_map<key_type, entry, key_hash>;
+
+private:
+    //Runs the function and publishes its result. The entry is marked ready before the future, so that a call
+    //that sees the future ready also finds the entry ready and is counted as a hit.
+    void run(const key_type* key, std::promise<Ret>& promise)
+    {
+        std::optional<Ret> value{};
+        std::exception_ptr error{};
+
+        try
+        {
+            value.emplace(std::apply(m_func, *key));
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+        }
+
+        //The key may be evicted as soon as the entry is completed
+        complete(*key, !error);
+
+        if(error)
+        {
+            promise.set_exception(std::move(error));
+        }
+        else
+        {
+            promise.set_value(std::move(*value));
+        }
+
+        m_pending.release();
+    }
+
+    //Must be called with m_mutex locked
+    void touch(entry& entry)
+    {
+        m_lru.splice(std::begin(m_lru), m_lru, entry.lru_position);
+    }
+
+    void complete(const key_type& key, bool success)
+    {
+        std::lock_guard lock{m_mutex};
+
+        const auto it{m_entries.find(key)};
+
+        //Failed calls are not cached, the next call with the same arguments runs again
+        if(!success)
+        {
+            m_entries.erase(it);
+
+            return;
+        }
+
+        it->second.ready = true;
+        it->second.lru_position = m_lru.emplace(std::begin(m_lru), &it->first);
+
+        while(std::size(m_lru) > m_capacity)
+        {
+            const key_type* oldest{m_lru.back()};
+            m_lru.pop_back();
+            m_entries.erase(m_entries.find(*oldest));
+        }
+    }
+
+private:
+    std::size_t m_capacity{};
+    function_type m_func{};
+    mutable std::mutex m_mutex{};
+    map_type m_entries{};
+    std::list<const key_type*> m_lru{};
+    memo_statistics m_statistics{};
+    impl::pending_counter m_pending{};
+    thread_pool* m_last_pool{};
+};
+
+//Returns the result of the cache's function called with args, computed on pool. If the same arguments are cached, the cached result is returned without running anything,
+//if a call with the same arguments is still running, its result is shared instead of running the function again.
+template<typename Ret, typename... Args, typename... CallArgs>
+std::shared_future<Ret> invoke_memoized(thread_pool& pool, memo_cache<Ret, Args...>& cache, CallArgs&&... args)
+{
+    using cache_type = memo_cache<Ret, Args...>;
+    using key_type = typename cache_type::key_type;
+
+    key_type key{std::forward<CallArgs>(args)...};
+
+    std::unique_lock lock{cache.m_mutex};
+
+    if(const auto it{cache.m_entries.find(key)}; it != std::end(cache.m_entries))
+    {
+        if(it->second.ready)
+        {
+            ++cache.m_statistics.hits;
+            cache.touch(it->second);
+        }
+        else
+        {
+            ++cache.m_statistics.coalesced;
+        }
+
+        return it->second.future;
+    }
+
+    ++cache.m_statistics.misses;
+    cache.m_last_pool = &pool;
+
+    std::promise<Ret> promise{};
+    auto [it, inserted] = cache.m_entries.emplace(std::move(key), typename cache_type::entry{promise.get_future().share()});
+    auto output{it->second.future};
+
+    //Keys are stable in the map until erased, which only happens once the call completed
+    const key_type* stored_key{&it->first};
+
+    cache.m_pending.add();
+
+    lock.unlock();
+
+    //If the call can not be queued, the entry is dropped so the next call retries it,
+    //the calls already coalesced on it get a broken_promise error
+    try
+    {
+        pool.execute([&cache, stored_key, promise = std::move(promise)]() mutable
+        {
+            cache.run(stored_key, promise);
+        });
+    }
+    catch(...)
+    {
+        lock.lock();
+        cache.m_entries.erase(cache.m_entries.find(*stored_key));
+        lock.unlock();
+
+        cache.m_pending.release();
+
+        throw;
+    }
+
+    return output;
+}
+
+}
+
+#endif
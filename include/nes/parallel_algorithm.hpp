@@ -0,0 +1,533 @@
+///////////////////////////////////////////////////////////
+/// Copyright 2020 Alexy Pellegrini
+///
+/// Permission is hereby granted, free of charge,
+/// to any person obtaining a copy of this software
+/// and associated documentation files (the "Software"),
+/// to deal in the Software without restriction,
+/// including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense,
+/// and/or sell copies of the Software, and to permit
+/// persons to whom the Software is furnished to do so,
+/// subject to the following conditions:
+///
+/// The above copyright notice and this permission notice
+/// shall be included in all copies or substantial portions
+/// of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+/// ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+/// TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+/// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+/// SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+/// ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+/// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+///////////////////////////////////////////////////////////
+
+#ifndef NOT_ENOUGH_STANDARDS_PARALLEL_ALGORITHM
+#define NOT_ENOUGH_STANDARDS_PARALLEL_ALGORITHM
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <future>
+#include <memory>
+#include <numeric>
+#include <ranges>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+namespace nes
+{
+
+namespace impl
+{
+
+inline constexpr std::size_t sort_grain_size{1 << 14};
+inline constexpr std::size_t algorithm_grain_size{1 << 11};
+
+//Every task is waited for before the first exception is rethrown, as tasks may reference the caller's stack
+inline void wait_all(std::vector<std::future<void>>& futures)
+{
+    std::exception_ptr error{};
+
+    for(auto& future : futures)
+    {
+        try
+        {
+            future.get();
+        }
+        catch(...)
+        {
+            if(!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
+
+    futures.clear();
+
+    if(error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+//Returns how many elements of the first range belong to the first "diagonal" elements of the merged output.
+//Ties are resolved in favour of the first range, like std::merge.
+template<typename InputIt1, typename InputIt2, typename Compare>
+std::size_t merge_co_rank(std::size_t diagonal, InputIt1 first1, std::size_t size1, InputIt2 first2, std::size_t size2, Compare& comp)
+{
+    std::size_t low {diagonal > size2 ? diagonal - size2 : 0};
+    std::size_t high{std::min(diagonal, size1)};
+
+    while(low < high)
+    {
+        const std::size_t middle{low + (high - low) / 2};
+
+        if(!comp(first2[diagonal - middle - 1], first1[middle]))
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+//Merge buffer of parallel_sort. It is not default constructed, value_type may not be default constructible:
+//each sorted run is moved in by the task that sorted it, and the runs that were are destroyed with the buffer.
+template<typename T>
+class sort_buffer
+{
+public:
+    sort_buffer(std::size_t size, const std::vector<std::size_t>& bounds)
+    :m_data{std::allocator<T>{}.allocate(size)}
+    ,m_size{size}
+    ,m_bounds{bounds}
+    ,m_constructed{std::make_unique<bool[]>(std::size(bounds) - 1)}
+    {
+
+    }
+
+    ~sort_buffer()
+    {
+        for(std::size_t run{}; run + 1 < std::size(m_bounds); ++run)
+        {
+            if(m_constructed[run])
+            {
+                std::destroy(m_data + m_bounds[run], m_data + m_bounds[run + 1]);
+            }
+        }
+
+        std::allocator<T>{}.deallocate(m_data, m_size);
+    }
+
+    sort_buffer(const sort_buffer&) = delete;
+    sort_buffer& operator=(const sort_buffer&) = delete;
+    sort_buffer(sort_buffer&&) = delete;
+    sort_buffer& operator=(sort_buffer&&) = delete;
+
+    //Each run is constructed by a single task, so the flags need no synchronization beyond waiting for the tasks
+    template<typename RandomIt>
+    void construct(std::size_t run, RandomIt source)
+    {
+        std::uninitialized_move(source + m_bounds[run], source + m_bounds[run + 1], m_data + m_bounds[run]);
+        m_constructed[run] = true;
+    }
+
+    T* get() const noexcept
+    {
+        return m_data;
+    }
+
+private:
+    T* m_data{};
+    std::size_t m_size{};
+    std::vector<std::size_t> m_bounds{};
+    std::unique_ptr<bool[]> m_constructed{};
+};
+
+template<typename InputIt1, typename InputIt2, typename OutputIt, typename Compare>
+void push_merge(thread_pool& pool, std::vector<std::future<void>>& futures, std::size_t pieces, InputIt1 first1, InputIt1 last1, InputIt2 first2, InputIt2 last2, OutputIt output, Compare comp)
+{
+    const auto size1{static_cast<std::size_t>(std::distance(first1, last1))};
+    const auto size2{static_cast<std::size_t>(std::distance(first2, last2))};
+    const std::size_t total{size1 + size2};
+
+    for(std::size_t piece{}; piece < pieces; ++piece)
+    {
+        const std::size_t begin{total * piece / pieces};
+        const std::size_t end  {total * (piece + 1) / pieces};
+
+        futures.emplace_back(pool.invoke([=]() mutable
+        {
+            const std::size_t i_begin{merge_co_rank(begin, first1, size1, first2, size2, comp)};
+            const std::size_t i_end  {merge_co_rank(end, first1, size1, first2, size2, comp)};
+            const std::size_t j_begin{begin - i_begin};
+            const std::size_t j_end  {end - i_end};
+
+            std::merge(first1 + i_begin, first1 + i_end, first2 + j_begin, first2 + j_end, output + begin, comp);
+        }));
+    }
+}
+
+template<typename InputIt, typename OutputIt>
+void push_move(thread_pool& pool, std::vector<std::future<void>>& futures, std::size_t pieces, InputIt first, InputIt last, OutputIt output)
+{
+    const auto total{static_cast<std::size_t>(std::distance(first, last))};
+
+    for(std::size_t piece{}; piece < pieces; ++piece)
+    {
+        const std::size_t begin{total * piece / pieces};
+        const std::size_t end  {total * (piece + 1) / pieces};
+
+        futures.emplace_back(pool.invoke([=]()
+        {
+            std::move(first + begin, first + end, output + begin);
+        }));
+    }
+}
+
+}
+
+template<typename RandomIt1, typename RandomIt2, typename RandomOutputIt, typename Compare = std::less<>>
+RandomOutputIt parallel_merge(thread_pool& pool, RandomIt1 first1, RandomIt1 last1, RandomIt2 first2, RandomIt2 last2, RandomOutputIt output, Compare comp = Compare{})
+{
+    const auto total{static_cast<std::size_t>(std::distance(first1, last1) + std::distance(first2, last2))};
+    const std::size_t pieces{std::min<std::size_t>(pool.thread_count(), total / impl::sort_grain_size)};
+
+    if(pieces <= 1 || this_worker::pool() == &pool)
+    {
+        return std::merge(first1, last1, first2, last2, output, comp);
+    }
+
+    std::vector<std::future<void>> futures{};
+    futures.reserve(pieces);
+
+    impl::push_merge(pool, futures, pieces, first1, last1, first2, last2, output, comp);
+    impl::wait_all(futures);
+
+    return output + total;
+}
+
+//Parallel merge sort: the range is split in one run per worker, each run is sorted with std::sort and moved to a buffer,
+//then runs are merged pairwise, each merge being itself split over the workers. value_type only needs to be move constructible and assignable, like for std::sort.
+//Falls back to std::sort for small ranges, and when called from one of the pool's own workers.
+template<typename RandomIt, typename Compare = std::less<>>
+void parallel_sort(thread_pool& pool, RandomIt first, RandomIt last, Compare comp = Compare{})
+{
+    using value_type = typename std::iterator_traits<RandomIt>::value_type;
+
+    const auto total{static_cast<std::size_t>(std::distance(first, last))};
+    const std::size_t thread_count{pool.thread_count()};
+    const std::size_t run_count{std::min<std::size_t>(thread_count, total / impl::sort_grain_size)};
+
+    if(run_count <= 1 || this_worker::pool() == &pool)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    std::vector<std::size_t> bounds{};
+    bounds.reserve(run_count + 1);
+
+    for(std::size_t run{}; run <= run_count; ++run)
+    {
+        bounds.emplace_back(total * run / run_count);
+    }
+
+    std::vector<std::future<void>> futures{};
+    futures.reserve(thread_count + run_count);
+
+    impl::sort_buffer<value_type> buffer{total, bounds};
+
+    for(std::size_t run{}; run < run_count; ++run)
+    {
+        futures.emplace_back(pool.invoke([first, begin = bounds[run], end = bounds[run + 1], comp, run, &buffer]() mutable
+        {
+            std::sort(first + begin, first + end, comp);
+            buffer.construct(run, first);
+        }));
+    }
+
+    impl::wait_all(futures);
+
+    const auto merge_round = [&](auto source, auto destination)
+    {
+        std::vector<std::size_t> next_bounds{};
+        next_bounds.reserve(std::size(bounds) / 2 + 1);
+
+        std::size_t run{};
+        for(; run + 2 < std::size(bounds); run += 2)
+        {
+            const std::size_t begin {bounds[run]};
+            const std::size_t middle{bounds[run + 1]};
+            const std::size_t end   {bounds[run + 2]};
+            const std::size_t pieces{std::max<std::size_t>(1, thread_count * (end - begin) / total)};
+
+            impl::push_merge(pool, futures, pieces, std::make_move_iterator(source + begin), std::make_move_iterator(source + middle),
+                             std::make_move_iterator(source + middle), std::make_move_iterator(source + end), destination + begin, comp);
+
+            next_bounds.emplace_back(begin);
+        }
+
+        if(run + 1 < std::size(bounds))
+        {
+            const std::size_t begin{bounds[run]};
+            const std::size_t end  {bounds[run + 1]};
+            const std::size_t pieces{std::max<std::size_t>(1, thread_count * (end - begin) / total)};
+
+            impl::push_move(pool, futures, pieces, source + begin, source + end, destination + begin);
+
+            next_bounds.emplace_back(begin);
+        }
+
+        next_bounds.emplace_back(total);
+
+        impl::wait_all(futures);
+        bounds = std::move(next_bounds);
+    };
+
+    bool in_buffer{true};
+    while(std::size(bounds) > 2)
+    {
+        if(in_buffer)
+        {
+            merge_round(buffer.get(), first);
+        }
+        else
+        {
+            merge_round(first, buffer.get());
+        }
+
+        in_buffer = !in_buffer;
+    }
+
+    if(in_buffer)
+    {
+        impl::push_move(pool, futures, thread_count, buffer.get(), buffer.get() + total, first);
+        impl::wait_all(futures);
+    }
+}
+
+//Execution policy like handle, the algorithms taking it run on the given pool instead of the standard library's own threads:
+//    nes::for_each(nes::par_on(pool), values, func);
+//Ranges are split in at most one piece per worker, each holding at least grain_size elements.
+//Like parallel_sort, the algorithms run sequentially on small ranges and when called from one of the pool's own workers.
+class thread_pool_policy
+{
+public:
+    explicit thread_pool_policy(thread_pool& pool, std::size_t grain_size = impl::algorithm_grain_size) noexcept
+    :m_pool{&pool}
+    ,m_grain_size{std::max<std::size_t>(grain_size, 1)}
+    {
+
+    }
+
+    thread_pool& pool() const noexcept
+    {
+        return *m_pool;
+    }
+
+    std::size_t grain_size() const noexcept
+    {
+        return m_grain_size;
+    }
+
+private:
+    thread_pool* m_pool{};
+    std::size_t m_grain_size{};
+};
+
+inline thread_pool_policy par_on(thread_pool& pool, std::size_t grain_size = impl::algorithm_grain_size) noexcept
+{
+    return thread_pool_policy{pool, grain_size};
+}
+
+namespace impl
+{
+
+inline std::size_t piece_count(const thread_pool_policy& policy, std::size_t total) noexcept
+{
+    if(this_worker::pool() == &policy.pool())
+    {
+        return 1;
+    }
+
+    return std::clamp<std::size_t>(total / policy.grain_size(), 1, policy.pool().thread_count());
+}
+
+//Calls func(piece, begin, end) for each piece of [0, total), pieces after the first one on the pool, then waits for them
+template<typename Func>
+void for_each_piece(const thread_pool_policy& policy, std::size_t pieces, std::size_t total, Func&& func)
+{
+    std::vector<std::future<void>> futures{};
+    futures.reserve(pieces);
+
+    for(std::size_t piece{1}; piece < pieces; ++piece)
+    {
+        futures.emplace_back(policy.pool().invoke([&func, piece, begin = total * piece / pieces, end = total * (piece + 1) / pieces]()
+        {
+            func(piece, begin, end);
+        }));
+    }
+
+    try
+    {
+        func(std::size_t{}, std::size_t{}, total / pieces);
+    }
+    catch(...)
+    {
+        for(auto& future : futures)
+        {
+            future.wait();
+        }
+
+        throw;
+    }
+
+    wait_all(futures);
+}
+
+}
+
+template<std::ranges::random_access_range Range, typename Func>
+    requires std::ranges::sized_range<Range>
+void for_each(const thread_pool_policy& policy, Range&& range, Func func)
+{
+    const auto first{std::ranges::begin(range)};
+    const auto total{static_cast<std::size_t>(std::ranges::size(range))};
+
+    impl::for_each_piece(policy, impl::piece_count(policy, total), total, [&](std::size_t, std::size_t begin, std::size_t end)
+    {
+        std::for_each(first + begin, first + end, std::ref(func));
+    });
+}
+
+template<std::ranges::random_access_range Range, std::random_access_iterator OutputIt, typename Func>
+    requires std::ranges::sized_range<Range>
+OutputIt transform(const thread_pool_policy& policy, Range&& range, OutputIt output, Func func)
+{
+    const auto first{std::ranges::begin(range)};
+    const auto total{static_cast<std::size_t>(std::ranges::size(range))};
+
+    impl::for_each_piece(policy, impl::piece_count(policy, total), total, [&](std::size_t, std::size_t begin, std::size_t end)
+    {
+        std::transform(first + begin, first + end, output + begin, std::ref(func));
+    });
+
+    return output + total;
+}
+
+template<std::ranges::random_access_range Range, typename Predicate>
+    requires std::ranges::sized_range<Range>
+std::ranges::range_difference_t<Range> count_if(const thread_pool_policy& policy, Range&& range, Predicate pred)
+{
+    const auto first{std::ranges::begin(range)};
+    const auto total{static_cast<std::size_t>(std::ranges::size(range))};
+    const std::size_t pieces{impl::piece_count(policy, total)};
+
+    std::vector<std::ranges::range_difference_t<Range>> counts(pieces);
+
+    impl::for_each_piece(policy, pieces, total, [&](std::size_t piece, std::size_t begin, std::size_t end)
+    {
+        counts[piece] = std::count_if(first + begin, first + end, std::ref(pred));
+    });
+
+    return std::accumulate(std::begin(counts), std::end(counts), std::ranges::range_difference_t<Range>{});
+}
+
+//Keeps the order of the input. pred is called once per element: a first pass stores its results and counts the matches of each piece,
+//then each piece copies its matches at the offset given by the counts of the pieces before it.
+template<std::ranges::random_access_range Range, std::random_access_iterator OutputIt, typename Predicate>
+    requires std::ranges::sized_range<Range>
+OutputIt copy_if(const thread_pool_policy& policy, Range&& range, OutputIt output, Predicate pred)
+{
+    const auto first{std::ranges::begin(range)};
+    const auto total{static_cast<std::size_t>(std::ranges::size(range))};
+    const std::size_t pieces{impl::piece_count(policy, total)};
+
+    if(pieces == 1)
+    {
+        return std::copy_if(first, first + total, output, std::ref(pred));
+    }
+
+    const auto matches{std::make_unique<bool[]>(total)};
+    std::vector<std::size_t> offsets(pieces + 1);
+
+    impl::for_each_piece(policy, pieces, total, [&](std::size_t piece, std::size_t begin, std::size_t end)
+    {
+        std::size_t count{};
+
+        for(std::size_t i{begin}; i < end; ++i)
+        {
+            matches[i] = static_cast<bool>(std::invoke(pred, first[i]));
+            count += matches[i];
+        }
+
+        offsets[piece + 1] = count;
+    });
+
+    std::partial_sum(std::begin(offsets), std::end(offsets), std::begin(offsets));
+
+    impl::for_each_piece(policy, pieces, total, [&](std::size_t piece, std::size_t begin, std::size_t end)
+    {
+        auto current{output + offsets[piece]};
+
+        for(std::size_t i{begin}; i < end; ++i)
+        {
+            if(matches[i])
+            {
+                *current++ = first[i];
+            }
+        }
+    });
+
+    return output + offsets.back();
+}
+
+//Returns the first match, like std::find_if. Pieces stop as soon as a match was found before their current position.
+template<std::ranges::random_access_range Range, typename Predicate>
+    requires std::ranges::sized_range<Range>
+std::ranges::borrowed_iterator_t<Range> find_if(const thread_pool_policy& policy, Range&& range, Predicate pred)
+{
+    const auto first{std::ranges::begin(range)};
+    const auto total{static_cast<std::size_t>(std::ranges::size(range))};
+
+    std::atomic<std::size_t> found{total};
+
+    impl::for_each_piece(policy, impl::piece_count(policy, total), total, [&](std::size_t, std::size_t begin, std::size_t end)
+    {
+        for(std::size_t i{begin}; i < end && i < found.load(std::memory_order_relaxed); ++i)
+        {
+            if(std::invoke(pred, first[i]))
+            {
+                std::size_t current{found.load(std::memory_order_relaxed)};
+
+                //Another piece may have found a later match first
+                while(i < current && !found.compare_exchange_weak(current, i, std::memory_order_relaxed))
+                {
+
+                }
+
+                return;
+            }
+        }
+    });
+
+    return first + found.load(std::memory_order_relaxed);
+}
+
+}
+
+#endif
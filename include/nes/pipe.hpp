@@ -42,6 +42,7 @@
     #define NES_POSIX_PIPE
     #include <unistd.h>
     #include <fcntl.h>
+    #include <string.h>
     #include <sys/types.h>
     #include <sys/stat.h>
 #else
@@ -50,11 +51,16 @@
 
 #include <vector>
 #include <algorithm>
+#include <limits>
 #include <streambuf>
 #include <istream>
 #include <ostream>
 #include <memory>
 #include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
 #include <utility>
 
 #if defined(NES_WIN32_PIPE)
@@ -64,12 +70,31 @@ namespace nes
 
 inline constexpr const char pipe_root[] = "\\\\.\\pipe\\";
 
+struct pipe_options
+{
+    std::size_t buffer_size{1024}; //Size of the user-space buffer of each stream, in characters, 0 is treated as 1
+    std::size_t pipe_capacity{}; //Pipe buffer size in bytes, given to the system when the pipe is created, 0 keeps the system default
+};
+
+enum class pipe_io_status : std::uint32_t
+{
+    ok = 0,
+    would_block = 1, //The pipe is in non-blocking mode and is empty, or full
+    closed = 2 //The other end of the pipe is closed
+};
+
+struct pipe_io_result
+{
+    std::size_t count{}; //Number of characters transferred
+    pipe_io_status status{};
+};
+
 template<typename CharT, typename Traits>
 class basic_pipe_istream;
 template<typename CharT, typename Traits>
 class basic_pipe_ostream;
 template<typename CharT = char, typename Traits = std::char_traits<CharT>>
-std::pair<basic_pipe_istream<CharT, Traits>, basic_pipe_ostream<CharT, Traits>> make_anonymous_pipe();
+std::pair<basic_pipe_istream<CharT, Traits>, basic_pipe_ostream<CharT, Traits>> make_anonymous_pipe(const pipe_options& options = pipe_options{});
 
 template<typename CharT, typename Traits = std::char_traits<CharT>>
 class basic_pipe_streambuf : public std::basic_streambuf<CharT, Traits>
@@ -83,14 +108,16 @@ public:
     using int_type     = typename Traits::int_type;
     using pos_type     = typename Traits::pos_type;
     using off_type     = typename Traits::off_type;
+    using native_handle_type = HANDLE;
 
 public:
-    static constexpr std::size_t buf_size{1024};
+    static constexpr std::size_t buf_size{1024}; //Default buffer size
 
 public:
     basic_pipe_streambuf() = default;
 
-    explicit basic_pipe_streambuf(const std::string& name, std::ios_base::openmode mode)
+    explicit basic_pipe_streambuf(const std::string& name, std::ios_base::openmode mode, std::size_t buffer_size = buf_size)
+    :m_buffer_size{std::max<std::size_t>(buffer_size, 1)}
     {
         open(name, mode);
     }
@@ -106,6 +133,7 @@ public:
     basic_pipe_streambuf(basic_pipe_streambuf&& other) noexcept
     :parent_type{other}
     ,m_buffer{std::move(other.m_buffer)}
+    ,m_buffer_size{other.m_buffer_size}
     ,m_handle{std::exchange(other.m_handle, INVALID_HANDLE_VALUE)}
     ,m_mode{std::exchange(other.m_mode, std::ios_base::openmode{})}
     {
@@ -116,6 +144,7 @@ public:
     {
         parent_type::operator=(other);
         m_buffer = std::move(other.m_buffer);
+        m_buffer_size = other.m_buffer_size;
         m_handle = std::exchange(other.m_handle, m_handle);
         m_mode = std::exchange(other.m_mode, m_mode);
 
@@ -138,7 +167,9 @@ public:
             {
                 native_mode = mode & std::ios_base::in ? PIPE_ACCESS_INBOUND : PIPE_ACCESS_OUTBOUND;
 
-                handle = CreateNamedPipeW(std::data(native_name), native_mode, PIPE_READMODE_BYTE | PIPE_WAIT, 1, buf_size, buf_size, 0, nullptr);
+                const auto size{static_cast<DWORD>(m_buffer_size * sizeof(char_type))};
+
+                handle = CreateNamedPipeW(std::data(native_name), native_mode, PIPE_READMODE_BYTE | PIPE_WAIT, 1, size, size, 0, nullptr);
                 if(handle == INVALID_HANDLE_VALUE)
                     return false;
 
@@ -150,10 +181,9 @@ public:
             }
         }
 
-        m_buffer.resize(buf_size);
-        parent_type::setp(std::data(m_buffer), std::data(m_buffer) + buf_size);
         m_handle = handle;
         m_mode = mode;
+        reset_buffer();
 
         return true;
     }
@@ -176,16 +206,137 @@ public:
         }
     }
 
+    native_handle_type native_handle() const noexcept
+    {
+        return m_handle;
+    }
+
+    std::size_t buffer_size() const noexcept
+    {
+        return m_buffer_size;
+    }
+
+    //Larger buffers need less system calls to stream the same amount of data, a size of 0 is treated as 1.
+    //Pending output is flushed first, if that fails nothing changes and false is returned. Pending input is kept and read before the next refill.
+    bool set_buffer_size(std::size_t size)
+    {
+        if(is_open() && (m_mode & std::ios_base::out) && sync() != 0)
+            return false;
+
+        m_buffer_size = std::max<std::size_t>(size, 1);
+
+        if(is_open())
+            reset_buffer();
+
+        return true;
+    }
+
+    //Size of the pipe's system buffer. It can only be chosen when the pipe is created, with pipe_options.
+    std::size_t pipe_capacity() const noexcept
+    {
+        DWORD output_size{};
+        DWORD input_size{};
+        if(!GetNamedPipeInfo(m_handle, nullptr, &output_size, &input_size, nullptr))
+            return 0;
+
+        return static_cast<std::size_t>(std::max(output_size, input_size));
+    }
+
+    //Always returns 0, Windows can not resize an existing pipe
+    std::size_t set_pipe_capacity(std::size_t) noexcept
+    {
+        return 0;
+    }
+
+    //In non-blocking mode, read_some and write_some return would_block instead of waiting.
+    //The stream interface (operator>>, read, write, ...) must not be used meanwhile, it would see would_block as an error.
+    void set_non_blocking(bool enabled)
+    {
+        DWORD mode{static_cast<DWORD>(PIPE_READMODE_BYTE | (enabled ? PIPE_NOWAIT : PIPE_WAIT))};
+        if(!SetNamedPipeHandleState(m_handle, &mode, nullptr, nullptr))
+            throw std::runtime_error{"Failed to change pipe blocking mode."};
+
+        m_non_blocking = enabled;
+    }
+
+    bool is_non_blocking() const noexcept
+    {
+        return m_non_blocking;
+    }
+
+    //Reads at most count characters, buffered ones first, with at most one system call
+    pipe_io_result read_some(char_type* data, std::size_t count)
+    {
+        assert(m_mode & std::ios_base::in && "Read operation on a write only pipe.");
+
+        const auto buffered{std::min(count, static_cast<std::size_t>(parent_type::egptr() - parent_type::gptr()))};
+        if(buffered != 0)
+        {
+            std::copy(parent_type::gptr(), parent_type::gptr() + buffered, data);
+            parent_type::gbump(static_cast<int>(buffered));
+
+            return pipe_io_result{buffered, pipe_io_status::ok};
+        }
+
+        DWORD readed{};
+        if(!ReadFile(m_handle, reinterpret_cast<CHAR*>(data), static_cast<DWORD>(std::min<std::size_t>(count * sizeof(char_type), std::numeric_limits<DWORD>::max())), &readed, nullptr))
+        {
+            if(GetLastError() == ERROR_NO_DATA)
+                return pipe_io_result{0, pipe_io_status::would_block};
+
+            if(GetLastError() == ERROR_BROKEN_PIPE)
+                return pipe_io_result{0, pipe_io_status::closed};
+
+            throw std::runtime_error{"Failed to read from pipe."};
+        }
+
+        return pipe_io_result{static_cast<std::size_t>(readed) / sizeof(char_type), pipe_io_status::ok};
+    }
+
+    //Writes at most count characters with at most one system call, after the characters buffered by the stream interface.
+    //Returns would_block with a count of 0 as long as those buffered characters can not all be written.
+    pipe_io_result write_some(const char_type* data, std::size_t count)
+    {
+        assert(m_mode & std::ios_base::out && "Write operation on a read only pipe.");
+
+        if(parent_type::pptr() != parent_type::pbase())
+        {
+            if(const auto status{write_pending()}; status != pipe_io_status::ok)
+                return pipe_io_result{0, status};
+        }
+
+        return write_native(reinterpret_cast<const CHAR*>(data), count * sizeof(char_type));
+    }
+
 private:
     friend class process;
-    friend std::pair<basic_pipe_istream<char_type, traits_type>, basic_pipe_ostream<char_type, traits_type>> make_anonymous_pipe<char_type, traits_type>();
+    friend std::pair<basic_pipe_istream<char_type, traits_type>, basic_pipe_ostream<char_type, traits_type>> make_anonymous_pipe<char_type, traits_type>(const pipe_options&);
 
-    basic_pipe_streambuf(HANDLE handle, std::ios_base::openmode mode)
-    :m_handle{handle}
+    basic_pipe_streambuf(HANDLE handle, std::ios_base::openmode mode, std::size_t buffer_size = buf_size)
+    :m_buffer_size{std::max<std::size_t>(buffer_size, 1)}
+    ,m_handle{handle}
     ,m_mode{mode}
     {
-        m_buffer.resize(buf_size);
-        parent_type::setp(std::data(m_buffer), std::data(m_buffer) + buf_size);
+        reset_buffer();
+    }
+
+    void reset_buffer()
+    {
+        if(m_mode & std::ios_base::out)
+        {
+            m_buffer.resize(m_buffer_size);
+            parent_type::setp(std::data(m_buffer), std::data(m_buffer) + m_buffer_size);
+        }
+        else
+        {
+            const auto pending{static_cast<std::size_t>(parent_type::egptr() - parent_type::gptr())};
+
+            std::vector<CharT> buffer(std::max(m_buffer_size, pending));
+            std::copy(parent_type::gptr(), parent_type::egptr(), std::data(buffer));
+
+            m_buffer = std::move(buffer);
+            parent_type::setg(std::data(m_buffer), std::data(m_buffer), std::data(m_buffer) + pending);
+        }
     }
 
 protected:
@@ -195,11 +346,10 @@ protected:
         {
             const std::ptrdiff_t count{parent_type::pptr() - parent_type::pbase()};
 
-            DWORD written{};
-            if(!WriteFile(m_handle, reinterpret_cast<const CHAR*>(std::data(m_buffer)), static_cast<DWORD>(count)* sizeof(char_type), &written, nullptr))
+            if(!write_all(std::data(m_buffer), static_cast<std::size_t>(count)))
                 return -1;
 
-            parent_type::setp(std::data(m_buffer), std::data(m_buffer) + buf_size);
+            parent_type::setp(std::data(m_buffer), std::data(m_buffer) + m_buffer_size);
         }
 
         return 0;
@@ -209,15 +359,10 @@ protected:
     {
         assert(m_mode & std::ios_base::out && "Write operation on a read only pipe.");
 
-        if(traits_type::eq_int_type(c, traits_type::eof()))
-        {
-            DWORD written{};
-            if(!WriteFile(m_handle, reinterpret_cast<const CHAR*>(std::data(m_buffer)), static_cast<DWORD>(buf_size) * sizeof(char_type), &written, nullptr))
-                return traits_type::eof();
+        if(sync() != 0)
+            return traits_type::eof();
 
-            parent_type::setp(std::data(m_buffer), std::data(m_buffer) + buf_size);
-        }
-        else
+        if(!traits_type::eq_int_type(c, traits_type::eof()))
         {
             *parent_type::pptr() = traits_type::to_char_type(c);
             parent_type::pbump(1);
@@ -226,15 +371,23 @@ protected:
         return traits_type::not_eof(c);
     }
 
+    //Small writes are gathered in the buffer, larger ones flush it and go directly to the pipe
     virtual std::streamsize xsputn(const char_type* s, std::streamsize count) override
     {
         assert(m_mode & std::ios_base::out && "Write operation on a read only pipe.");
 
-        DWORD written{};
-        if(!WriteFile(m_handle, reinterpret_cast<const CHAR*>(s), static_cast<DWORD>(count) * sizeof(char_type), &written, nullptr))
+        if(count < parent_type::epptr() - parent_type::pptr())
+        {
+            std::copy(s, s + count, parent_type::pptr());
+            parent_type::pbump(static_cast<int>(count));
+
+            return count;
+        }
+
+        if(sync() != 0 || !write_all(s, static_cast<std::size_t>(count)))
             return 0;
 
-        return static_cast<std::streamsize>(written);
+        return count;
     }
 
     virtual int_type underflow() override
@@ -244,7 +397,7 @@ protected:
         if(parent_type::gptr() == parent_type::egptr())
         {
             DWORD readed{};
-            if(!ReadFile(m_handle, reinterpret_cast<CHAR*>(std::data(m_buffer)), static_cast<DWORD>(buf_size * sizeof(char_type)), &readed, nullptr) || readed == 0)
+            if(!ReadFile(m_handle, reinterpret_cast<CHAR*>(std::data(m_buffer)), static_cast<DWORD>(m_buffer_size * sizeof(char_type)), &readed, nullptr) || readed == 0)
                 return traits_type::eof();
 
             parent_type::setg(std::data(m_buffer), std::data(m_buffer), std::data(m_buffer) + (readed / sizeof(char_type)));
@@ -253,15 +406,107 @@ protected:
         return traits_type::to_int_type(*parent_type::gptr());
     }
 
+    //Small reads are served from the buffer, large ones read directly once it is empty
     virtual std::streamsize xsgetn(char_type* s, std::streamsize count) override
     {
         assert(m_mode & std::ios_base::in && "Read operation on a write only pipe.");
 
-        DWORD readed{};
-        if(!ReadFile(m_handle, reinterpret_cast<CHAR*>(s), static_cast<DWORD>(count) * sizeof(char_type), &readed, nullptr))
-            return 0;
+        std::streamsize done{};
+
+        while(done < count)
+        {
+            const std::streamsize available{std::min<std::streamsize>(count - done, parent_type::egptr() - parent_type::gptr())};
 
-        return static_cast<std::streamsize>(readed / sizeof(char_type));
+            if(available > 0)
+            {
+                std::copy(parent_type::gptr(), parent_type::gptr() + available, s + done);
+                parent_type::gbump(static_cast<int>(available));
+                done += available;
+            }
+            else if(static_cast<std::size_t>(count - done) >= m_buffer_size)
+            {
+                const auto size{std::min<std::size_t>(static_cast<std::size_t>(count - done) * sizeof(char_type), std::numeric_limits<DWORD>::max())};
+
+                DWORD readed{};
+                if(!ReadFile(m_handle, reinterpret_cast<CHAR*>(s + done), static_cast<DWORD>(size), &readed, nullptr) || readed == 0)
+                    break;
+
+                done += static_cast<std::streamsize>(readed / sizeof(char_type));
+            }
+            else if(traits_type::eq_int_type(underflow(), traits_type::eof()))
+            {
+                break;
+            }
+        }
+
+        return done;
+    }
+
+private:
+    //A pipe in PIPE_NOWAIT mode writes nothing when it does not have enough room
+    pipe_io_result write_native(const CHAR* data, std::size_t size)
+    {
+        DWORD written{};
+        if(!WriteFile(m_handle, data, static_cast<DWORD>(std::min<std::size_t>(size, std::numeric_limits<DWORD>::max())), &written, nullptr))
+        {
+            if(GetLastError() == ERROR_NO_DATA || GetLastError() == ERROR_BROKEN_PIPE)
+                return pipe_io_result{0, pipe_io_status::closed};
+
+            throw std::runtime_error{"Failed to write to pipe."};
+        }
+
+        if(written == 0 && size != 0)
+            return pipe_io_result{0, pipe_io_status::would_block};
+
+        return pipe_io_result{static_cast<std::size_t>(written) / sizeof(char_type), pipe_io_status::ok};
+    }
+
+    //Writes as much of the put area as possible, and moves what remains at its beginning
+    pipe_io_status write_pending()
+    {
+        const auto pending{static_cast<std::size_t>(parent_type::pptr() - parent_type::pbase())};
+        std::size_t done{};
+        pipe_io_status status{pipe_io_status::ok};
+
+        while(done < pending)
+        {
+            const auto result{write_native(reinterpret_cast<const CHAR*>(parent_type::pbase() + done), (pending - done) * sizeof(char_type))};
+            if(result.status != pipe_io_status::ok)
+            {
+                status = result.status;
+                break;
+            }
+
+            done += result.count;
+        }
+
+        //Shifts the rest to the front, when nothing was written the put area is left as is
+        if(done != 0)
+        {
+            std::copy(parent_type::pbase() + done, parent_type::pptr(), std::data(m_buffer));
+            parent_type::setp(std::data(m_buffer), std::data(m_buffer) + m_buffer_size);
+            parent_type::pbump(static_cast<int>(pending - done));
+        }
+
+        return status;
+    }
+
+    bool write_all(const char_type* data, std::size_t count)
+    {
+        const CHAR* current{reinterpret_cast<const CHAR*>(data)};
+        std::size_t remaining{count * sizeof(char_type)};
+
+        while(remaining != 0)
+        {
+            DWORD written{};
+            if(!WriteFile(m_handle, current, static_cast<DWORD>(std::min<std::size_t>(remaining, std::numeric_limits<DWORD>::max())), &written, nullptr))
+                return false;
+
+            current += written;
+            remaining -= static_cast<std::size_t>(written);
+        }
+
+        return true;
     }
 
 private:
@@ -285,8 +530,10 @@ private:
 
 private:
     std::vector<CharT> m_buffer{};
+    std::size_t m_buffer_size{buf_size};
     HANDLE m_handle{INVALID_HANDLE_VALUE};
     std::ios_base::openmode m_mode{};
+    bool m_non_blocking{};
 };
 
 
@@ -358,7 +605,7 @@ public:
 
 private:
     friend class process;
-    friend std::pair<basic_pipe_istream<char_type, traits_type>, basic_pipe_ostream<char_type, traits_type>> make_anonymous_pipe<char_type, traits_type>();
+    friend std::pair<basic_pipe_istream<char_type, traits_type>, basic_pipe_ostream<char_type, traits_type>> make_anonymous_pipe<char_type, traits_type>(const pipe_options&);
 
     basic_pipe_istream(basic_pipe_streambuf<char_type, traits_type> buffer)
     :parent_type{nullptr}
@@ -439,7 +686,7 @@ public:
 
 private:
     friend class process;
-    friend std::pair<basic_pipe_istream<char_type, traits_type>, basic_pipe_ostream<char_type, traits_type>> make_anonymous_pipe<char_type, traits_type>();
+    friend std::pair<basic_pipe_istream<char_type, traits_type>, basic_pipe_ostream<char_type, traits_type>> make_anonymous_pipe<char_type, traits_type>(const pipe_options&);
 
     basic_pipe_ostream(basic_pipe_streambuf<char_type, traits_type> buffer)
     :parent_type{nullptr}
@@ -453,16 +700,16 @@ private:
 };
 
 template<typename CharT, typename Traits>
-std::pair<basic_pipe_istream<CharT, Traits>, basic_pipe_ostream<CharT, Traits>> make_anonymous_pipe()
+std::pair<basic_pipe_istream<CharT, Traits>, basic_pipe_ostream<CharT, Traits>> make_anonymous_pipe(const pipe_options& options)
 {
     HANDLE input{};
     HANDLE output{};
 
-    if(!CreatePipe(&input, &output, nullptr, 0))
+    if(!CreatePipe(&input, &output, nullptr, static_cast<DWORD>(options.pipe_capacity)))
         throw std::runtime_error{"Failed to create pipe"};
 
-    return std::make_pair(basic_pipe_istream<CharT, Traits>{basic_pipe_streambuf<CharT, Traits>{input, std::ios_base::in}},
-                          basic_pipe_ostream<CharT, Traits>{basic_pipe_streambuf<CharT, Traits>{output, std::ios_base::out}});
+    return std::make_pair(basic_pipe_istream<CharT, Traits>{basic_pipe_streambuf<CharT, Traits>{input, std::ios_base::in, options.buffer_size}},
+                          basic_pipe_ostream<CharT, Traits>{basic_pipe_streambuf<CharT, Traits>{output, std::ios_base::out, options.buffer_size}});
 }
 
 using pipe_streambuf = basic_pipe_streambuf<char>;
@@ -479,12 +726,63 @@ namespace nes
 
 inline constexpr const char pipe_root[] = "/tmp/";
 
+struct pipe_options
+{
+    std::size_t buffer_size{1024}; //Size of the user-space buffer of each stream, in characters, 0 is treated as 1
+    std::size_t pipe_capacity{}; //Kernel pipe capacity in bytes, set with F_SETPIPE_SZ on Linux, 0 keeps the system default
+};
+
+enum class pipe_io_status : std::uint32_t
+{
+    ok = 0,
+    would_block = 1, //The pipe is in non-blocking mode and is empty, or full
+    closed = 2 //The other end of the pipe is closed
+};
+
+struct pipe_io_result
+{
+    std::size_t count{}; //Number of characters transferred
+    pipe_io_status status{};
+};
+
 template<typename CharT, typename Traits>
 class basic_pipe_istream;
 template<typename CharT, typename Traits>
 class basic_pipe_ostream;
 template<typename CharT = char, typename Traits = std::char_traits<CharT>>
-std::pair<basic_pipe_istream<CharT, Traits>, basic_pipe_ostream<CharT, Traits>> make_anonymous_pipe();
+std::pair<basic_pipe_istream<CharT, Traits>, basic_pipe_ostream<CharT, Traits>> make_anonymous_pipe(const pipe_options& options = pipe_options{});
+
+namespace impl
+{
+
+//Returns the new capacity, rounded up by the system, or 0 if it could not be changed
+inline std::size_t set_pipe_capacity(int handle [[maybe_unused]], std::size_t capacity [[maybe_unused]]) noexcept
+{
+#if defined(F_SETPIPE_SZ)
+    const int output{fcntl(handle, F_SETPIPE_SZ, static_cast<int>(std::min<std::size_t>(capacity, std::numeric_limits<int>::max())))};
+    if(output < 0)
+        return 0;
+
+    return static_cast<std::size_t>(output);
+#else
+    return 0;
+#endif
+}
+
+inline std::size_t get_pipe_capacity(int handle [[maybe_unused]]) noexcept
+{
+#if defined(F_GETPIPE_SZ)
+    const int output{fcntl(handle, F_GETPIPE_SZ)};
+    if(output < 0)
+        return 0;
+
+    return static_cast<std::size_t>(output);
+#else
+    return 0;
+#endif
+}
+
+}
 
 template<typename CharT, typename Traits = std::char_traits<CharT>>
 class basic_pipe_streambuf : public std::basic_streambuf<CharT, Traits>
@@ -498,15 +796,17 @@ public:
     using int_type     = typename Traits::int_type;
     using pos_type     = typename Traits::pos_type;
     using off_type     = typename Traits::off_type;
+    using native_handle_type = int;
 
 public:
-    static constexpr std::size_t buf_size{1024};
+    static constexpr std::size_t buf_size{1024}; //Default buffer size
 
 public:
     basic_pipe_streambuf() = default;
 
-    explicit basic_pipe_streambuf(const std::string& name, std::ios_base::openmode mode)
+    explicit basic_pipe_streambuf(const std::string& name, std::ios_base::openmode mode, std::size_t buffer_size = buf_size)
     :parent_type{nullptr}
+    ,m_buffer_size{std::max<std::size_t>(buffer_size, 1)}
     {
         open(name, mode);
     }
@@ -522,6 +822,7 @@ public:
     basic_pipe_streambuf(basic_pipe_streambuf&& other) noexcept
     :parent_type{std::move(other)}
     ,m_buffer{std::move(other.m_buffer)}
+    ,m_buffer_size{other.m_buffer_size}
     ,m_handle{std::exchange(other.m_handle, 0)}
     ,m_mode{std::exchange(other.m_mode, std::ios_base::openmode{})}
     {
@@ -532,6 +833,7 @@ public:
     {
         parent_type::operator=(std::move(other));
         m_buffer = std::move(other.m_buffer);
+        m_buffer_size = other.m_buffer_size;
         m_handle = std::exchange(other.m_handle, m_handle);
         m_mode = std::exchange(other.m_mode, m_mode);
 
@@ -553,10 +855,9 @@ public:
         if(handle < 0)
             return false;
 
-        m_buffer.resize(buf_size);
-        parent_type::setp(std::data(m_buffer), std::data(m_buffer) + buf_size);
         m_handle = handle;
         m_mode = mode;
+        reset_buffer();
 
         return true;
     }
@@ -579,16 +880,153 @@ public:
         }
     }
 
+    native_handle_type native_handle() const noexcept
+    {
+        return m_handle;
+    }
+
+    std::size_t buffer_size() const noexcept
+    {
+        return m_buffer_size;
+    }
+
+    //Larger buffers need less system calls to stream the same amount of data, a size of 0 is treated as 1.
+    //Pending output is flushed first, if that fails nothing changes and false is returned. Pending input is kept and read before the next refill.
+    bool set_buffer_size(std::size_t size)
+    {
+        if(is_open() && (m_mode & std::ios_base::out) && sync() != 0)
+            return false;
+
+        m_buffer_size = std::max<std::size_t>(size, 1);
+
+        if(is_open())
+            reset_buffer();
+
+        return true;
+    }
+
+    //Kernel capacity of the pipe, shared by both of its ends. Only supported on Linux, returns 0 elsewhere.
+    std::size_t pipe_capacity() const noexcept
+    {
+        return impl::get_pipe_capacity(m_handle);
+    }
+
+    //Returns the new capacity, rounded up to a page size multiple by the system, or 0 if it could not be changed.
+    //Unprivileged processes are limited to /proc/sys/fs/pipe-max-size.
+    std::size_t set_pipe_capacity(std::size_t capacity) noexcept
+    {
+        return impl::set_pipe_capacity(m_handle, capacity);
+    }
+
+    //In non-blocking mode, read_some and write_some return would_block instead of waiting.
+    //The stream interface (operator>>, read, write, ...) must not be used meanwhile, it would see would_block as an error.
+    void set_non_blocking(bool enabled)
+    {
+        const int flags{fcntl(m_handle, F_GETFL)};
+        if(flags < 0 || fcntl(m_handle, F_SETFL, enabled ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) < 0)
+            throw std::runtime_error{"Failed to change pipe blocking mode. " + std::string{strerror(errno)}};
+    }
+
+    bool is_non_blocking() const
+    {
+        const int flags{fcntl(m_handle, F_GETFL)};
+        if(flags < 0)
+            throw std::runtime_error{"Failed to get pipe blocking mode. " + std::string{strerror(errno)}};
+
+        return flags & O_NONBLOCK;
+    }
+
+    //Reads at most count characters, buffered ones first, with at most one system call
+    pipe_io_result read_some(char_type* data, std::size_t count)
+    {
+        assert(m_mode & std::ios_base::in && "Read operation on a write only pipe.");
+
+        const auto buffered{std::min(count, static_cast<std::size_t>(parent_type::egptr() - parent_type::gptr()))};
+        if(buffered != 0)
+        {
+            std::copy(parent_type::gptr(), parent_type::gptr() + buffered, data);
+            parent_type::gbump(static_cast<int>(buffered));
+
+            return pipe_io_result{buffered, pipe_io_status::ok};
+        }
+
+        while(true)
+        {
+            const auto readed = read(m_handle, reinterpret_cast<char*>(data), count * sizeof(char_type));
+            if(readed > 0)
+                return pipe_io_result{static_cast<std::size_t>(readed) / sizeof(char_type), pipe_io_status::ok};
+
+            if(readed == 0)
+                return pipe_io_result{0, pipe_io_status::closed};
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return pipe_io_result{0, pipe_io_status::would_block};
+
+            if(errno != EINTR)
+                throw std::runtime_error{"Failed to read from pipe. " + std::string{strerror(errno)}};
+        }
+    }
+
+    //Writes at most count characters with at most one system call, after the characters buffered by the stream interface.
+    //Returns would_block with a count of 0 as long as those buffered characters can not all be written.
+    //Writing to a pipe whose read end is closed raises SIGPIPE, which terminates the process by default:
+    //closed is only returned if the process ignores or blocks SIGPIPE, e.g. with signal(SIGPIPE, SIG_IGN).
+    pipe_io_result write_some(const char_type* data, std::size_t count)
+    {
+        assert(m_mode & std::ios_base::out && "Write operation on a read only pipe.");
+
+        if(parent_type::pptr() != parent_type::pbase())
+        {
+            if(const auto status{write_pending()}; status != pipe_io_status::ok)
+                return pipe_io_result{0, status};
+        }
+
+        while(true)
+        {
+            const auto written = write(m_handle, reinterpret_cast<const char*>(data), count * sizeof(char_type));
+            if(written >= 0)
+                return pipe_io_result{static_cast<std::size_t>(written) / sizeof(char_type), pipe_io_status::ok};
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return pipe_io_result{0, pipe_io_status::would_block};
+
+            if(errno == EPIPE)
+                return pipe_io_result{0, pipe_io_status::closed};
+
+            if(errno != EINTR)
+                throw std::runtime_error{"Failed to write to pipe. " + std::string{strerror(errno)}};
+        }
+    }
+
 private:
     friend class process;
-    friend std::pair<basic_pipe_istream<char_type, traits_type>, basic_pipe_ostream<char_type, traits_type>> make_anonymous_pipe<char_type, traits_type>();
+    friend std::pair<basic_pipe_istream<char_type, traits_type>, basic_pipe_ostream<char_type, traits_type>> make_anonymous_pipe<char_type, traits_type>(const pipe_options&);
 
-    basic_pipe_streambuf(int handle, std::ios_base::openmode mode)
-    :m_handle{handle}
+    basic_pipe_streambuf(int handle, std::ios_base::openmode mode, std::size_t buffer_size = buf_size)
+    :m_buffer_size{std::max<std::size_t>(buffer_size, 1)}
+    ,m_handle{handle}
     ,m_mode{mode}
     {
-        m_buffer.resize(buf_size);
-        parent_type::setp(std::data(m_buffer), std::data(m_buffer) + buf_size);
+        reset_buffer();
+    }
+
+    void reset_buffer()
+    {
+        if(m_mode & std::ios_base::out)
+        {
+            m_buffer.resize(m_buffer_size);
+            parent_type::setp(std::data(m_buffer), std::data(m_buffer) + m_buffer_size);
+        }
+        else
+        {
+            const auto pending{static_cast<std::size_t>(parent_type::egptr() - parent_type::gptr())};
+
+            std::vector<CharT> buffer(std::max(m_buffer_size, pending));
+            std::copy(parent_type::gptr(), parent_type::egptr(), std::data(buffer));
+
+            m_buffer = std::move(buffer);
+            parent_type::setg(std::data(m_buffer), std::data(m_buffer), std::data(m_buffer) + pending);
+        }
     }
 
 protected:
@@ -598,10 +1036,10 @@ protected:
         {
             const std::ptrdiff_t count{parent_type::pptr() - parent_type::pbase()};
 
-            if(write(m_handle, reinterpret_cast<const char*>(std::data(m_buffer)), count * sizeof(char_type)) < 0)
+            if(!write_all(std::data(m_buffer), static_cast<std::size_t>(count)))
                 return -1;
 
-            parent_type::setp(std::data(m_buffer), std::data(m_buffer) + buf_size);
+            parent_type::setp(std::data(m_buffer), std::data(m_buffer) + m_buffer_size);
         }
 
         return 0;
@@ -611,14 +1049,10 @@ protected:
     {
         assert(m_mode & std::ios_base::out && "Write operation on a read only pipe.");
 
-        if(traits_type::eq_int_type(c, traits_type::eof()))
-        {
-            if(write(m_handle, reinterpret_cast<const char*>(std::data(m_buffer)), std::size(m_buffer) * sizeof(char_type)))
-                return traits_type::eof();
+        if(sync() != 0)
+            return traits_type::eof();
 
-            parent_type::setp(std::data(m_buffer), std::data(m_buffer) + buf_size);
-        }
-        else
+        if(!traits_type::eq_int_type(c, traits_type::eof()))
         {
             *parent_type::pptr() = traits_type::to_char_type(c);
             parent_type::pbump(1);
@@ -627,15 +1061,23 @@ protected:
         return traits_type::not_eof(c);
     }
 
+    //Small writes are gathered in the buffer, larger ones flush it and go directly to the pipe
     virtual std::streamsize xsputn(const char_type* s, std::streamsize count) override
     {
         assert(m_mode & std::ios_base::out && "Write operation on a read only pipe.");
 
-        const auto written = write(m_handle, reinterpret_cast<const char*>(s), count * sizeof(char_type));
-        if(written < 0)
+        if(count < parent_type::epptr() - parent_type::pptr())
+        {
+            std::copy(s, s + count, parent_type::pptr());
+            parent_type::pbump(static_cast<int>(count));
+
+            return count;
+        }
+
+        if(sync() != 0 || !write_all(s, static_cast<std::size_t>(count)))
             return 0;
 
-        return static_cast<std::streamsize>(written);
+        return count;
     }
 
     virtual int_type underflow() override
@@ -644,7 +1086,7 @@ protected:
 
         if(parent_type::gptr() == parent_type::egptr())
         {
-            const auto readed = read(m_handle, reinterpret_cast<char*>(std::data(m_buffer)), buf_size * sizeof(char_type));
+            const auto readed = read(m_handle, reinterpret_cast<char*>(std::data(m_buffer)), m_buffer_size * sizeof(char_type));
             if(readed <= 0)
                 return traits_type::eof();
 
@@ -654,19 +1096,110 @@ protected:
         return traits_type::to_int_type(*parent_type::gptr());
     }
 
+    //Small reads are served from the buffer, large ones read directly once it is empty
     virtual std::streamsize xsgetn(char_type* s, std::streamsize count) override
     {
         assert(m_mode & std::ios_base::in && "Read operation on a write only pipe.");
 
-        const auto readed = read(m_handle, reinterpret_cast<char*>(s), count * sizeof(char_type));
-        if(readed < 0)
-            return 0;
+        std::streamsize done{};
+
+        while(done < count)
+        {
+            const std::streamsize available{std::min<std::streamsize>(count - done, parent_type::egptr() - parent_type::gptr())};
+
+            if(available > 0)
+            {
+                std::copy(parent_type::gptr(), parent_type::gptr() + available, s + done);
+                parent_type::gbump(static_cast<int>(available));
+                done += available;
+            }
+            else if(static_cast<std::size_t>(count - done) >= m_buffer_size)
+            {
+                const auto readed = read(m_handle, reinterpret_cast<char*>(s + done), static_cast<std::size_t>(count - done) * sizeof(char_type));
+                if(readed < 0 && errno == EINTR)
+                    continue;
+
+                if(readed <= 0)
+                    break;
 
-        return static_cast<std::streamsize>(readed / sizeof(char_type));
+                done += static_cast<std::streamsize>(readed / sizeof(char_type));
+            }
+            else if(traits_type::eq_int_type(underflow(), traits_type::eof()))
+            {
+                break;
+            }
+        }
+
+        return done;
+    }
+
+private:
+    //Writes as much of the put area as possible, and moves what remains at its beginning
+    pipe_io_status write_pending()
+    {
+        const auto pending{static_cast<std::size_t>(parent_type::pptr() - parent_type::pbase())};
+        std::size_t done{};
+        pipe_io_status status{pipe_io_status::ok};
+
+        while(done < pending)
+        {
+            const auto written = write(m_handle, reinterpret_cast<const char*>(parent_type::pbase() + done), (pending - done) * sizeof(char_type));
+            if(written >= 0)
+            {
+                done += static_cast<std::size_t>(written) / sizeof(char_type);
+                continue;
+            }
+
+            if(errno == EINTR)
+                continue;
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                status = pipe_io_status::would_block;
+            else if(errno == EPIPE)
+                status = pipe_io_status::closed;
+            else
+                throw std::runtime_error{"Failed to write to pipe. " + std::string{strerror(errno)}};
+
+            break;
+        }
+
+        //Shifts the rest to the front, when nothing was written the put area is left as is
+        if(done != 0)
+        {
+            std::copy(parent_type::pbase() + done, parent_type::pptr(), std::data(m_buffer));
+            parent_type::setp(std::data(m_buffer), std::data(m_buffer) + m_buffer_size);
+            parent_type::pbump(static_cast<int>(pending - done));
+        }
+
+        return status;
+    }
+
+    bool write_all(const char_type* data, std::size_t count)
+    {
+        const char* current{reinterpret_cast<const char*>(data)};
+        std::size_t remaining{count * sizeof(char_type)};
+
+        while(remaining != 0)
+        {
+            const auto written = write(m_handle, current, remaining);
+            if(written < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+
+                return false;
+            }
+
+            current += written;
+            remaining -= static_cast<std::size_t>(written);
+        }
+
+        return true;
     }
 
 private:
     std::vector<CharT> m_buffer{};
+    std::size_t m_buffer_size{buf_size};
     int m_handle{};
     std::ios_base::openmode m_mode{};
 };
@@ -739,7 +1272,7 @@ public:
 
 private:
     friend class process;
-    friend std::pair<basic_pipe_istream<char_type, traits_type>, basic_pipe_ostream<char_type, traits_type>> make_anonymous_pipe<char_type, traits_type>();
+    friend std::pair<basic_pipe_istream<char_type, traits_type>, basic_pipe_ostream<char_type, traits_type>> make_anonymous_pipe<char_type, traits_type>(const pipe_options&);
 
     basic_pipe_istream(basic_pipe_streambuf<char_type, traits_type> buffer)
     :parent_type{nullptr}
@@ -820,7 +1353,7 @@ public:
 
 private:
     friend class process;
-    friend std::pair<basic_pipe_istream<char_type, traits_type>, basic_pipe_ostream<char_type, traits_type>> make_anonymous_pipe<char_type, traits_type>();
+    friend std::pair<basic_pipe_istream<char_type, traits_type>, basic_pipe_ostream<char_type, traits_type>> make_anonymous_pipe<char_type, traits_type>(const pipe_options&);
 
     basic_pipe_ostream(basic_pipe_streambuf<char_type, traits_type> buffer)
     :parent_type{nullptr}
@@ -834,15 +1367,18 @@ private:
 };
 
 template<typename CharT, typename Traits>
-std::pair<basic_pipe_istream<CharT, Traits>, basic_pipe_ostream<CharT, Traits>> make_anonymous_pipe()
+std::pair<basic_pipe_istream<CharT, Traits>, basic_pipe_ostream<CharT, Traits>> make_anonymous_pipe(const pipe_options& options)
 {
     int fd[2];
 
     if(pipe(fd))
         throw std::runtime_error{"Failed to create pipe"};
 
-    return std::make_pair(basic_pipe_istream<CharT, Traits>{basic_pipe_streambuf<CharT, Traits>{fd[0], std::ios_base::in}},
-                          basic_pipe_ostream<CharT, Traits>{basic_pipe_streambuf<CharT, Traits>{fd[1], std::ios_base::out}});
+    if(options.pipe_capacity != 0)
+        impl::set_pipe_capacity(fd[0], options.pipe_capacity);
+
+    return std::make_pair(basic_pipe_istream<CharT, Traits>{basic_pipe_streambuf<CharT, Traits>{fd[0], std::ios_base::in, options.buffer_size}},
+                          basic_pipe_ostream<CharT, Traits>{basic_pipe_streambuf<CharT, Traits>{fd[1], std::ios_base::out, options.buffer_size}});
 }
 
 using pipe_streambuf = basic_pipe_streambuf<char>;
@@ -0,0 +1,384 @@
+///////////////////////////////////////////////////////////
+/// Copyright 2020 Alexy Pellegrini
+///
+/// Permission is hereby granted, free of charge,
+/// to any person obtaining a copy of this software
+/// and associated documentation files (the "Software"),
+/// to deal in the Software without restriction,
+/// including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense,
+/// and/or sell copies of the Software, and to permit
+/// persons to whom the Software is furnished to do so,
+/// subject to the following conditions:
+///
+/// The above copyright notice and this permission notice
+/// shall be included in all copies or substantial portions
+/// of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+/// ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+/// TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+/// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+/// SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+/// ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+/// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+///////////////////////////////////////////////////////////
+
+#ifndef NOT_ENOUGH_STANDARDS_PIPELINE
+#define NOT_ENOUGH_STANDARDS_PIPELINE
+
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "thread_pool.hpp"
+
+namespace nes
+{
+
+enum class pipeline_mode : std::uint32_t
+{
+    parallel = 1,
+    serial_in_order,
+    serial_out_of_order
+};
+
+template<typename Func>
+struct pipeline_stage
+{
+    pipeline_mode mode{};
+    Func func;
+};
+
+template<typename Func>
+pipeline_stage(pipeline_mode, Func) -> pipeline_stage<Func>;
+
+namespace impl
+{
+
+template<typename T>
+using pipeline_value_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+template<typename Input, typename... Funcs>
+struct pipeline_types;
+
+template<typename Input>
+struct pipeline_types<Input>
+{
+    using values = std::tuple<Input>;
+};
+
+template<typename Input, typename Func, typename... Funcs>
+struct pipeline_types<Input, Func, Funcs...>
+{
+    using next_type = pipeline_value_t<std::invoke_result_t<Func&, Input&&>>;
+    using values = decltype(std::tuple_cat(std::declval<std::tuple<Input>>(), std::declval<typename pipeline_types<next_type, Funcs...>::values>()));
+};
+
+template<typename Input>
+struct pipeline_stage_state
+{
+    std::mutex mutex{};
+    bool busy{};
+    std::uint64_t next_sequence{};
+    std::map<std::uint64_t, std::optional<Input>> pending{};
+};
+
+//Each pulled item is processed by a single pool task that walks the stages.
+//Parallel stages are run inline. A serial stage is run inline if it is free (and, for in-order stages, if the item is the next one),
+//otherwise the item is parked in the stage and picked up by the task currently owning the stage, which resubmits it to the pool.
+//Failed items keep flowing as empty values so in-order stages never wait for a sequence number that will not come.
+template<typename Source, typename... Funcs>
+class pipeline_runner
+{
+    using source_type = typename std::invoke_result_t<Source&>::value_type;
+    using values_type = typename pipeline_types<source_type, Funcs...>::values;
+
+    template<std::size_t Index>
+    using value_t = std::tuple_element_t<Index, values_type>;
+
+    static constexpr std::size_t stage_count{sizeof...(Funcs)};
+
+public:
+    pipeline_runner(thread_pool& pool, std::size_t max_in_flight, Source& source, std::tuple<pipeline_stage<Funcs>...>& stages)
+    :m_pool{&pool}
+    ,m_tokens{max_in_flight}
+    ,m_source{&source}
+    ,m_stages{&stages}
+    {
+
+    }
+
+    ~pipeline_runner() = default;
+    pipeline_runner(const pipeline_runner&) = delete;
+    pipeline_runner& operator=(const pipeline_runner&) = delete;
+    pipeline_runner(pipeline_runner&&) = delete;
+    pipeline_runner& operator=(pipeline_runner&&) = delete;
+
+    void run()
+    {
+        const std::size_t token_count{m_tokens};
+
+        for(std::size_t i{}; i < token_count; ++i)
+        {
+            m_pool->execute([this]()
+            {
+                pull();
+            });
+        }
+
+        std::unique_lock lock{m_mutex};
+        m_condition.wait(lock, [this]()
+        {
+            return m_tokens == 0;
+        });
+
+        if(m_error)
+        {
+            std::rethrow_exception(m_error);
+        }
+    }
+
+private:
+    void pull()
+    {
+        std::optional<source_type> value{};
+        std::uint64_t sequence{};
+
+        {
+            std::lock_guard lock{m_source_mutex};
+
+            if(!m_source_done && !m_failed.load(std::memory_order_relaxed))
+            {
+                try
+                {
+                    value = (*m_source)();
+                }
+                catch(...)
+                {
+                    store_error(std::current_exception());
+                }
+            }
+
+            if(value)
+            {
+                sequence = m_next_sequence++;
+            }
+            else
+            {
+                m_source_done = true;
+            }
+        }
+
+        if(!value)
+        {
+            release_token();
+            return;
+        }
+
+        process<0>(sequence, std::move(value));
+    }
+
+    template<std::size_t Index>
+    void process(std::uint64_t sequence, std::optional<value_t<Index>> value)
+    {
+        if constexpr(Index == stage_count)
+        {
+            m_pool->execute([this]()
+            {
+                pull();
+            });
+        }
+        else
+        {
+            auto& stage{std::get<Index>(*m_stages)};
+
+            if(stage.mode == pipeline_mode::parallel)
+            {
+                process<Index + 1>(sequence, run_stage<Index>(std::move(value)));
+            }
+            else
+            {
+                auto& state{std::get<Index>(m_states)};
+
+                {
+                    std::lock_guard lock{state.mutex};
+
+                    if(state.busy || (stage.mode == pipeline_mode::serial_in_order && sequence != state.next_sequence))
+                    {
+                        state.pending.emplace(sequence, std::move(value));
+                        return;
+                    }
+
+                    state.busy = true;
+                }
+
+                run_serial<Index>(sequence, std::move(value));
+            }
+        }
+    }
+
+    template<std::size_t Index>
+    void run_serial(std::uint64_t sequence, std::optional<value_t<Index>> value)
+    {
+        auto& stage{std::get<Index>(*m_stages)};
+        auto& state{std::get<Index>(m_states)};
+
+        auto output{run_stage<Index>(std::move(value))};
+
+        std::optional<std::pair<std::uint64_t, std::optional<value_t<Index>>>> next{};
+
+        {
+            std::lock_guard lock{state.mutex};
+
+            ++state.next_sequence;
+
+            const auto it{std::begin(state.pending)};
+            if(it != std::end(state.pending) && (stage.mode != pipeline_mode::serial_in_order || it->first == state.next_sequence))
+            {
+                next.emplace(it->first, std::move(it->second));
+                state.pending.erase(it);
+            }
+            else
+            {
+                state.busy = false;
+            }
+        }
+
+        if(next)
+        {
+            m_pool->execute([this, next = std::move(*next)]() mutable
+            {
+                run_serial<Index>(next.first, std::move(next.second));
+            });
+        }
+
+        process<Index + 1>(sequence, std::move(output));
+    }
+
+    template<std::size_t Index>
+    std::optional<value_t<Index + 1>> run_stage(std::optional<value_t<Index>> value) noexcept
+    {
+        if(!value || m_failed.load(std::memory_order_relaxed))
+        {
+            return std::nullopt;
+        }
+
+        auto& func{std::get<Index>(*m_stages).func};
+
+        try
+        {
+            if constexpr(std::is_void_v<std::invoke_result_t<decltype(func)&, value_t<Index>&&>>)
+            {
+                std::invoke(func, std::move(*value));
+
+                return std::monostate{};
+            }
+            else
+            {
+                return std::invoke(func, std::move(*value));
+            }
+        }
+        catch(...)
+        {
+            store_error(std::current_exception());
+        }
+
+        return std::nullopt;
+    }
+
+    void store_error(std::exception_ptr error)
+    {
+        std::lock_guard lock{m_mutex};
+
+        if(!m_error)
+        {
+            m_error = std::move(error);
+            m_failed.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    void release_token()
+    {
+        std::lock_guard lock{m_mutex};
+
+        if(--m_tokens == 0)
+        {
+            m_condition.notify_all();
+        }
+    }
+
+    template<std::size_t... Indices>
+    static auto make_states(std::index_sequence<Indices...>) -> std::tuple<pipeline_stage_state<value_t<Indices>>...>;
+
+private:
+    thread_pool* m_pool{};
+
+    std::mutex m_mutex{};
+    std::condition_variable m_condition{};
+    std::size_t m_tokens{};
+    std::exception_ptr m_error{};
+    std::atomic<bool> m_failed{};
+
+    std::mutex m_source_mutex{};
+    Source* m_source{};
+    bool m_source_done{};
+    std::uint64_t m_next_sequence{};
+
+    std::tuple<pipeline_stage<Funcs>...>* m_stages{};
+    decltype(make_states(std::make_index_sequence<stage_count>{})) m_states{};
+};
+
+}
+
+//Source is called serially until it returns an empty std::optional; each value is then passed through the stages in declaration order.
+//At most max_in_flight items are being processed at any time, which bounds the memory used by the pipeline.
+//Only the last stage may return void.
+template<typename Source, typename... Funcs>
+class pipeline
+{
+public:
+    explicit pipeline(Source source, pipeline_stage<Funcs>... stages)
+    :m_source{std::move(source)}
+    ,m_stages{std::move(stages)...}
+    {
+
+    }
+
+    ~pipeline() = default;
+    pipeline(const pipeline&) = delete;
+    pipeline& operator=(const pipeline&) = delete;
+    pipeline(pipeline&&) = default;
+    pipeline& operator=(pipeline&&) = default;
+
+    void run(thread_pool& pool, std::size_t max_in_flight)
+    {
+        assert(max_in_flight != 0 && "nes::pipeline::run called with max_in_flight == 0");
+        assert(this_worker::pool() != &pool && "nes::pipeline::run called from a worker of the thread pool it runs on.");
+
+        impl::pipeline_runner<Source, Funcs...> runner{pool, max_in_flight, m_source, m_stages};
+        runner.run();
+    }
+
+private:
+    Source m_source;
+    std::tuple<pipeline_stage<Funcs>...> m_stages;
+};
+
+template<typename Source, typename... Funcs>
+pipeline(Source, pipeline_stage<Funcs>...) -> pipeline<Source, Funcs...>;
+
+}
+
+#endif
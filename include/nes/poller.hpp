@@ -0,0 +1,580 @@
+///////////////////////////////////////////////////////////
+/// Copyright 2020 Alexy Pellegrini
+///
+/// Permission is hereby granted, free of charge,
+/// to any person obtaining a copy of this software
+/// and associated documentation files (the "Software"),
+/// to deal in the Software without restriction,
+/// including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense,
+/// and/or sell copies of the Software, and to permit
+/// persons to whom the Software is furnished to do so,
+/// subject to the following conditions:
+///
+/// The above copyright notice and this permission notice
+/// shall be included in all copies or substantial portions
+/// of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+/// ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+/// TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+/// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+/// SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+/// ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+/// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+///////////////////////////////////////////////////////////
+
+#ifndef NOT_ENOUGH_STANDARDS_POLLER
+#define NOT_ENOUGH_STANDARDS_POLLER
+
+#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+    #define NES_POSIX_POLLER
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <string.h>
+    #include <poll.h>
+    #if defined(__linux__)
+        #define NES_LINUX_POLLER
+        #include <sys/epoll.h>
+    #endif
+#else
+    #error "nes::poller is only available on POSIX systems, Windows anonymous pipes do not report readiness."
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "pipe.hpp"
+#include "thread_pool.hpp"
+
+namespace nes
+{
+
+enum class poll_events : std::uint32_t
+{
+    none = 0x00,
+    readable = 0x01,
+    writable = 0x02,
+    hangup = 0x04, //Only reported, the other end of the pipe is closed
+    error = 0x08 //Only reported
+};
+
+constexpr poll_events operator&(poll_events left, poll_events right) noexcept
+{
+    return static_cast<poll_events>(static_cast<std::uint32_t>(left) & static_cast<std::uint32_t>(right));
+}
+
+constexpr poll_events& operator&=(poll_events& left, poll_events right) noexcept
+{
+    left = left & right;
+    return left;
+}
+
+constexpr poll_events operator|(poll_events left, poll_events right) noexcept
+{
+    return static_cast<poll_events>(static_cast<std::uint32_t>(left) | static_cast<std::uint32_t>(right));
+}
+
+constexpr poll_events& operator|=(poll_events& left, poll_events right) noexcept
+{
+    left = left | right;
+    return left;
+}
+
+constexpr poll_events operator^(poll_events left, poll_events right) noexcept
+{
+    return static_cast<poll_events>(static_cast<std::uint32_t>(left) ^ static_cast<std::uint32_t>(right));
+}
+
+constexpr poll_events& operator^=(poll_events& left, poll_events right) noexcept
+{
+    left = left ^ right;
+    return left;
+}
+
+constexpr poll_events operator~(poll_events value) noexcept
+{
+    return static_cast<poll_events>(~static_cast<std::uint32_t>(value));
+}
+
+namespace impl
+{
+
+struct poller_registration
+{
+    int handle{};
+    poll_events events{};
+    std::function<void(poll_events)> callback{};
+    bool dispatching{};
+    bool removed{};
+};
+
+#if defined(NES_LINUX_POLLER)
+
+inline std::uint32_t to_epoll_events(poll_events events) noexcept
+{
+    std::uint32_t output{EPOLLONESHOT};
+
+    if(static_cast<bool>(events & poll_events::readable))
+        output |= EPOLLIN;
+    if(static_cast<bool>(events & poll_events::writable))
+        output |= EPOLLOUT;
+
+    return output;
+}
+
+inline poll_events from_epoll_events(std::uint32_t events) noexcept
+{
+    poll_events output{};
+
+    if(events & EPOLLIN)
+        output |= poll_events::readable;
+    if(events & EPOLLOUT)
+        output |= poll_events::writable;
+    if(events & EPOLLHUP)
+        output |= poll_events::hangup;
+    if(events & EPOLLERR)
+        output |= poll_events::error;
+
+    return output;
+}
+
+#else
+
+inline short to_poll_events(poll_events events) noexcept
+{
+    short output{};
+
+    if(static_cast<bool>(events & poll_events::readable))
+        output |= POLLIN;
+    if(static_cast<bool>(events & poll_events::writable))
+        output |= POLLOUT;
+
+    return output;
+}
+
+inline poll_events from_poll_events(short events) noexcept
+{
+    poll_events output{};
+
+    if(events & POLLIN)
+        output |= poll_events::readable;
+    if(events & POLLOUT)
+        output |= poll_events::writable;
+    if(events & POLLHUP)
+        output |= poll_events::hangup;
+    if(events & (POLLERR | POLLNVAL))
+        output |= poll_events::error;
+
+    return output;
+}
+
+#endif
+
+}
+
+//Waits for the readiness of many pipes, process standard streams or other native handles from a single thread, with epoll on Linux and poll elsewhere.
+//The callback of a handle is called with the reported events, either by the thread in poll() or by a task of a thread_pool.
+//A handle is disarmed while its callback runs, then armed again, so callbacks of the same handle never overlap and
+//a readiness is reported again only if it remains once the callback returns: read or write until pipe_io_status::would_block.
+//Streams must be set to non-blocking mode (rdbuf()->set_non_blocking(true)) and used through read_some and write_some.
+class poller
+{
+public:
+    using native_handle_type = int;
+    using callback_type = std::function<void(poll_events)>;
+
+    static constexpr std::size_t max_events{256};
+
+public:
+    //Callbacks are called by poll()
+    poller()
+    {
+        open();
+    }
+
+    //Callbacks are pushed on the pool, poll() only waits for readiness
+    explicit poller(thread_pool& pool)
+    :m_pool{&pool}
+    {
+        open();
+    }
+
+    //Waits for the callbacks pushed on the pool, helping it meanwhile
+    ~poller()
+    {
+        if(m_pool)
+        {
+            m_pending.wait([this]()
+            {
+                return impl::run_pending_task(*m_pool);
+            });
+        }
+
+#if defined(NES_LINUX_POLLER)
+        ::close(m_handle);
+#endif
+        ::close(m_wake[0]);
+        ::close(m_wake[1]);
+    }
+
+    poller(const poller&) = delete;
+    poller& operator=(const poller&) = delete;
+    poller(poller&&) = delete;
+    poller& operator=(poller&&) = delete;
+
+    template<typename CharT, typename Traits>
+    void add(basic_pipe_istream<CharT, Traits>& stream, callback_type callback)
+    {
+        add(stream.rdbuf()->native_handle(), poll_events::readable, std::move(callback));
+    }
+
+    template<typename CharT, typename Traits>
+    void add(basic_pipe_ostream<CharT, Traits>& stream, callback_type callback)
+    {
+        add(stream.rdbuf()->native_handle(), poll_events::writable, std::move(callback));
+    }
+
+    void add(int handle, poll_events events, callback_type callback)
+    {
+        assert(callback && "nes::poller::add called with an empty callback.");
+
+        std::lock_guard lock{m_mutex};
+
+        if(m_registrations.find(handle) != std::end(m_registrations))
+            throw std::runtime_error{"Failed to register handle in poller. The handle is already registered."};
+
+        auto registration{std::make_shared<impl::poller_registration>()};
+        registration->handle = handle;
+        registration->events = events;
+        registration->callback = std::move(callback);
+
+#if defined(NES_LINUX_POLLER)
+        epoll_event event{};
+        event.events = impl::to_epoll_events(events);
+        event.data.fd = handle;
+
+        if(epoll_ctl(m_handle, EPOLL_CTL_ADD, handle, &event) < 0)
+            throw std::runtime_error{"Failed to register handle in poller. " + std::string{strerror(errno)}};
+#endif
+
+        m_registrations.emplace(handle, std::move(registration));
+
+#if !defined(NES_LINUX_POLLER)
+        wake();
+#endif
+    }
+
+    //Changes the events waited for, may be called from the handle's own callback
+    void modify(int handle, poll_events events)
+    {
+        std::lock_guard lock{m_mutex};
+
+        const auto it{m_registrations.find(handle)};
+        assert(it != std::end(m_registrations) && "nes::poller::modify called with an unregistered handle.");
+
+        it->second->events = events;
+        if(!it->second->dispatching)
+            arm(*it->second);
+    }
+
+    //Must be called before the handle is closed. A callback already running is not waited for.
+    void remove(int handle)
+    {
+        std::lock_guard lock{m_mutex};
+
+        const auto it{m_registrations.find(handle)};
+        if(it == std::end(m_registrations))
+            return;
+
+        it->second->removed = true;
+        m_registrations.erase(it);
+
+#if defined(NES_LINUX_POLLER)
+        epoll_ctl(m_handle, EPOLL_CTL_DEL, handle, nullptr);
+#else
+        wake();
+#endif
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard lock{m_mutex};
+        return std::size(m_registrations);
+    }
+
+    //Waits until at least one handle is ready, or the poller is woken up
+    std::size_t poll()
+    {
+        return wait(-1);
+    }
+
+    //Waits at most timeout, returns the number of callbacks called or pushed on the pool.
+    //The first exception thrown by a callback since the last call is rethrown.
+    template<typename Rep, typename Period>
+    std::size_t poll(const std::chrono::duration<Rep, Period>& timeout)
+    {
+        const auto milliseconds{std::chrono::ceil<std::chrono::milliseconds>(timeout).count()};
+
+        return wait(static_cast<int>(std::clamp<decltype(milliseconds)>(milliseconds, 0, std::numeric_limits<int>::max())));
+    }
+
+    //Polls until stop() is called
+    void run()
+    {
+        while(!m_stopped.exchange(false, std::memory_order_acq_rel))
+        {
+            wait(-1);
+        }
+    }
+
+    //Makes run() return, may be called from any thread or callback
+    void stop()
+    {
+        m_stopped.store(true, std::memory_order_release);
+        wake();
+    }
+
+    //Makes a blocked poll() return
+    void wake()
+    {
+        const char value{};
+        while(write(m_wake[1], &value, 1) < 0 && errno == EINTR);
+    }
+
+    //Epoll instance on Linux, -1 elsewhere
+    native_handle_type native_handle() const noexcept
+    {
+        return m_handle;
+    }
+
+private:
+    void open()
+    {
+#if defined(NES_LINUX_POLLER)
+        //Created with its flags, so a concurrent fork and exec can not inherit it
+        if(pipe2(m_wake, O_CLOEXEC | O_NONBLOCK))
+            throw std::runtime_error{"Failed to create poller wake up pipe. " + std::string{strerror(errno)}};
+#else
+        if(pipe(m_wake))
+            throw std::runtime_error{"Failed to create poller wake up pipe. " + std::string{strerror(errno)}};
+
+        for(const int handle : m_wake)
+        {
+            fcntl(handle, F_SETFL, fcntl(handle, F_GETFL) | O_NONBLOCK);
+            fcntl(handle, F_SETFD, FD_CLOEXEC);
+        }
+#endif
+
+#if defined(NES_LINUX_POLLER)
+        m_handle = epoll_create1(EPOLL_CLOEXEC);
+        if(m_handle < 0)
+        {
+            ::close(m_wake[0]);
+            ::close(m_wake[1]);
+            throw std::runtime_error{"Failed to create epoll instance. " + std::string{strerror(errno)}};
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = m_wake[0];
+        epoll_ctl(m_handle, EPOLL_CTL_ADD, m_wake[0], &event);
+#endif
+    }
+
+    void drain_wake()
+    {
+        std::array<char, 64> buffer{};
+        while(read(m_wake[0], std::data(buffer), std::size(buffer)) > 0);
+    }
+
+    //Called with m_mutex locked
+    void arm(impl::poller_registration& registration)
+    {
+#if defined(NES_LINUX_POLLER)
+        epoll_event event{};
+        event.events = impl::to_epoll_events(registration.events);
+        event.data.fd = registration.handle;
+
+        if(epoll_ctl(m_handle, EPOLL_CTL_MOD, registration.handle, &event) < 0 && !m_error)
+            m_error = std::make_exception_ptr(std::runtime_error{"Failed to rearm handle in poller. " + std::string{strerror(errno)}});
+#else
+        static_cast<void>(registration);
+        wake();
+#endif
+    }
+
+#if defined(NES_LINUX_POLLER)
+    std::size_t wait(int timeout)
+    {
+        std::array<epoll_event, max_events> events{};
+
+        int count{};
+        do
+        {
+            count = epoll_wait(m_handle, std::data(events), static_cast<int>(std::size(events)), timeout);
+        } while(count < 0 && errno == EINTR);
+
+        if(count < 0)
+            throw std::runtime_error{"Failed to wait for epoll events. " + std::string{strerror(errno)}};
+
+        std::size_t dispatched{};
+        for(int i{}; i < count; ++i)
+        {
+            if(events[i].data.fd == m_wake[0])
+            {
+                drain_wake();
+                continue;
+            }
+
+            if(dispatch(events[i].data.fd, impl::from_epoll_events(events[i].events)))
+                ++dispatched;
+        }
+
+        rethrow();
+
+        return dispatched;
+    }
+#else
+    std::size_t wait(int timeout)
+    {
+        std::vector<pollfd> handles{};
+
+        {
+            std::lock_guard lock{m_mutex};
+
+            handles.reserve(std::size(m_registrations) + 1);
+            handles.emplace_back(pollfd{m_wake[0], POLLIN, 0});
+
+            for(auto&& [handle, registration] : m_registrations)
+            {
+                if(!registration->dispatching && registration->events != poll_events::none)
+                    handles.emplace_back(pollfd{handle, impl::to_poll_events(registration->events), 0});
+            }
+        }
+
+        int count{};
+        do
+        {
+            count = ::poll(std::data(handles), static_cast<nfds_t>(std::size(handles)), timeout);
+        } while(count < 0 && errno == EINTR);
+
+        if(count < 0)
+            throw std::runtime_error{"Failed to poll handles. " + std::string{strerror(errno)}};
+
+        if(handles[0].revents != 0)
+            drain_wake();
+
+        std::size_t dispatched{};
+        for(std::size_t i{1}; i < std::size(handles); ++i)
+        {
+            if(handles[i].revents != 0 && dispatch(handles[i].fd, impl::from_poll_events(handles[i].revents)))
+                ++dispatched;
+        }
+
+        rethrow();
+
+        return dispatched;
+    }
+#endif
+
+    bool dispatch(int handle, poll_events events)
+    {
+        std::shared_ptr<impl::poller_registration> registration{};
+
+        {
+            std::lock_guard lock{m_mutex};
+
+            const auto it{m_registrations.find(handle)};
+            //Removed, or removed then added again while its callback was running
+            if(it == std::end(m_registrations) || it->second->dispatching)
+                return false;
+
+            registration = it->second;
+            registration->dispatching = true;
+        }
+
+        if(m_pool)
+        {
+            m_pending.add();
+
+            m_pool->execute([this, registration = std::move(registration), events]()
+            {
+                invoke(*registration, events);
+                m_pending.release();
+            });
+        }
+        else
+        {
+            invoke(*registration, events);
+        }
+
+        return true;
+    }
+
+    void invoke(impl::poller_registration& registration, poll_events events) noexcept
+    {
+        std::exception_ptr error{};
+
+        try
+        {
+            registration.callback(events);
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+        }
+
+        std::lock_guard lock{m_mutex};
+
+        if(error && !m_error)
+            m_error = std::move(error);
+
+        registration.dispatching = false;
+        if(!registration.removed)
+            arm(registration);
+    }
+
+    void rethrow()
+    {
+        std::exception_ptr error{};
+
+        {
+            std::lock_guard lock{m_mutex};
+            std::swap(error, m_error);
+        }
+
+        if(error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    thread_pool* m_pool{};
+    native_handle_type m_handle{-1};
+    int m_wake[2]{-1, -1};
+    mutable std::mutex m_mutex{};
+    std::unordered_map<int, std::shared_ptr<impl::poller_registration>> m_registrations{};
+    std::exception_ptr m_error{};
+    std::atomic<bool> m_stopped{};
+    impl::pending_counter m_pending{};
+};
+
+}
+
+#endif
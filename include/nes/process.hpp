@@ -238,7 +238,12 @@ public:
     explicit process(const std::string& path, const std::string& working_directory, process_options options)
     :process{path, {}, working_directory, options}{}
 
-    explicit process(const std::string& path, std::vector<std::string> args = std::vector<std::string>{}, const std::string& working_directory = std::string{}, process_options options [[maybe_unused]] = process_options{})
+    //pipes sets the buffer sizes of the grabbed standard streams, and the capacity of their pipes
+    explicit process(const std::string& path, std::vector<std::string> args = std::vector<std::string>{}, const std::string& working_directory = std::string{}, process_options options [[maybe_unused]] = process_options{}
+                #ifdef NES_PROCESS_PIPE_EXTENSION
+                     , const pipe_options& pipes [[maybe_unused]] = pipe_options{}
+                #endif
+                     )
     {
         assert(!std::empty(path) && "nes::process::process called with empty path.");
 
@@ -256,15 +261,15 @@ public:
         impl::auto_handle stderr_wr{};
 
         if(static_cast<bool>(options & process_options::grab_stdin))
-            if(!CreatePipe(&stdin_rd, &stdin_wr, &security_attributes, 0) || !SetHandleInformation(stdin_wr, HANDLE_FLAG_INHERIT, 0))
+            if(!CreatePipe(&stdin_rd, &stdin_wr, &security_attributes, static_cast<DWORD>(pipes.pipe_capacity)) || !SetHandleInformation(stdin_wr, HANDLE_FLAG_INHERIT, 0))
                 throw std::runtime_error{"Failed to create stdin pipe. " + get_error_message()};
 
         if(static_cast<bool>(options & process_options::grab_stdout))
-            if(!CreatePipe(&stdout_rd, &stdout_wr, &security_attributes, 0) || !SetHandleInformation(stdout_rd, HANDLE_FLAG_INHERIT, 0))
+            if(!CreatePipe(&stdout_rd, &stdout_wr, &security_attributes, static_cast<DWORD>(pipes.pipe_capacity)) || !SetHandleInformation(stdout_rd, HANDLE_FLAG_INHERIT, 0))
                 throw std::runtime_error{"Failed to create stdout pipe. " + get_error_message()};
 
         if(static_cast<bool>(options & process_options::grab_stderr))
-            if(!CreatePipe(&stderr_rd, &stderr_wr, &security_attributes, 0) || !SetHandleInformation(stderr_rd, HANDLE_FLAG_INHERIT, 0))
+            if(!CreatePipe(&stderr_rd, &stderr_wr, &security_attributes, static_cast<DWORD>(pipes.pipe_capacity)) || !SetHandleInformation(stderr_rd, HANDLE_FLAG_INHERIT, 0))
                 throw std::runtime_error{"Failed to create stderr pipe. " + get_error_message()};
     #endif
 
@@ -343,19 +348,19 @@ public:
     #ifdef NES_PROCESS_PIPE_EXTENSION
         if(static_cast<bool>(options & process_options::grab_stdin))
         {
-            pipe_streambuf buffer{stdin_wr.release(), std::ios_base::out};
+            pipe_streambuf buffer{stdin_wr.release(), std::ios_base::out, pipes.buffer_size};
             m_stdin_stream.reset(new pipe_ostream{std::move(buffer)});
         }
 
         if(static_cast<bool>(options & process_options::grab_stdout))
         {
-            pipe_streambuf buffer{stdout_rd.release(), std::ios_base::in};
+            pipe_streambuf buffer{stdout_rd.release(), std::ios_base::in, pipes.buffer_size};
             m_stdout_stream.reset(new pipe_istream{std::move(buffer)});
         }
 
         if(static_cast<bool>(options & process_options::grab_stderr))
         {
-            pipe_streambuf buffer{stderr_rd.release(), std::ios_base::in};
+            pipe_streambuf buffer{stderr_rd.release(), std::ios_base::in, pipes.buffer_size};
             m_stderr_stream.reset(new pipe_istream{std::move(buffer)});
         }
     #endif
@@ -782,7 +787,12 @@ public:
     explicit process(const std::string& path, const std::string& working_directory, process_options options)
     :process{path, {}, working_directory, options}{}
 
-    explicit process(const std::string& path, std::vector<std::string> args = std::vector<std::string>{}, const std::string& working_directory = std::string{}, process_options options [[maybe_unused]] = process_options{})
+    //pipes sets the buffer sizes of the grabbed standard streams, and the capacity of their pipes
+    explicit process(const std::string& path, std::vector<std::string> args = std::vector<std::string>{}, const std::string& working_directory = std::string{}, process_options options [[maybe_unused]] = process_options{}
+                #ifdef NES_PROCESS_PIPE_EXTENSION
+                     , const pipe_options& pipes [[maybe_unused]] = pipe_options{}
+                #endif
+                     )
     {
         assert(!std::empty(path) && "nes::process::process called with empty path.");
 
@@ -807,6 +817,15 @@ public:
         if(static_cast<bool>(options & process_options::grab_stderr) && pipe(reinterpret_cast<int*>(stderr_fd)))
             throw std::runtime_error{"Failed to create stderr pipe. " + std::string{strerror(errno)}};
 
+        if(pipes.pipe_capacity != 0)
+        {
+            for(const auto* fd : {stdin_fd, stdout_fd, stderr_fd})
+            {
+                if(fd[0])
+                    impl::set_pipe_capacity(fd[0], pipes.pipe_capacity);
+            }
+        }
+
         const bool standard_streams{static_cast<bool>(options & process_options::grab_stdin) || static_cast<bool>(options & process_options::grab_stdout) || static_cast<bool>(options & process_options::grab_stderr)};
     #else
         constexpr bool standard_streams{false};
@@ -846,13 +865,13 @@ public:
 
     #ifdef NES_PROCESS_PIPE_EXTENSION
         if(static_cast<bool>(options & process_options::grab_stdin))
-             m_stdin_stream.reset(new pipe_ostream{pipe_streambuf{stdin_fd[1].release(), std::ios_base::out}});
+             m_stdin_stream.reset(new pipe_ostream{pipe_streambuf{stdin_fd[1].release(), std::ios_base::out, pipes.buffer_size}});
 
         if(static_cast<bool>(options & process_options::grab_stdout))
-            m_stdout_stream.reset(new pipe_istream{pipe_streambuf{stdout_fd[0].release(), std::ios_base::in}});
+            m_stdout_stream.reset(new pipe_istream{pipe_streambuf{stdout_fd[0].release(), std::ios_base::in, pipes.buffer_size}});
 
         if(static_cast<bool>(options & process_options::grab_stderr))
-            m_stderr_stream.reset(new pipe_istream{pipe_streambuf{stderr_fd[0].release(), std::ios_base::in}});
+            m_stderr_stream.reset(new pipe_istream{pipe_streambuf{stderr_fd[0].release(), std::ios_base::in, pipes.buffer_size}});
     #endif
     }
 
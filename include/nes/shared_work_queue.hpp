@@ -0,0 +1,575 @@
+///////////////////////////////////////////////////////////
+/// Copyright 2020 Alexy Pellegrini
+///
+/// Permission is hereby granted, free of charge,
+/// to any person obtaining a copy of this software
+/// and associated documentation files (the "Software"),
+/// to deal in the Software without restriction,
+/// including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense,
+/// and/or sell copies of the Software, and to permit
+/// persons to whom the Software is furnished to do so,
+/// subject to the following conditions:
+///
+/// The above copyright notice and this permission notice
+/// shall be included in all copies or substantial portions
+/// of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+/// ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+/// TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+/// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+/// SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+/// ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+/// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+///////////////////////////////////////////////////////////
+
+#ifndef NOT_ENOUGH_STANDARDS_SHARED_WORK_QUEUE
+#define NOT_ENOUGH_STANDARDS_SHARED_WORK_QUEUE
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "shared_memory.hpp"
+#include "named_semaphore.hpp"
+#include "thread_pool.hpp"
+
+namespace nes
+{
+
+namespace impl
+{
+
+//The low bits of a slot's state word hold its state, the high 32 bits a generation bumped each time the slot is taken back from its holder,
+//so a lease that expired and was given to another consumer can not be completed twice.
+enum class work_slot_state : std::uint64_t
+{
+    free = 0,
+    writing = 1,
+    ready = 2,
+    leased = 3
+};
+
+inline constexpr std::uint64_t work_slot_state_mask{0x03};
+inline constexpr std::uint64_t work_slot_generation{std::uint64_t{1} << 32};
+
+constexpr work_slot_state get_work_slot_state(std::uint64_t word) noexcept
+{
+    return static_cast<work_slot_state>(word & work_slot_state_mask);
+}
+
+constexpr std::uint64_t make_work_slot_word(std::uint64_t word, work_slot_state state) noexcept
+{
+    return (word & ~work_slot_state_mask) | static_cast<std::uint64_t>(state);
+}
+
+constexpr std::uint64_t next_work_slot_word(std::uint64_t word, work_slot_state state) noexcept
+{
+    return make_work_slot_word(word + work_slot_generation, state);
+}
+
+struct shared_work_queue_header
+{
+    static constexpr std::uint64_t magic_value{0x4E45535F53575131}; //"NES_SWQ1"
+
+    std::uint64_t magic;
+    std::uint64_t capacity;
+    std::uint64_t slot_size;
+    std::uint64_t lease_duration; //nanoseconds
+    std::uint64_t next_ticket;
+    std::uint64_t reserved[3];
+};
+
+static_assert(std::is_trivial_v<shared_work_queue_header> && sizeof(shared_work_queue_header) == 64, "nes::impl::shared_work_queue_header layout must not change");
+
+template<typename T>
+struct shared_work_slot
+{
+    std::uint64_t state;
+    std::uint64_t ticket; //Ready slots are leased in ticket order
+    std::uint64_t deadline; //A writing or leased slot is taken back once the steady clock passes it, in nanoseconds
+    std::uint64_t deadline_word; //State word the deadline was written for, the deadline of a previous holder is never trusted
+    T value;
+};
+
+//steady_clock is system-wide on the supported platforms, so deadlines written by a process are meaningful to the others
+inline std::uint64_t shared_work_clock() noexcept
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+}
+
+//Bounded MPMC queue of trivial task descriptors in named shared memory, shared by several processes.
+//Consumers lease descriptors instead of removing them: a lease that is not completed, renewed or released before lease_duration
+//elapses is taken back and given to another consumer, so descriptors held by a process that crashed are not lost.
+//Delivery is at least once: a consumer slower than its lease may see its descriptor run elsewhere, complete() then returns false.
+//Ready descriptors are announced on a named semaphore, waiting consumers also poll to notice expired leases.
+template<typename T>
+class shared_work_queue
+{
+    static_assert(std::is_trivial_v<T>, "nes::shared_work_queue value type must be trivial, it is copied through shared memory.");
+
+    using slot_type = impl::shared_work_slot<T>;
+
+public:
+    using value_type = T;
+
+    class lease
+    {
+        friend class shared_work_queue;
+
+    public:
+        const T& value() const noexcept
+        {
+            return m_value;
+        }
+
+    private:
+        lease(std::size_t index, std::uint64_t word, const T& value) noexcept
+        :m_index{index}
+        ,m_word{word}
+        ,m_value{value}
+        {
+
+        }
+
+    private:
+        std::size_t m_index{};
+        std::uint64_t m_word{};
+        T m_value{};
+    };
+
+public:
+    //Creates the queue, replacing any queue with the same name
+    shared_work_queue(const std::string& name, std::size_t capacity, std::chrono::nanoseconds lease_duration)
+    :m_memory{name, sizeof(impl::shared_work_queue_header) + sizeof(slot_type) * capacity}
+    ,m_header{m_memory.map<impl::shared_work_queue_header>(0)}
+    ,m_slots{m_memory.map<slot_type[]>(sizeof(impl::shared_work_queue_header), capacity)}
+    ,m_capacity{capacity}
+    ,m_lease_duration{lease_duration}
+    ,m_ready{remove_ready_semaphore(name)}
+    {
+        assert(capacity != 0 && "nes::shared_work_queue created with capacity == 0");
+        assert(lease_duration.count() > 0 && "nes::shared_work_queue created with a null lease duration");
+
+    #if defined(NES_WIN32_NAMED_SEMAPHORE)
+        //Windows semaphores can not be removed while a process holds them, the count of the previous queue is dropped instead
+        while(m_ready.try_acquire())
+        {
+
+        }
+    #endif
+
+        //ftruncate zero-fills the memory, so every slot starts free with generation 0
+        auto& header{*m_header};
+        std::atomic_ref{header.capacity}.store(capacity, std::memory_order_relaxed);
+        std::atomic_ref{header.slot_size}.store(sizeof(slot_type), std::memory_order_relaxed);
+        std::atomic_ref{header.lease_duration}.store(static_cast<std::uint64_t>(lease_duration.count()), std::memory_order_relaxed);
+        std::atomic_ref{header.magic}.store(impl::shared_work_queue_header::magic_value, std::memory_order_release);
+    }
+
+    //Opens a queue created by another process, throws std::runtime_error if it is not fully created or holds another value type
+    explicit shared_work_queue(const std::string& name)
+    :m_memory{name}
+    ,m_header{m_memory.map<impl::shared_work_queue_header>(0)}
+    ,m_ready{name + "_ready"}
+    {
+        auto& header{*m_header};
+
+        if(std::atomic_ref{header.magic}.load(std::memory_order_acquire) != impl::shared_work_queue_header::magic_value)
+            throw std::runtime_error{"Failed to open shared work queue. The queue is not initialized."};
+
+        if(std::atomic_ref{header.slot_size}.load(std::memory_order_relaxed) != sizeof(slot_type))
+            throw std::runtime_error{"Failed to open shared work queue. The queue holds another value type."};
+
+        m_capacity = static_cast<std::size_t>(std::atomic_ref{header.capacity}.load(std::memory_order_relaxed));
+        m_lease_duration = std::chrono::nanoseconds{static_cast<std::chrono::nanoseconds::rep>(std::atomic_ref{header.lease_duration}.load(std::memory_order_relaxed))};
+        m_slots = m_memory.map<slot_type[]>(sizeof(impl::shared_work_queue_header), m_capacity);
+    }
+
+    ~shared_work_queue() = default;
+    shared_work_queue(const shared_work_queue&) = delete;
+    shared_work_queue& operator=(const shared_work_queue&) = delete;
+    shared_work_queue(shared_work_queue&&) = delete;
+    shared_work_queue& operator=(shared_work_queue&&) = delete;
+
+    bool try_push(const T& value)
+    {
+        const auto ticket{std::atomic_ref{m_header->next_ticket}.fetch_add(1, std::memory_order_relaxed)};
+        const auto deadline{impl::shared_work_clock() + lease_nanoseconds()};
+
+        for(std::size_t i{}; i < m_capacity; ++i)
+        {
+            auto& slot{m_slots[(ticket + i) % m_capacity]};
+            std::atomic_ref state{slot.state};
+
+            auto word{state.load(std::memory_order_acquire)};
+            if(impl::get_work_slot_state(word) != impl::work_slot_state::free)
+            {
+                continue;
+            }
+
+            const auto writing_word{impl::make_work_slot_word(word, impl::work_slot_state::writing)};
+            if(!state.compare_exchange_strong(word, writing_word, std::memory_order_acq_rel))
+            {
+                continue;
+            }
+
+            set_deadline(slot, writing_word, deadline);
+            std::atomic_ref{slot.ticket}.store(ticket, std::memory_order_relaxed);
+            slot.value = value;
+
+            //A writer slower than its lease had its slot freed and maybe taken again by another writer,
+            //the generation then differs and the value is written again in another slot
+            auto expected{writing_word};
+            if(!state.compare_exchange_strong(expected, impl::make_work_slot_word(writing_word, impl::work_slot_state::ready), std::memory_order_release, std::memory_order_relaxed))
+            {
+                continue;
+            }
+
+            m_ready.release();
+
+            return true;
+        }
+
+        return false;
+    }
+
+    //Waits for a free slot, taking back the slots of writers that crashed meanwhile
+    void push(const T& value)
+    {
+        while(!try_push(value))
+        {
+            reclaim_expired();
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+    }
+
+    std::optional<lease> try_pop()
+    {
+        while(true)
+        {
+            const auto now{impl::shared_work_clock()};
+
+            std::size_t best{m_capacity};
+            std::uint64_t best_word{};
+            std::uint64_t best_ticket{std::numeric_limits<std::uint64_t>::max()};
+
+            for(std::size_t i{}; i < m_capacity; ++i)
+            {
+                auto word{reclaim(i, now)};
+
+                if(impl::get_work_slot_state(word) == impl::work_slot_state::ready)
+                {
+                    const auto ticket{std::atomic_ref{m_slots[i].ticket}.load(std::memory_order_relaxed)};
+
+                    if(ticket < best_ticket)
+                    {
+                        best = i;
+                        best_word = word;
+                        best_ticket = ticket;
+                    }
+                }
+            }
+
+            if(best == m_capacity)
+            {
+                return std::nullopt;
+            }
+
+            auto& slot{m_slots[best]};
+
+            const auto leased_word{impl::make_work_slot_word(best_word, impl::work_slot_state::leased)};
+            if(std::atomic_ref{slot.state}.compare_exchange_strong(best_word, leased_word, std::memory_order_acq_rel))
+            {
+                set_deadline(slot, leased_word, now + lease_nanoseconds());
+
+                //Consumes the announcement of this descriptor, so the semaphore count follows the number of ready descriptors
+                m_ready.try_acquire();
+
+                return lease{best, leased_word, slot.value};
+            }
+        }
+    }
+
+    std::optional<lease> pop()
+    {
+        return pop_for(std::chrono::nanoseconds::max());
+    }
+
+    template<class Rep, class Period>
+    std::optional<lease> pop_for(const std::chrono::duration<Rep, Period>& timeout)
+    {
+        const auto start{std::chrono::steady_clock::now()};
+        const auto limit{std::chrono::duration_cast<std::chrono::nanoseconds>(timeout)};
+
+        while(true)
+        {
+            if(auto output{try_pop()}; output)
+            {
+                return output;
+            }
+
+            const auto elapsed{std::chrono::steady_clock::now() - start};
+            if(elapsed >= limit)
+            {
+                return std::nullopt;
+            }
+
+            //Expired leases are not announced, waits are bounded to notice them
+            m_ready.try_lock_for(std::min<std::chrono::nanoseconds>(limit - elapsed, poll_interval()));
+        }
+    }
+
+    //Removes the descriptor from the queue. Returns false if the lease expired and the descriptor was given back to the queue.
+    bool complete(const lease& lease)
+    {
+        auto word{lease.m_word};
+
+        return std::atomic_ref{m_slots[lease.m_index].state}.compare_exchange_strong(word, impl::next_work_slot_word(word, impl::work_slot_state::free), std::memory_order_acq_rel);
+    }
+
+    //Extends the lease by lease_duration. Returns false if it already expired.
+    bool renew(const lease& lease)
+    {
+        auto& slot{m_slots[lease.m_index]};
+        std::atomic_ref state{slot.state};
+
+        if(state.load(std::memory_order_acquire) != lease.m_word)
+        {
+            return false;
+        }
+
+        std::atomic_ref{slot.deadline}.store(impl::shared_work_clock() + lease_nanoseconds(), std::memory_order_relaxed);
+
+        return state.load(std::memory_order_acquire) == lease.m_word;
+    }
+
+    //Gives the descriptor back to the queue without waiting for the lease to expire
+    bool release(const lease& lease)
+    {
+        auto word{lease.m_word};
+
+        if(!std::atomic_ref{m_slots[lease.m_index].state}.compare_exchange_strong(word, impl::next_work_slot_word(word, impl::work_slot_state::ready), std::memory_order_acq_rel))
+        {
+            return false;
+        }
+
+        m_ready.release();
+
+        return true;
+    }
+
+    std::size_t capacity() const noexcept
+    {
+        return m_capacity;
+    }
+
+    std::chrono::nanoseconds lease_duration() const noexcept
+    {
+        return m_lease_duration;
+    }
+
+    std::chrono::nanoseconds poll_interval() const noexcept
+    {
+        return std::clamp<std::chrono::nanoseconds>(m_lease_duration / 4, std::chrono::milliseconds{1}, std::chrono::milliseconds{100});
+    }
+
+private:
+    //A semaphore left by a previous queue keeps its count on POSIX, the creating side starts from a new one
+    static std::string remove_ready_semaphore(const std::string& name)
+    {
+        auto output{name + "_ready"};
+
+    #if defined(NES_POSIX_NAMED_SEMAPHORE)
+        sem_unlink(std::data(named_semaphore_root + output));
+    #endif
+
+        return output;
+    }
+
+    std::uint64_t lease_nanoseconds() const noexcept
+    {
+        return static_cast<std::uint64_t>(m_lease_duration.count());
+    }
+
+    //Only the holder of the slot writes its deadline, once it owns the slot, so a writer or consumer that lost the slot
+    //can not shorten the lease of the one that won it
+    static void set_deadline(slot_type& slot, std::uint64_t word, std::uint64_t deadline) noexcept
+    {
+        std::atomic_ref{slot.deadline}.store(deadline, std::memory_order_relaxed);
+        std::atomic_ref{slot.deadline_word}.store(word, std::memory_order_release);
+    }
+
+    //Takes the slot back from its holder if its deadline passed, and returns its state word
+    std::uint64_t reclaim(std::size_t index, std::uint64_t now)
+    {
+        auto& slot{m_slots[index]};
+        std::atomic_ref state{slot.state};
+
+        auto word{state.load(std::memory_order_acquire)};
+        const auto current{impl::get_work_slot_state(word)};
+
+        if(current != impl::work_slot_state::writing && current != impl::work_slot_state::leased)
+        {
+            return word;
+        }
+
+        //Until its holder writes the deadline, the slot keeps the one of its previous holder, which may already be over.
+        //A holder that dies between its compare-exchange and the two stores of set_deadline keeps its slot.
+        if(std::atomic_ref{slot.deadline_word}.load(std::memory_order_acquire) != word || std::atomic_ref{slot.deadline}.load(std::memory_order_relaxed) > now)
+        {
+            return word;
+        }
+
+        //A writer that did not finish leaves an incomplete value, its slot is freed. A lease that expired makes the descriptor ready again.
+        const auto next{current == impl::work_slot_state::writing ? impl::work_slot_state::free : impl::work_slot_state::ready};
+        const auto next_word{impl::next_work_slot_word(word, next)};
+
+        if(!state.compare_exchange_strong(word, next_word, std::memory_order_acq_rel))
+        {
+            return word;
+        }
+
+        return next_word;
+    }
+
+    void reclaim_expired()
+    {
+        const auto now{impl::shared_work_clock()};
+
+        for(std::size_t i{}; i < m_capacity; ++i)
+        {
+            reclaim(i, now);
+        }
+    }
+
+private:
+    shared_memory m_memory;
+    unique_map_t<impl::shared_work_queue_header> m_header;
+    unique_map_t<slot_type[]> m_slots{};
+    std::size_t m_capacity{};
+    std::chrono::nanoseconds m_lease_duration{};
+    timed_named_semaphore m_ready;
+};
+
+//Runs func on the descriptors of a shared_work_queue from concurrency tasks of a thread_pool, one by default.
+//Each task waits for a descriptor, runs func, completes the lease and is pushed back to the pool, so the pool keeps running its other tasks in between.
+//A waiting task holds its worker for up to poll_interval(): more tasks than the expected descriptor rate needs take workers from the rest of the pool.
+//func is called concurrently and must be thread-safe. An exception escaping it leaves the lease to expire, then the descriptor is given to another consumer.
+template<typename T, typename Func>
+class shared_work_consumer
+{
+public:
+    shared_work_consumer(thread_pool& pool, shared_work_queue<T>& queue, Func func, std::size_t concurrency = 1)
+    :m_pool{&pool}
+    ,m_queue{&queue}
+    ,m_func{std::move(func)}
+    {
+        const std::size_t task_count{std::clamp<std::size_t>(concurrency, 1, pool.thread_count())};
+
+        m_pending.add(task_count);
+
+        for(std::size_t i{}; i < task_count; ++i)
+        {
+            submit();
+        }
+    }
+
+    //Stops and waits for the tasks, helping the pool meanwhile
+    ~shared_work_consumer()
+    {
+        stop();
+
+        m_pending.wait([this]()
+        {
+            return impl::run_pending_task(*m_pool);
+        });
+    }
+
+    shared_work_consumer(const shared_work_consumer&) = delete;
+    shared_work_consumer& operator=(const shared_work_consumer&) = delete;
+    shared_work_consumer(shared_work_consumer&&) = delete;
+    shared_work_consumer& operator=(shared_work_consumer&&) = delete;
+
+    //Tasks finish their current descriptor, then stop taking new ones
+    void stop() noexcept
+    {
+        m_stopped.store(true, std::memory_order_release);
+    }
+
+    std::uint64_t completed_count() const noexcept
+    {
+        return m_completed.load(std::memory_order_relaxed);
+    }
+
+private:
+    void submit()
+    {
+        m_pool->execute([this]()
+        {
+            consume();
+        });
+    }
+
+    void consume()
+    {
+        if(!m_stopped.load(std::memory_order_acquire))
+        {
+            if(auto lease{m_queue->pop_for(m_queue->poll_interval())}; lease)
+            {
+                try
+                {
+                    std::invoke(m_func, lease->value());
+
+                    if(m_queue->complete(*lease))
+                    {
+                        m_completed.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                catch(...)
+                {
+                    //The lease is left to expire, like the one of a crashed consumer
+                }
+            }
+
+            if(!m_stopped.load(std::memory_order_acquire))
+            {
+                submit();
+                return;
+            }
+        }
+
+        m_pending.release();
+    }
+
+private:
+    thread_pool* m_pool{};
+    shared_work_queue<T>* m_queue{};
+    Func m_func;
+    std::atomic<bool> m_stopped{};
+    std::atomic<std::uint64_t> m_completed{};
+    impl::pending_counter m_pending{};
+};
+
+template<typename T, typename Func>
+shared_work_consumer(thread_pool&, shared_work_queue<T>&, Func, std::size_t = 1) -> shared_work_consumer<T, Func>;
+
+}
+
+#endif
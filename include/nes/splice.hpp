@@ -0,0 +1,302 @@
+///////////////////////////////////////////////////////////
+/// Copyright 2020 Alexy Pellegrini
+///
+/// Permission is hereby granted, free of charge,
+/// to any person obtaining a copy of this software
+/// and associated documentation files (the "Software"),
+/// to deal in the Software without restriction,
+/// including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense,
+/// and/or sell copies of the Software, and to permit
+/// persons to whom the Software is furnished to do so,
+/// subject to the following conditions:
+///
+/// The above copyright notice and this permission notice
+/// shall be included in all copies or substantial portions
+/// of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+/// ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+/// TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+/// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+/// SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+/// ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+/// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+///////////////////////////////////////////////////////////
+
+#ifndef NOT_ENOUGH_STANDARDS_SPLICE
+#define NOT_ENOUGH_STANDARDS_SPLICE
+
+#if defined(_WIN32)
+    #define NES_WIN32_SPLICE
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <Windows.h>
+#elif defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+    #define NES_POSIX_SPLICE
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <string.h>
+    #include <sys/uio.h>
+    #if defined(__linux__)
+        #define NES_LINUX_SPLICE
+    #endif
+#else
+    #error "Not enough standards does not support this environment."
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "pipe.hpp"
+
+namespace nes
+{
+
+//Transfers between pipe streams and native handles (files, sockets, ...), including nes::process standard streams.
+//On Linux, the data is moved with splice, tee and vmsplice and never goes through user space, at least one end must be a pipe.
+//Elsewhere, or when the kernel refuses the pair of handles, the data is copied through a buffer.
+//Characters already buffered by the streams are transferred first, so the order of the data is kept.
+
+inline constexpr std::uint64_t transfer_all{std::numeric_limits<std::uint64_t>::max()};
+
+namespace impl
+{
+
+using splice_handle_type = pipe_streambuf::native_handle_type;
+
+inline constexpr std::size_t splice_chunk_size{1 << 16};
+
+#if defined(NES_WIN32_SPLICE)
+
+inline std::string splice_error_message()
+{
+    return "Error " + std::to_string(GetLastError());
+}
+
+inline std::size_t read_some(splice_handle_type handle, char* data, std::size_t size)
+{
+    DWORD readed{};
+    if(!ReadFile(handle, data, static_cast<DWORD>(std::min<std::size_t>(size, std::numeric_limits<DWORD>::max())), &readed, nullptr))
+    {
+        if(GetLastError() == ERROR_BROKEN_PIPE)
+            return 0;
+
+        throw std::runtime_error{"Failed to read. " + splice_error_message()};
+    }
+
+    return static_cast<std::size_t>(readed);
+}
+
+inline void write_all(splice_handle_type handle, const char* data, std::size_t size)
+{
+    while(size != 0)
+    {
+        DWORD written{};
+        if(!WriteFile(handle, data, static_cast<DWORD>(std::min<std::size_t>(size, std::numeric_limits<DWORD>::max())), &written, nullptr))
+            throw std::runtime_error{"Failed to write. " + splice_error_message()};
+
+        data += written;
+        size -= static_cast<std::size_t>(written);
+    }
+}
+
+#else
+
+inline std::size_t read_some(splice_handle_type handle, char* data, std::size_t size)
+{
+    while(true)
+    {
+        const auto readed{::read(handle, data, size)};
+        if(readed >= 0)
+            return static_cast<std::size_t>(readed);
+
+        if(errno != EINTR)
+            throw std::runtime_error{"Failed to read. " + std::string{strerror(errno)}};
+    }
+}
+
+inline void write_all(splice_handle_type handle, const char* data, std::size_t size)
+{
+    while(size != 0)
+    {
+        const auto written{::write(handle, data, size)};
+        if(written < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            throw std::runtime_error{"Failed to write. " + std::string{strerror(errno)}};
+        }
+
+        data += written;
+        size -= static_cast<std::size_t>(written);
+    }
+}
+
+#endif
+
+inline std::uint64_t copy_handles(splice_handle_type input, splice_handle_type output, std::uint64_t count)
+{
+    std::vector<char> buffer(static_cast<std::size_t>(std::min<std::uint64_t>(count, splice_chunk_size)));
+    std::uint64_t moved{};
+
+    while(moved < count)
+    {
+        const auto readed{read_some(input, std::data(buffer), static_cast<std::size_t>(std::min<std::uint64_t>(count - moved, std::size(buffer))))};
+        if(readed == 0)
+            break;
+
+        write_all(output, std::data(buffer), readed);
+        moved += readed;
+    }
+
+    return moved;
+}
+
+inline std::uint64_t splice_handles(splice_handle_type input, splice_handle_type output, std::uint64_t count)
+{
+#if defined(NES_LINUX_SPLICE)
+    std::uint64_t moved{};
+
+    while(moved < count)
+    {
+        const auto size{static_cast<std::size_t>(std::min<std::uint64_t>(count - moved, splice_chunk_size))};
+        const auto spliced{::splice(input, nullptr, output, nullptr, size, SPLICE_F_MOVE | SPLICE_F_MORE)};
+
+        if(spliced == 0)
+            break;
+
+        if(spliced < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            //Neither handle is a pipe, or the file system does not support splice
+            if(errno == EINVAL && moved == 0)
+                return copy_handles(input, output, count);
+
+            throw std::runtime_error{"Failed to splice. " + std::string{strerror(errno)}};
+        }
+
+        moved += static_cast<std::uint64_t>(spliced);
+    }
+
+    return moved;
+#else
+    return copy_handles(input, output, count);
+#endif
+}
+
+//Gives the characters buffered by input to output, returns how many were written
+inline std::uint64_t transfer_buffered(pipe_streambuf& input, splice_handle_type output, std::uint64_t count)
+{
+    const auto available{static_cast<std::uint64_t>(std::max<std::streamsize>(input.in_avail(), 0))};
+    const auto size{static_cast<std::size_t>(std::min(available, count))};
+
+    if(size == 0)
+        return 0;
+
+    std::vector<char> buffer(size);
+    input.sgetn(std::data(buffer), static_cast<std::streamsize>(size));
+    write_all(output, std::data(buffer), size);
+
+    return size;
+}
+
+}
+
+//Moves count bytes, or everything until input is closed, from input to output. Returns the number of bytes moved.
+inline std::uint64_t splice(pipe_istream& input, pipe_ostream& output, std::uint64_t count = transfer_all)
+{
+    output.flush();
+
+    const auto buffered{impl::transfer_buffered(*input.rdbuf(), output.rdbuf()->native_handle(), count)};
+
+    return buffered + impl::splice_handles(input.rdbuf()->native_handle(), output.rdbuf()->native_handle(), count - buffered);
+}
+
+//Moves data from a pipe stream to a native handle, like a file opened for writing
+inline std::uint64_t splice(pipe_istream& input, pipe_streambuf::native_handle_type output, std::uint64_t count = transfer_all)
+{
+    const auto buffered{impl::transfer_buffered(*input.rdbuf(), output, count)};
+
+    return buffered + impl::splice_handles(input.rdbuf()->native_handle(), output, count - buffered);
+}
+
+//Moves data from a native handle, like a file opened for reading, to a pipe stream
+inline std::uint64_t splice(pipe_streambuf::native_handle_type input, pipe_ostream& output, std::uint64_t count = transfer_all)
+{
+    output.flush();
+
+    return impl::splice_handles(input, output.rdbuf()->native_handle(), count);
+}
+
+#if defined(NES_LINUX_SPLICE)
+
+//Copies up to count bytes available in the input pipe to the output pipe without consuming them, and without waiting for more data.
+//Returns the number of bytes copied, 0 if input is empty and closed. Only available on Linux.
+inline std::uint64_t tee(pipe_istream& input, pipe_ostream& output, std::uint64_t count = transfer_all)
+{
+    assert(input.rdbuf()->in_avail() <= 0 && "nes::tee called with characters buffered by the input stream, they are not in the pipe anymore.");
+
+    output.flush();
+
+    while(true)
+    {
+        const auto size{static_cast<std::size_t>(std::min<std::uint64_t>(count, std::numeric_limits<std::ptrdiff_t>::max()))};
+        const auto copied{::tee(input.rdbuf()->native_handle(), output.rdbuf()->native_handle(), size, 0)};
+
+        if(copied >= 0)
+            return static_cast<std::uint64_t>(copied);
+
+        if(errno != EINTR)
+            throw std::runtime_error{"Failed to tee. " + std::string{strerror(errno)}};
+    }
+}
+
+#endif
+
+//Writes data to the pipe. On Linux, the pages of data are mapped in the pipe instead of being copied:
+//data must not be modified or freed until the reader consumed it. Elsewhere this is a plain write.
+inline void vmsplice(pipe_ostream& output, std::span<const char> data)
+{
+    output.flush();
+
+#if defined(NES_LINUX_SPLICE)
+    while(!std::empty(data))
+    {
+        iovec vector{const_cast<char*>(std::data(data)), std::size(data)};
+
+        const auto moved{::vmsplice(output.rdbuf()->native_handle(), &vector, 1, 0)};
+        if(moved < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            throw std::runtime_error{"Failed to vmsplice. " + std::string{strerror(errno)}};
+        }
+
+        data = data.subspan(static_cast<std::size_t>(moved));
+    }
+#else
+    impl::write_all(output.rdbuf()->native_handle(), std::data(data), std::size(data));
+#endif
+}
+
+}
+
+#endif
@@ -0,0 +1,308 @@
+///////////////////////////////////////////////////////////
+/// Copyright 2020 Alexy Pellegrini
+///
+/// Permission is hereby granted, free of charge,
+/// to any person obtaining a copy of this software
+/// and associated documentation files (the "Software"),
+/// to deal in the Software without restriction,
+/// including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense,
+/// and/or sell copies of the Software, and to permit
+/// persons to whom the Software is furnished to do so,
+/// subject to the following conditions:
+///
+/// The above copyright notice and this permission notice
+/// shall be included in all copies or substantial portions
+/// of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+/// ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+/// TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+/// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+/// SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+/// ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+/// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+///////////////////////////////////////////////////////////
+
+#ifndef NOT_ENOUGH_STANDARDS_STATIC_TASK_GRAPH
+#define NOT_ENOUGH_STANDARDS_STATIC_TASK_GRAPH
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <tuple>
+#include <utility>
+
+#include "thread_pool.hpp"
+
+namespace nes
+{
+
+//Indices of the nodes that must complete before a node may run.
+template<std::size_t... Dependencies>
+struct depends_on
+{
+    static constexpr std::array<std::size_t, sizeof...(Dependencies)> indices{Dependencies...};
+};
+
+template<typename Func, typename Dependencies = depends_on<>>
+struct static_node
+{
+    using dependencies_type = Dependencies;
+
+    Func func;
+    [[no_unique_address]] Dependencies dependencies{};
+};
+
+template<typename Func>
+static_node(Func) -> static_node<Func>;
+template<typename Func, std::size_t... Dependencies>
+static_node(Func, depends_on<Dependencies...>) -> static_node<Func, depends_on<Dependencies...>>;
+
+namespace impl
+{
+
+template<std::size_t NodeCount>
+struct static_graph_edges
+{
+    std::array<std::uint32_t, NodeCount> in_degrees{};
+    std::array<std::size_t, NodeCount> successor_counts{};
+    std::array<std::array<std::size_t, NodeCount>, NodeCount> successors{};
+};
+
+//Nodes may only depend on nodes declared before them, once each, so every graph is acyclic by construction.
+template<typename... Nodes>
+consteval bool is_valid_static_graph()
+{
+    std::size_t node{};
+    bool valid{true};
+
+    ([&]()
+    {
+        const auto& indices{Nodes::dependencies_type::indices};
+
+        for(std::size_t i{}; i < std::size(indices); ++i)
+        {
+            valid = valid && indices[i] < node;
+
+            for(std::size_t j{}; j < i; ++j)
+            {
+                valid = valid && indices[i] != indices[j];
+            }
+        }
+
+        ++node;
+    }(), ...);
+
+    return valid;
+}
+
+template<typename... Nodes>
+consteval auto make_static_graph_edges()
+{
+    static_graph_edges<sizeof...(Nodes)> output{};
+    std::size_t node{};
+
+    ([&]()
+    {
+        for(const std::size_t dependency : Nodes::dependencies_type::indices)
+        {
+            output.successors[dependency][output.successor_counts[dependency]++] = node;
+            ++output.in_degrees[node];
+        }
+
+        ++node;
+    }(), ...);
+
+    return output;
+}
+
+}
+
+//A task graph whose shape is known at compile time.
+//Dependency counts and successor lists are constant tables, and every node is called directly through its own type,
+//so running the graph allocates nothing and involves no indirect call besides one pool task per extra ready successor,
+//and one call through a constant table per node run inline.
+//When a node completes, the first successor it makes ready runs next on the same thread, the others are pushed to the pool.
+//Nodes run inline one after the other in a loop, so a long chain does not grow the stack.
+//On a bounded pool, a node run by the thread calling run may wait for room in the pool before pushing its successors,
+//and with caller_runs it runs them on its own stack instead.
+template<typename... Nodes>
+class static_task_graph
+{
+    static_assert(sizeof...(Nodes) > 0, "nes::static_task_graph must contain at least one node");
+    static_assert(impl::is_valid_static_graph<Nodes...>(), "nes::static_task_graph nodes may only depend once on nodes declared before them");
+
+    static constexpr std::size_t node_count{sizeof...(Nodes)};
+    static constexpr impl::static_graph_edges<node_count> edges{impl::make_static_graph_edges<Nodes...>()};
+
+public:
+    explicit static_task_graph(Nodes... nodes)
+    :m_nodes{std::move(nodes)...}
+    {
+
+    }
+
+    ~static_task_graph() = default;
+    static_task_graph(const static_task_graph&) = delete;
+    static_task_graph& operator=(const static_task_graph&) = delete;
+    static_task_graph(static_task_graph&&) = delete;
+    static_task_graph& operator=(static_task_graph&&) = delete;
+
+    //Runs every node once and blocks until all of them completed, running pool tasks in the meantime.
+    //Once a node throws, the nodes that did not start yet are skipped and the first exception is rethrown here.
+    //A graph must not be run concurrently with itself.
+    void run(thread_pool& pool)
+    {
+        m_pool = &pool;
+        m_failed.store(false, std::memory_order_relaxed);
+        m_error = nullptr;
+
+        for(std::size_t i{}; i < node_count; ++i)
+        {
+            m_remaining[i].store(edges.in_degrees[i], std::memory_order_relaxed);
+        }
+
+        m_pending.add(node_count);
+
+        [this]<std::size_t... Indices>(std::index_sequence<Indices...>)
+        {
+            ([this]()
+            {
+                if constexpr(edges.in_degrees[Indices] == 0)
+                {
+                    submit<Indices>();
+                }
+            }(), ...);
+        }(std::make_index_sequence<node_count>{});
+
+        m_pending.wait([this]()
+        {
+            return impl::run_pending_task(*m_pool);
+        });
+
+        if(m_error)
+        {
+            std::rethrow_exception(std::exchange(m_error, nullptr));
+        }
+    }
+
+    static constexpr std::size_t size() noexcept
+    {
+        return node_count;
+    }
+
+private:
+    template<std::size_t Index>
+    void submit()
+    {
+        m_pool->execute([this]()
+        {
+            run_from(Index);
+        });
+    }
+
+    void run_from(std::size_t index) noexcept
+    {
+        using runner_type = std::size_t(static_task_graph::*)() noexcept;
+
+        static constexpr auto runners{[]<std::size_t... Indices>(std::index_sequence<Indices...>)
+        {
+            return std::array<runner_type, node_count>{&static_task_graph::run_node<Indices>...};
+        }(std::make_index_sequence<node_count>{})};
+
+        while(index != node_count)
+        {
+            index = (this->*runners[index])();
+        }
+    }
+
+    //Returns the successor to run next on this thread, node_count if there is none
+    template<std::size_t Index>
+    std::size_t run_node() noexcept
+    {
+        if(!m_failed.load(std::memory_order_relaxed))
+        {
+            try
+            {
+                std::invoke(std::get<Index>(m_nodes).func);
+            }
+            catch(...)
+            {
+                std::lock_guard lock{m_mutex};
+
+                if(!m_failed.exchange(true, std::memory_order_relaxed))
+                {
+                    m_error = std::current_exception();
+                }
+            }
+        }
+
+        const std::size_t next{release_successors<Index>(std::make_index_sequence<edges.successor_counts[Index]>{})};
+
+        //The graph may be destroyed as soon as the last node is released, when next is node_count
+        m_pending.release();
+
+        return next;
+    }
+
+    template<std::size_t Index, std::size_t... Successors>
+    std::size_t release_successors(std::index_sequence<Successors...>) noexcept
+    {
+        if constexpr(sizeof...(Successors) > 0)
+        {
+            constexpr std::array<std::size_t, sizeof...(Successors)> successors{edges.successors[Index][Successors]...};
+
+            const std::array<bool, sizeof...(Successors)> ready{(m_remaining[successors[Successors]].fetch_sub(1, std::memory_order_acq_rel) == 1)...};
+
+            std::size_t inlined{std::size(ready)};
+            for(std::size_t i{}; i < std::size(ready); ++i)
+            {
+                if(ready[i])
+                {
+                    inlined = i;
+                    break;
+                }
+            }
+
+            //Workers of the pool never wait for room and a lazy pool keeps its current workers when spawning fails,
+            //so execute may only throw on allocation failure, there is no way to recover a consistent graph from that.
+            //Outside of the workers, a bounded pool makes execute wait for room, or run the successor here with caller_runs.
+            ([&]()
+            {
+                if(ready[Successors] && Successors != inlined)
+                {
+                    submit<successors[Successors]>();
+                }
+            }(), ...);
+
+            return inlined != std::size(ready) ? successors[inlined] : node_count;
+        }
+        else
+        {
+            return node_count;
+        }
+    }
+
+private:
+    std::tuple<Nodes...> m_nodes;
+    std::array<std::atomic<std::uint32_t>, node_count> m_remaining{};
+    thread_pool* m_pool{};
+    impl::pending_counter m_pending{};
+    std::atomic<bool> m_failed{};
+    std::mutex m_mutex{};
+    std::exception_ptr m_error{};
+};
+
+template<typename... Nodes>
+static_task_graph(Nodes...) -> static_task_graph<Nodes...>;
+
+}
+
+#endif
@@ -0,0 +1,376 @@
+///////////////////////////////////////////////////////////
+/// Copyright 2020 Alexy Pellegrini
+///
+/// Permission is hereby granted, free of charge,
+/// to any person obtaining a copy of this software
+/// and associated documentation files (the "Software"),
+/// to deal in the Software without restriction,
+/// including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense,
+/// and/or sell copies of the Software, and to permit
+/// persons to whom the Software is furnished to do so,
+/// subject to the following conditions:
+///
+/// The above copyright notice and this permission notice
+/// shall be included in all copies or substantial portions
+/// of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+/// ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+/// TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+/// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+/// SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+/// ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+/// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+///////////////////////////////////////////////////////////
+
+#ifndef NOT_ENOUGH_STANDARDS_STRAND
+#define NOT_ENOUGH_STANDARDS_STRAND
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "thread_pool.hpp"
+
+namespace nes
+{
+
+namespace impl
+{
+
+class strand_node_base
+{
+public:
+    strand_node_base() = default;
+    virtual ~strand_node_base() = default;
+    strand_node_base(const strand_node_base&) = delete;
+    strand_node_base& operator=(const strand_node_base&) = delete;
+    strand_node_base(strand_node_base&&) = delete;
+    strand_node_base& operator=(strand_node_base&&) = delete;
+
+    //The base is only instantiated as the queue stub, which is never executed
+    virtual void execute() {}
+
+    std::atomic<strand_node_base*> next{};
+};
+
+template<typename Func>
+class strand_node final : public strand_node_base
+{
+public:
+    explicit strand_node(Func&& func)
+    :m_func{std::move(func)}
+    {
+
+    }
+
+    ~strand_node() = default;
+    strand_node(const strand_node&) = delete;
+    strand_node& operator=(const strand_node&) = delete;
+    strand_node(strand_node&&) = delete;
+    strand_node& operator=(strand_node&&) = delete;
+
+    void execute() override
+    {
+        m_func();
+    }
+
+private:
+    Func m_func;
+};
+
+}
+
+//Runs the tasks posted to it one at a time, in posting order, on the workers of a thread pool.
+//Posting is lock-free (intrusive multi-producer single-consumer queue) and a strand only occupies a worker while it has tasks,
+//so a strand costs a few pointers when idle. A busy strand gives its worker back after batch_size tasks and requeues itself.
+class strand
+{
+public:
+    static constexpr std::size_t batch_size{64};
+
+public:
+    explicit strand(thread_pool& pool) noexcept
+    :m_pool{&pool}
+    {
+
+    }
+
+    //Waits for the tasks already posted to complete, helping the pool meanwhile when called from one of its workers.
+    //A strand can not be destroyed by one of its own tasks, it would wait for itself: this terminates instead of deadlocking.
+    ~strand()
+    {
+        if(running_in_this_thread())
+        {
+            assert(false && "nes::strand destroyed from one of its own tasks.");
+            std::terminate();
+        }
+
+        m_pending.wait([this]()
+        {
+            return impl::run_pending_task(*m_pool);
+        });
+    }
+
+    strand(const strand&) = delete;
+    strand& operator=(const strand&) = delete;
+    strand(strand&&) = delete;
+    strand& operator=(strand&&) = delete;
+
+    //Like with thread_pool::execute, an exception escaping func is not caught, the following tasks still run.
+    template<typename Func, typename... Args>
+    void execute(Func&& func, Args&&... args)
+    {
+        push([func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+        {
+            std::invoke(std::forward<Func>(func), std::forward<Args>(args)...);
+        });
+    }
+
+    template<typename Func, typename... Args>
+    auto invoke(Func&& func, Args&&... args)
+    {
+        using return_type  = std::invoke_result_t<Func, Args...>;
+        using promise_type = std::promise<return_type>;
+        using future_type  = std::future<return_type>;
+
+        promise_type promise{};
+        future_type  future {promise.get_future()};
+
+        if constexpr(std::is_same_v<return_type, void>)
+        {
+            push([promise = std::move(promise), func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+            {
+                try
+                {
+                    std::invoke(std::forward<Func>(func), std::forward<Args>(args)...);
+                    promise.set_value();
+                }
+                catch(...)
+                {
+                    promise.set_exception(std::current_exception());
+                }
+            });
+        }
+        else
+        {
+            push([promise = std::move(promise), func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+            {
+                try
+                {
+                    promise.set_value(std::invoke(std::forward<Func>(func), std::forward<Args>(args)...));
+                }
+                catch(...)
+                {
+                    promise.set_exception(std::current_exception());
+                }
+            });
+        }
+
+        return future;
+    }
+
+    //True if the calling thread is currently running a task of this strand.
+    bool running_in_this_thread() const noexcept
+    {
+        return current_strand() == this;
+    }
+
+    thread_pool& pool() const noexcept
+    {
+        return *m_pool;
+    }
+
+private:
+    template<typename Func>
+    void push(Func&& func)
+    {
+        push_node(new impl::strand_node<std::decay_t<Func>>{std::forward<Func>(func)});
+
+        m_pending.add();
+        if(m_count.fetch_add(1, std::memory_order_acq_rel) == 0)
+        {
+            schedule();
+        }
+    }
+
+    void schedule()
+    {
+        m_pool->execute([this]()
+        {
+            drain();
+        });
+    }
+
+    //Runs batch_size tasks at most, then gives the worker back and requeues the strand if tasks remain.
+    //If the pool does not take the strand back, the draining goes on here instead of recursing into drain.
+    //A task that throws ends the batch, the first exception is rethrown once the strand is requeued or empty.
+    void drain()
+    {
+        const strand* previous{std::exchange(current_strand(), this)};
+        std::exception_ptr error{};
+        bool finished{};
+
+        while(!finished)
+        {
+            bool thrown{};
+            for(std::size_t i{}; i < batch_size && !finished && !thrown; ++i)
+            {
+                std::unique_ptr<impl::strand_node_base> node{pop()};
+
+                try
+                {
+                    node->execute();
+                }
+                catch(...)
+                {
+                    thrown = true;
+                    if(!error)
+                    {
+                        error = std::current_exception();
+                    }
+                }
+
+                node.reset();
+
+                //If it was the last posted task, the strand may be destroyed at any time after the release
+                finished = m_count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+                m_pending.release();
+            }
+
+            if(!finished && requeue())
+            {
+                break;
+            }
+        }
+
+        current_strand() = previous;
+
+        if(error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+    //Returns false if the pool did not take the strand: execute threw, or ran the task inline
+    //(caller_runs or a worker of a full pool), in which case the task returns at once.
+    bool requeue() noexcept
+    {
+        bool ran_inline{};
+
+        try
+        {
+            m_pool->execute([this, &ran_inline]()
+            {
+                //Only reached through execute itself, ran_inline is still alive then
+                if(running_in_this_thread())
+                {
+                    ran_inline = true;
+                    return;
+                }
+
+                drain();
+            });
+        }
+        catch(...)
+        {
+            return false;
+        }
+
+        return !ran_inline;
+    }
+
+    //Vyukov's intrusive queue: the producer that swaps the head links the previous node afterwards,
+    //so the consumer may briefly see a pushed node unlinked.
+    void push_node(impl::strand_node_base* node) noexcept
+    {
+        node->next.store(nullptr, std::memory_order_relaxed);
+
+        auto* previous{m_head.exchange(node, std::memory_order_acq_rel)};
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    //Only called by the draining thread, when m_count guarantees that a node has been pushed.
+    impl::strand_node_base* pop() noexcept
+    {
+        while(true)
+        {
+            if(auto* node{try_pop()}; node)
+            {
+                return node;
+            }
+
+            std::this_thread::yield();
+        }
+    }
+
+    impl::strand_node_base* try_pop() noexcept
+    {
+        auto* tail{m_tail};
+        auto* next{tail->next.load(std::memory_order_acquire)};
+
+        if(tail == &m_stub)
+        {
+            if(!next)
+            {
+                return nullptr;
+            }
+
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if(next)
+        {
+            m_tail = next;
+            return tail;
+        }
+
+        if(tail != m_head.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+
+        //tail is the last node, put the stub behind it so it can be detached
+        push_node(&m_stub);
+
+        next = tail->next.load(std::memory_order_acquire);
+        if(next)
+        {
+            m_tail = next;
+            return tail;
+        }
+
+        return nullptr;
+    }
+
+    static const strand*& current_strand() noexcept
+    {
+        static thread_local const strand* current{};
+
+        return current;
+    }
+
+private:
+    thread_pool* m_pool{};
+    impl::strand_node_base m_stub{};
+    std::atomic<impl::strand_node_base*> m_head{&m_stub};
+    impl::strand_node_base* m_tail{&m_stub};
+    std::atomic<std::size_t> m_count{};
+    impl::pending_counter m_pending{};
+};
+
+}
+
+#endif
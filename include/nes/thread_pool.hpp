@@ -29,7 +29,19 @@
 #ifndef NOT_ENOUGH_STANDARDS_THREAD_POOL
 #define NOT_ENOUGH_STANDARDS_THREAD_POOL
 
+#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+    #define NES_POSIX_THREAD_POOL
+    #include <pthread.h>
+    #include <sched.h>
+    #include <unistd.h>
+    #include <sys/resource.h>
+    #if defined(__linux__)
+        #include <sys/syscall.h>
+    #endif
+#endif
+
 #include <vector>
+#include <deque>
 #include <atomic>
 #include <thread>
 #include <future>
@@ -37,16 +49,435 @@
 #include <mutex>
 #include <functional>
 #include <variant>
+#include <optional>
 #include <cassert>
 #include <span>
+#include <initializer_list>
 #include <utility>
+#include <memory>
+#include <memory_resource>
+#include <limits>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <array>
+#include <charconv>
+#include <system_error>
+#include <exception>
+
+#include "hash.hpp"
 
 namespace nes
 {
 
+class thread_pool;
+class task_group;
+
+class scratch_arena final : public std::pmr::memory_resource
+{
+public:
+    static constexpr std::size_t default_block_size{64 * 1024};
+
+public:
+    explicit scratch_arena(std::size_t block_size = default_block_size)
+    :m_block_size{block_size != 0 ? block_size : default_block_size}
+    {
+
+    }
+
+    ~scratch_arena() = default;
+    scratch_arena(const scratch_arena&) = delete;
+    scratch_arena& operator=(const scratch_arena&) = delete;
+    scratch_arena(scratch_arena&&) = delete;
+    scratch_arena& operator=(scratch_arena&&) = delete;
+
+    template<typename T>
+    std::span<T> allocate_span(std::size_t count)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "nes::scratch_arena never calls destructors.");
+
+        T* const data{static_cast<T*>(do_allocate(count * sizeof(T), alignof(T)))};
+        std::uninitialized_value_construct_n(data, count);
+
+        return std::span<T>{data, count};
+    }
+
+    //Releases everything allocated since the last reset. If the previous cycle needed more than one block,
+    //they are merged so the next cycle fits in a single block and does not allocate at all.
+    void reset() noexcept
+    {
+        if(std::size(m_blocks) > 1)
+        {
+            std::size_t total{};
+            for(auto&& block : m_blocks)
+            {
+                total += block.size;
+            }
+
+            m_blocks.clear();
+
+            try
+            {
+                push_block(total);
+            }
+            catch(...)
+            {
+                m_blocks.clear();
+            }
+        }
+
+        m_current = 0;
+        m_offset = 0;
+    }
+
+    std::size_t capacity() const noexcept
+    {
+        std::size_t total{};
+        for(auto&& block : m_blocks)
+        {
+            total += block.size;
+        }
+
+        return total;
+    }
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        while(m_current < std::size(m_blocks))
+        {
+            auto& block{m_blocks[m_current]};
+
+            const auto base   {reinterpret_cast<std::uintptr_t>(block.data.get())};
+            const auto aligned{(base + m_offset + alignment - 1) & ~(static_cast<std::uintptr_t>(alignment) - 1)};
+
+            if(aligned + bytes <= base + block.size)
+            {
+                m_offset = static_cast<std::size_t>(aligned + bytes - base);
+
+                return reinterpret_cast<void*>(aligned);
+            }
+
+            ++m_current;
+            m_offset = 0;
+        }
+
+        push_block(std::max(m_block_size, bytes + alignment));
+
+        return do_allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override
+    {
+
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    void push_block(std::size_t size)
+    {
+        m_blocks.emplace_back(block{std::make_unique<std::byte[]>(size), size});
+    }
+
+private:
+    struct block
+    {
+        std::unique_ptr<std::byte[]> data{};
+        std::size_t size{};
+    };
+
+private:
+    std::size_t m_block_size{};
+    std::vector<block> m_blocks{};
+    std::size_t m_current{};
+    std::size_t m_offset{};
+};
+
+//A versioned value read by cached task_builder tasks. Call invalidate() each time the value changes:
+//when a task_list is pushed again, cached tasks whose inputs all kept their version reuse their previous result instead of running.
+class task_input
+{
+public:
+    task_input() = default;
+    ~task_input() = default;
+    task_input(const task_input&) = delete;
+    task_input& operator=(const task_input&) = delete;
+    task_input(task_input&&) = delete;
+    task_input& operator=(task_input&&) = delete;
+
+    void invalidate() noexcept
+    {
+        m_version.fetch_add(1, std::memory_order_release);
+    }
+
+    std::uint64_t version() const noexcept
+    {
+        return m_version.load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<std::uint64_t> m_version{};
+};
+
+class task_inputs
+{
+    friend class task_builder;
+
+public:
+    task_inputs(std::initializer_list<std::reference_wrapper<const task_input>> inputs)
+    {
+        m_inputs.reserve(std::size(inputs));
+
+        for(const task_input& input : inputs)
+        {
+            m_inputs.emplace_back(&input);
+        }
+    }
+
+    ~task_inputs() = default;
+    task_inputs(const task_inputs&) = default;
+    task_inputs& operator=(const task_inputs&) = default;
+    task_inputs(task_inputs&&) = default;
+    task_inputs& operator=(task_inputs&&) = default;
+
+private:
+    std::vector<const task_input*> m_inputs{};
+};
+
 namespace impl
 {
 
+inline constexpr std::size_t cache_line_size{64};
+
+template<typename T>
+struct alignas(cache_line_size) padded_value
+{
+    T value{};
+};
+
+struct worker_context
+{
+    thread_pool* pool{};
+    std::size_t index{};
+    scratch_arena* arena{};
+};
+
+inline thread_local worker_context* this_worker_context{};
+
+inline void notify_worker(thread_pool& pool) noexcept;
+
+//Counts tasks that have been handed to a pool but have not finished yet.
+//wait() runs the help function while tasks are pending, and only sleeps when it returns false.
+class pending_counter
+{
+public:
+    pending_counter() = default;
+    ~pending_counter() = default;
+    pending_counter(const pending_counter&) = delete;
+    pending_counter& operator=(const pending_counter&) = delete;
+    pending_counter(pending_counter&&) = delete;
+    pending_counter& operator=(pending_counter&&) = delete;
+
+    void add(std::size_t count = 1) noexcept
+    {
+        m_pending.fetch_add(count, std::memory_order_relaxed);
+        m_pending.notify_all();
+    }
+
+    void release() noexcept
+    {
+        //m_notifying keeps wait() from returning, and the owner from being destroyed, until notify_all is done with m_pending
+        m_notifying.fetch_add(1, std::memory_order_acq_rel);
+
+        if(m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            m_pending.notify_all();
+        }
+
+        m_notifying.fetch_sub(1, std::memory_order_release);
+    }
+
+    template<typename HelpFunc>
+    void wait(HelpFunc&& help) noexcept
+    {
+        while(true)
+        {
+            const std::size_t pending{m_pending.load(std::memory_order_acquire)};
+            if(pending == 0)
+            {
+                while(m_notifying.load(std::memory_order_acquire) != 0)
+                {
+                    std::this_thread::yield();
+                }
+
+                return;
+            }
+
+            if(!help())
+            {
+                m_pending.wait(pending, std::memory_order_acquire);
+            }
+        }
+    }
+
+private:
+    std::atomic<std::size_t> m_pending{};
+    std::atomic<std::size_t> m_notifying{};
+};
+
+//Child of a task_group spawned from one of the pool's workers. run() executes and frees it.
+class spawned_task
+{
+public:
+    using run_type = void(*)(spawned_task*) noexcept;
+
+public:
+    explicit spawned_task(run_type run) noexcept
+    :m_run{run}
+    {
+
+    }
+
+    ~spawned_task() = default;
+    spawned_task(const spawned_task&) = delete;
+    spawned_task& operator=(const spawned_task&) = delete;
+    spawned_task(spawned_task&&) = delete;
+    spawned_task& operator=(spawned_task&&) = delete;
+
+    void run() noexcept
+    {
+        m_run(this);
+    }
+
+private:
+    run_type m_run{};
+};
+
+//Func must not throw, task_group's children catch their exceptions themselves
+template<typename Func>
+class spawned_task_holder final : public spawned_task
+{
+public:
+    explicit spawned_task_holder(Func&& func)
+    :spawned_task{&execute}
+    ,m_func{std::move(func)}
+    {
+
+    }
+
+private:
+    static void execute(spawned_task* task) noexcept
+    {
+        const std::unique_ptr<spawned_task_holder> holder{static_cast<spawned_task_holder*>(task)};
+        holder->m_func();
+    }
+
+private:
+    Func m_func;
+};
+
+//Fixed size work-stealing deque (Chase and Lev, with the C11 orderings of Le et al.): its worker pushes and pops at the bottom
+//without locking, other workers steal from the top with a single compare-exchange.
+class spawn_deque
+{
+public:
+    static constexpr std::int64_t capacity{1024};
+
+public:
+    spawn_deque() = default;
+    ~spawn_deque() = default;
+    spawn_deque(const spawn_deque&) = delete;
+    spawn_deque& operator=(const spawn_deque&) = delete;
+    spawn_deque(spawn_deque&&) = delete;
+    spawn_deque& operator=(spawn_deque&&) = delete;
+
+    //Owner only. Returns false if the deque is full.
+    bool push(spawned_task* task) noexcept
+    {
+        const std::int64_t bottom{m_bottom.value.load(std::memory_order_relaxed)};
+        const std::int64_t top{m_top.value.load(std::memory_order_acquire)};
+
+        if(bottom - top >= capacity)
+        {
+            return false;
+        }
+
+        m_tasks[bottom & (capacity - 1)].store(task, std::memory_order_relaxed);
+        m_bottom.value.store(bottom + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    //Owner only, newest first
+    spawned_task* pop() noexcept
+    {
+        const std::int64_t bottom{m_bottom.value.load(std::memory_order_relaxed) - 1};
+        m_bottom.value.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t top{m_top.value.load(std::memory_order_relaxed)};
+
+        if(top > bottom)
+        {
+            m_bottom.value.store(bottom + 1, std::memory_order_relaxed);
+
+            return nullptr;
+        }
+
+        auto* output{m_tasks[bottom & (capacity - 1)].load(std::memory_order_relaxed)};
+
+        //Last task, a thief may take it at the same time
+        if(top == bottom)
+        {
+            if(!m_top.value.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                output = nullptr;
+            }
+
+            m_bottom.value.store(bottom + 1, std::memory_order_relaxed);
+        }
+
+        return output;
+    }
+
+    //Any thread, oldest first. Returns nullptr if the deque is empty or another thread took the task first.
+    spawned_task* steal() noexcept
+    {
+        std::int64_t top{m_top.value.load(std::memory_order_acquire)};
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const std::int64_t bottom{m_bottom.value.load(std::memory_order_acquire)};
+
+        if(top >= bottom)
+        {
+            return nullptr;
+        }
+
+        auto* output{m_tasks[top & (capacity - 1)].load(std::memory_order_relaxed)};
+
+        if(!m_top.value.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return nullptr;
+        }
+
+        return output;
+    }
+
+    //Approximate when other threads push or take tasks meanwhile
+    bool empty() const noexcept
+    {
+        return m_top.value.load(std::memory_order_seq_cst) >= m_bottom.value.load(std::memory_order_seq_cst);
+    }
+
+private:
+    padded_value<std::atomic<std::int64_t>> m_top{};
+    padded_value<std::atomic<std::int64_t>> m_bottom{};
+    std::unique_ptr<std::atomic<spawned_task*>[]> m_tasks{std::make_unique<std::atomic<spawned_task*>[]>(capacity)};
+};
+
 class checkpoint_holder_base
 {
 public:
@@ -181,60 +612,180 @@ private:
 
 using checkpoint_range = std::span<checkpoint_holder_base*>;
 
-class task_holder_base
+//Shared by the tasks of a task_list: remembers the first exception thrown by one of them,
+//and, in fail fast mode, makes the list skip every task that did not start yet.
+class task_list_state
 {
 public:
-    task_holder_base() = default;
-    virtual ~task_holder_base() = default;
-    task_holder_base(const task_holder_base&) = delete;
-    task_holder_base& operator=(const task_holder_base&) = delete;
-    task_holder_base(task_holder_base&&) = delete;
-    task_holder_base& operator=(task_holder_base&&) = delete;
+    task_list_state() = default;
+    ~task_list_state() = default;
+    task_list_state(const task_list_state&) = delete;
+    task_list_state& operator=(const task_list_state&) = delete;
+    task_list_state(task_list_state&&) = delete;
+    task_list_state& operator=(task_list_state&&) = delete;
 
-    virtual void reset() = 0;
-    virtual void execute() = 0;
-
-    void set_checkpoint_range(checkpoint_range checkpoints)
+    void reset()
     {
-        m_checkpoints = checkpoints;
+        std::lock_guard lock{m_mutex};
+
+        m_error = nullptr;
+        m_failed.store(false, std::memory_order_relaxed);
     }
 
-protected:
-    void trigger_checkpoints()
+    void fail(std::exception_ptr error)
     {
-        for(auto& checkpoint : m_checkpoints)
+        std::lock_guard lock{m_mutex};
+
+        if(!m_error)
         {
-            checkpoint->count_down();
+            m_error = std::move(error);
         }
+
+        m_failed.store(true, std::memory_order_release);
     }
 
-private:
-    checkpoint_range m_checkpoints{};
-};
+    bool is_skipping() const noexcept
+    {
+        return m_fail_fast && m_failed.load(std::memory_order_acquire);
+    }
 
-template<typename Func>
-class task_holder final : public task_holder_base
-{
-public:
-    task_holder(Func&& func)
-    :m_func{std::move(func)}
+    std::exception_ptr error() const
     {
+        std::lock_guard lock{m_mutex};
 
+        return m_error;
     }
 
-    ~task_holder() = default;
-    task_holder(const task_holder&) = delete;
-    task_holder& operator=(const task_holder&) = delete;
-    task_holder(task_holder&&) = delete;
-    task_holder& operator=(task_holder&&) = delete;
-
-    void execute() override
+    void set_fail_fast(bool enabled) noexcept
     {
-        m_func();
-        trigger_checkpoints();
+        m_fail_fast = enabled;
     }
 
-    void reset() override
+private:
+    mutable std::mutex m_mutex{};
+    std::exception_ptr m_error{};
+    std::atomic<bool> m_failed{};
+    bool m_fail_fast{};
+};
+
+class task_holder_base
+{
+public:
+    task_holder_base() = default;
+    virtual ~task_holder_base() = default;
+    task_holder_base(const task_holder_base&) = delete;
+    task_holder_base& operator=(const task_holder_base&) = delete;
+    task_holder_base(task_holder_base&&) = delete;
+    task_holder_base& operator=(task_holder_base&&) = delete;
+
+    virtual void reset() = 0;
+    virtual void execute() = 0;
+
+    //A clean task is completed by its task_list, without being queued, by calling complete_clean()
+    virtual bool is_clean() const noexcept
+    {
+        return false;
+    }
+
+    virtual void complete_clean()
+    {
+
+    }
+
+    //Completes the task without running it, once its list failed in fail fast mode. Results carry the list's first exception.
+    virtual void skip()
+    {
+        trigger_checkpoints();
+    }
+
+    void set_checkpoint_range(checkpoint_range checkpoints)
+    {
+        m_checkpoints = checkpoints;
+    }
+
+    void set_list_state(task_list_state* state) noexcept
+    {
+        m_list_state = state;
+    }
+
+protected:
+    void trigger_checkpoints()
+    {
+        for(auto& checkpoint : m_checkpoints)
+        {
+            checkpoint->count_down();
+        }
+    }
+
+    bool is_skipping() const noexcept
+    {
+        return m_list_state && m_list_state->is_skipping();
+    }
+
+    //Returns false when the task is not part of a task_list, the exception should then propagate like before
+    bool report_error(std::exception_ptr error)
+    {
+        if(!m_list_state)
+        {
+            return false;
+        }
+
+        m_list_state->fail(std::move(error));
+
+        return true;
+    }
+
+    std::exception_ptr list_error() const
+    {
+        return m_list_state->error();
+    }
+
+private:
+    checkpoint_range m_checkpoints{};
+    task_list_state* m_list_state{};
+};
+
+template<typename Func>
+class task_holder final : public task_holder_base
+{
+public:
+    task_holder(Func&& func)
+    :m_func{std::move(func)}
+    {
+
+    }
+
+    ~task_holder() = default;
+    task_holder(const task_holder&) = delete;
+    task_holder& operator=(const task_holder&) = delete;
+    task_holder(task_holder&&) = delete;
+    task_holder& operator=(task_holder&&) = delete;
+
+    void execute() override
+    {
+        if(is_skipping())
+        {
+            skip();
+            return;
+        }
+
+        try
+        {
+            m_func();
+        }
+        catch(...)
+        {
+            //Tasks pushed with thread_pool::execute have no list to carry the exception, they keep terminating like a throwing std::thread
+            if(!report_error(std::current_exception()))
+            {
+                throw;
+            }
+        }
+
+        trigger_checkpoints();
+    }
+
+    void reset() override
     {
 
     }
@@ -261,14 +812,28 @@ public:
 
     void execute() override
     {
-        if constexpr(std::is_same_v<Ret, void>)
+        if(is_skipping())
         {
-            m_func();
-            m_promise.set_value();
+            skip();
+            return;
         }
-        else
+
+        try
+        {
+            if constexpr(std::is_same_v<Ret, void>)
+            {
+                m_func();
+                m_promise.set_value();
+            }
+            else
+            {
+                m_promise.set_value(m_func());
+            }
+        }
+        catch(...)
         {
-            m_promise.set_value(m_func());
+            m_promise.set_exception(std::current_exception());
+            report_error(std::current_exception());
         }
 
         trigger_checkpoints();
@@ -280,714 +845,2430 @@ public:
         m_future  = m_promise.get_future();
     }
 
+    void skip() override
+    {
+        m_promise.set_exception(list_error());
+        trigger_checkpoints();
+    }
+
 private:
     Func m_func;
     std::promise<Ret> m_promise{};
     std::future<Ret>  m_future{};
 };
 
-class task
+//Remembers the input versions seen by its last run, and the result of that run.
+template<typename Func, typename Ret>
+class cached_task_holder final : public task_holder_base
 {
+    static_assert(std::is_void_v<Ret> || std::is_copy_constructible_v<Ret>, "Cached task results must be copy constructible");
+
 public:
-    template<typename Func>
-    task(Func&& func)
-    :m_holder{std::make_unique<task_holder<Func>>(std::forward<Func>(func))}
+    cached_task_holder(Func&& func, std::vector<const task_input*> inputs, std::future<Ret>*& user_reference, const task_input*& output)
+    :m_func{std::move(func)}
+    ,m_inputs{std::move(inputs)}
+    ,m_versions(std::size(m_inputs))
     {
-
+        user_reference = &m_future;
+        output = &m_output;
     }
 
-    template<typename Func, typename Ret>
-    task(Func&& func, std::future<Ret>*& user_reference)
-    :m_holder{std::make_unique<return_task_holder<Func, Ret>>(std::forward<Func>(func), user_reference)}
+    ~cached_task_holder() = default;
+    cached_task_holder(const cached_task_holder&) = delete;
+    cached_task_holder& operator=(const cached_task_holder&) = delete;
+    cached_task_holder(cached_task_holder&&) = delete;
+    cached_task_holder& operator=(cached_task_holder&&) = delete;
+
+    void execute() override
     {
+        if(is_skipping())
+        {
+            skip();
+            return;
+        }
 
-    }
+        //Versions are read before running, so an input changed during the run makes the next push run the task again
+        for(std::size_t i{}; i < std::size(m_inputs); ++i)
+        {
+            m_versions[i] = m_inputs[i]->version();
+        }
 
-    ~task() = default;
-    task(const task&) = delete;
-    task& operator=(const task&) = delete;
-    task(task&&) = default;
-    task& operator=(task&&) = default;
+        try
+        {
+            m_valid = false;
 
-    void set_checkpoint_range(checkpoint_range checkpoints)
-    {
-        m_holder->set_checkpoint_range(checkpoints);
-    }
+            if constexpr(std::is_same_v<Ret, void>)
+            {
+                m_func();
+                m_valid = true;
+                m_promise.set_value();
+            }
+            else
+            {
+                m_cache.emplace(m_func());
+                m_valid = true;
+                m_promise.set_value(*m_cache);
+            }
+        }
+        catch(...)
+        {
+            m_promise.set_exception(std::current_exception());
+            report_error(std::current_exception());
+        }
 
-    void execute()
-    {
-        m_holder->execute();
+        m_output.invalidate();
+        trigger_checkpoints();
     }
 
-    void reset()
+    void skip() override
     {
-        m_holder->reset();
+        m_promise.set_exception(list_error());
+        trigger_checkpoints();
     }
 
-    task_holder_base* holder() const noexcept
+    void reset() override
     {
-        return m_holder.get();
+        m_promise = std::promise<Ret>{};
+        m_future  = m_promise.get_future();
     }
 
-private:
-    std::unique_ptr<task_holder_base> m_holder{};
-};
+    bool is_clean() const noexcept override
+    {
+        if(!m_valid)
+        {
+            return false;
+        }
 
-class fence_holder
-{
-public:
-    fence_holder() = default;
-    ~fence_holder() = default;
-    fence_holder(const fence_holder&) = delete;
-    fence_holder& operator=(const fence_holder&) = delete;
-    fence_holder(fence_holder&&) = delete;
-    fence_holder& operator=(fence_holder&&) = delete;
+        for(std::size_t i{}; i < std::size(m_inputs); ++i)
+        {
+            if(m_versions[i] != m_inputs[i]->version())
+            {
+                return false;
+            }
+        }
 
-    void set_condition(std::condition_variable& condition) noexcept
-    {
-        m_condition = &condition;
+        return true;
     }
 
-    void reset() noexcept
+    void complete_clean() override
     {
-        m_signaled.store(false, std::memory_order_release);
-    }
+        if constexpr(std::is_same_v<Ret, void>)
+        {
+            m_promise.set_value();
+        }
+        else
+        {
+            m_promise.set_value(*m_cache);
+        }
 
-    void signal() noexcept
-    {
-        m_signaled.store(true, std::memory_order_release);
-        m_condition->notify_one();
+        trigger_checkpoints();
     }
 
-    bool is_signaled() const noexcept
-    {
-        return m_signaled.load(std::memory_order_acquire);
-    }
+private:
+    using cache_type = std::conditional_t<std::is_same_v<Ret, void>, std::monostate, std::optional<Ret>>;
 
 private:
-    std::condition_variable* m_condition{};
-    std::atomic<bool> m_signaled{};
+    Func m_func;
+    std::vector<const task_input*> m_inputs{};
+    std::vector<std::uint64_t> m_versions{};
+    cache_type m_cache{};
+    bool m_valid{};
+    task_input m_output{};
+    std::promise<Ret> m_promise{};
+    std::future<Ret>  m_future{};
 };
 
-class fence
+template<typename T, typename Map, typename Combine>
+struct reduce_state
 {
-public:
-    fence()
-    :m_holder{std::make_unique<fence_holder>()}
+    reduce_state(std::size_t chunk_count, T identity, Map map, Combine combine)
+    :partials(chunk_count)
+    ,arrivals(chunk_count)
+    ,identity{std::move(identity)}
+    ,map{std::move(map)}
+    ,combine{std::move(combine)}
     {
 
     }
 
-    ~fence() = default;
-    fence(const fence&) = delete;
-    fence& operator=(const fence&) = delete;
-    fence(fence&&) = default;
-    fence& operator=(fence&&) = default;
-
-    void set_condition(std::condition_variable& condition) noexcept
+    void reset()
     {
-        m_holder->set_condition(condition);
-    }
+        promise = std::promise<T>{};
+        future  = promise.get_future();
 
-    void reset() noexcept
-    {
-        m_holder->reset();
-    }
+        for(auto& arrival : arrivals)
+        {
+            arrival.store(0, std::memory_order_relaxed);
+        }
 
-    void signal() noexcept
-    {
-        m_holder->signal();
+        std::lock_guard lock{error_mutex};
+        error = nullptr;
     }
 
-    bool is_signaled() const noexcept
+    void fail(std::exception_ptr exception)
     {
-        return m_holder->is_signaled();
+        std::lock_guard lock{error_mutex};
+
+        if(!error)
+        {
+            error = std::move(exception);
+        }
     }
 
-    fence_holder* holder() const noexcept
+    //Combines the partials in a tree as chunks complete: at each level, the second chunk of a pair to arrive combines both partials and goes up.
+    //The left partial is always the first argument of combine, so it only has to be associative.
+    //Returns the exception thrown by combine, if any. The tree still completes, and the result then carries the first error.
+    std::exception_ptr arrive(std::size_t chunk)
     {
-        return m_holder.get();
-    }
+        std::exception_ptr output{};
+        const std::size_t chunk_count{std::size(partials)};
+        std::size_t index{chunk};
 
-private:
-    std::unique_ptr<fence_holder> m_holder{};
-};
+        for(std::size_t step{1}; step < chunk_count; step *= 2)
+        {
+            const std::size_t left{index - index % (2 * step)};
+            const std::size_t right{left + step};
 
-using task_type = std::variant<checkpoint, task, fence>;
+            if(right < chunk_count)
+            {
+                //Each index is the right side of exactly one pair, so it can hold that pair's arrival counter
+                if(arrivals[right].fetch_add(1, std::memory_order_acq_rel) == 0)
+                {
+                    return output;
+                }
 
-}
+                try
+                {
+                    partials[left].value = std::invoke(combine, std::move(partials[left].value), std::move(partials[right].value));
+                }
+                catch(...)
+                {
+                    output = std::current_exception();
+                    fail(output);
+                }
+            }
 
-template<typename T>
-class task_result
-{
-    friend class task_builder;
+            index = left;
+        }
 
-public:
-    task_result() = default;
-    ~task_result() = default;
-    task_result(const task_result&) = delete;
-    task_result& operator=(const task_result&) = delete;
+        std::lock_guard lock{error_mutex};
 
-    task_result(task_result&& other) noexcept
-    :m_state{std::exchange(other.m_state, nullptr)}
-    {
-
-    }
-
-    task_result& operator=(task_result&& other) noexcept
-    {
-        m_state = std::exchange(other.m_state, nullptr);
+        if(error)
+        {
+            promise.set_exception(error);
+        }
+        else
+        {
+            promise.set_value(std::move(partials[0].value));
+        }
 
-        return *this;
+        return output;
     }
 
-    T get()
-    {
-        return m_state->get();
-    }
+    std::vector<padded_value<T>> partials;
+    std::vector<std::atomic<std::uint32_t>> arrivals;
+    T identity;
+    Map map;
+    Combine combine;
+    std::promise<T> promise{};
+    std::future<T>  future{};
+    std::mutex error_mutex{};
+    std::exception_ptr error{};
+};
 
-    bool valid() const noexcept
+template<typename State>
+class reduce_task_holder final : public task_holder_base
+{
+public:
+    reduce_task_holder(std::shared_ptr<State> state, std::size_t chunk, std::uint64_t begin, std::uint64_t count, std::uint32_t x, std::uint32_t y)
+    :m_state{std::move(state)}
+    ,m_chunk{chunk}
+    ,m_begin{begin}
+    ,m_count{count}
+    ,m_x{x}
+    ,m_y{y}
     {
-        return m_state->valid();
-    }
 
-    void wait() const
-    {
-        m_state->wait();
     }
 
-    template<class Rep, class Period>
-    bool wait_for(const std::chrono::duration<Rep, Period>& timeout) const
-    {
-        return m_state->wait_for(timeout) == std::future_status::ready;
-    }
+    ~reduce_task_holder() = default;
+    reduce_task_holder(const reduce_task_holder&) = delete;
+    reduce_task_holder& operator=(const reduce_task_holder&) = delete;
+    reduce_task_holder(reduce_task_holder&&) = delete;
+    reduce_task_holder& operator=(reduce_task_holder&&) = delete;
 
-    template<class Rep, class Period>
-    bool wait_until(const std::chrono::duration<Rep, Period>& timeout) const
+    void execute() override
     {
-        return m_state->wait_until(timeout) == std::future_status::ready;
-    }
+        if(is_skipping())
+        {
+            skip();
+            return;
+        }
 
-private:
-    std::future<T>* m_state{};
-};
+        try
+        {
+            auto partial{m_state->identity};
 
-using task_checkpoint = task_result<void>;
+            for(std::uint64_t i{m_begin}; i < m_begin + m_count; ++i)
+            {
+                const auto current_x{static_cast<std::uint32_t>(i % m_x)};
+                const auto current_y{static_cast<std::uint32_t>((i / m_x) % m_y)};
+                const auto current_z{static_cast<std::uint32_t>(i / (static_cast<std::uint64_t>(m_x) * m_y))};
 
-class task_fence
-{
-    friend class task_builder;
+                partial = std::invoke(m_state->combine, std::move(partial), std::invoke(m_state->map, current_x, current_y, current_z));
+            }
 
-public:
-    task_fence() = default;
-    ~task_fence() = default;
-    task_fence(const task_fence&) = delete;
-    task_fence& operator=(const task_fence&) = delete;
+            m_state->partials[m_chunk].value = std::move(partial);
+        }
+        catch(...)
+        {
+            m_state->fail(std::current_exception());
+            report_error(std::current_exception());
+        }
 
-    task_fence(task_fence&& other) noexcept
-    :m_holder{std::exchange(other.m_holder, nullptr)}
-    {
+        if(auto error{m_state->arrive(m_chunk)}; error)
+        {
+            report_error(std::move(error));
+        }
 
+        trigger_checkpoints();
     }
 
-    task_fence& operator=(task_fence&& other) noexcept
+    void skip() override
     {
-        m_holder = std::exchange(other.m_holder, nullptr);
+        m_state->fail(list_error());
+        m_state->arrive(m_chunk);
 
-        return *this;
+        trigger_checkpoints();
     }
 
-    void signal() noexcept
+    void reset() override
     {
-        m_holder->signal();
+        //The state is shared by all chunks, and every task of a list is reset before any of them runs
+        if(m_chunk == 0)
+        {
+            m_state->reset();
+        }
     }
 
 private:
-    impl::fence_holder* m_holder{};
+    std::shared_ptr<State> m_state;
+    std::size_t m_chunk{};
+    std::uint64_t m_begin{};
+    std::uint64_t m_count{};
+    std::uint32_t m_x{};
+    std::uint32_t m_y{};
 };
 
-class task_list
+//Shared by the chunks of an invoke_batch: each chunk writes its slice of the output, and the last one to finish fulfils the promise.
+template<typename T, typename Func>
+struct batch_state
 {
-    friend class thread_pool;
-    friend class task_builder;
+    batch_state(std::size_t chunk_count, std::span<T> output, Func func)
+    :output{output}
+    ,func{std::move(func)}
+    ,chunk_count{chunk_count}
+    {
 
-public:
-    constexpr task_list() = default;
-    ~task_list() = default;
-    task_list(const task_list&) = delete;
-    task_list& operator=(const task_list&) = delete;
-    task_list(task_list&&) = default;
-    task_list& operator=(task_list&&) = default;
+    }
 
-private:
-    void reset(std::condition_variable& condition)
+    void reset()
     {
-        for(auto& task : m_tasks)
-        {
-            std::visit([&condition](auto&& task)
-            {
-                using alternative_type = std::decay_t<decltype(task)>;
+        promise = std::promise<void>{};
+        future  = promise.get_future();
 
-                if constexpr(std::is_same_v<alternative_type, impl::fence>)
-                {
-                    task.set_condition(condition);
-                }
+        remaining.store(chunk_count, std::memory_order_relaxed);
 
-                task.reset();
+        std::lock_guard lock{error_mutex};
+        error = nullptr;
+    }
 
-            }, task);
+    //Returns the exception thrown by func, if any. The chunk still completes, and the promise then carries the first error.
+    std::exception_ptr run(std::size_t begin, std::size_t end)
+    {
+        std::exception_ptr output_error{};
+
+        try
+        {
+            for(std::size_t i{begin}; i < end; ++i)
+            {
+                output[i] = std::invoke(func, i);
+            }
+        }
+        catch(...)
+        {
+            output_error = std::current_exception();
+            fail(output_error);
         }
 
-        m_current = std::begin(m_tasks);
+        finish();
+
+        return output_error;
     }
 
-    template<typename OutputIt>
-    std::pair<bool, std::size_t> next(OutputIt output)
+    void fail(std::exception_ptr exception)
     {
-        std::size_t count{};
+        std::lock_guard lock{error_mutex};
 
-        while(m_current != std::end(m_tasks))
+        if(!error)
         {
-            if(std::holds_alternative<impl::checkpoint>(*m_current))
-            {
-                auto& checkpoint{std::get<impl::checkpoint>(*m_current)};
+            error = std::move(exception);
+        }
+    }
 
-                if(checkpoint.is_barrier() && !checkpoint.check_barrier())
-                {
-                    return std::make_pair(false, count);
-                }
+    void finish()
+    {
+        if(remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            std::lock_guard lock{error_mutex};
 
-                checkpoint.count_down();
-            }
-            else if(std::holds_alternative<impl::task>(*m_current))
+            if(error)
             {
-                auto& task{std::get<impl::task>(*m_current)};
-
-                *output++ = task.holder();
-                ++count;
+                promise.set_exception(error);
             }
             else
             {
-                auto& fence{std::get<impl::fence>(*m_current)};
-
-                if(!fence.is_signaled())
-                {
-                    return std::make_pair(false, count);
-                }
+                promise.set_value();
             }
-
-            ++m_current;
         }
-
-        return std::make_pair(true, count);
     }
 
-private:
-    std::vector<impl::task_type> m_tasks{};
-    std::vector<impl::task_type>::iterator m_current{};
-    std::vector<impl::checkpoint_holder_base*> m_checkpoints{};
+    std::span<T> output;
+    Func func;
+    std::size_t chunk_count{};
+    std::atomic<std::size_t> remaining{};
+    std::promise<void> promise{};
+    std::future<void>  future{};
+    std::mutex error_mutex{};
+    std::exception_ptr error{};
 };
 
-class task_builder
+template<typename State>
+class batch_task_holder final : public task_holder_base
 {
 public:
-    explicit task_builder(std::uint32_t thread_count = std::thread::hardware_concurrency())
-    :m_thread_count{thread_count != 0 ? thread_count : 8}
+    batch_task_holder(std::shared_ptr<State> state, std::size_t chunk, std::size_t begin, std::size_t end)
+    :m_state{std::move(state)}
+    ,m_chunk{chunk}
+    ,m_begin{begin}
+    ,m_end{end}
     {
-        m_tasks.reserve(32);
+
     }
 
-    ~task_builder() = default;
-    task_builder(const task_builder&) = delete;
-    task_builder& operator=(const task_builder&) = delete;
-    task_builder(task_builder&&) = default;
-    task_builder& operator=(task_builder&&) = default;
+    ~batch_task_holder() = default;
+    batch_task_holder(const batch_task_holder&) = delete;
+    batch_task_holder& operator=(const batch_task_holder&) = delete;
+    batch_task_holder(batch_task_holder&&) = delete;
+    batch_task_holder& operator=(batch_task_holder&&) = delete;
 
-    template<typename Func, typename... Args>
-    void execute(Func&& func, Args&&... args)
+    void execute() override
     {
-        push_task([func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+        if(is_skipping())
         {
-            std::invoke(func, args...);
-        });
-    }
-
-    template<typename Func, typename... Args>
-    [[nodiscard]] auto invoke(Func&& func, Args&&... args)
-    {
-        using func_return_type = std::invoke_result_t<Func, Args...>;
-        using result_type = task_result<func_return_type>;
-
-        result_type output{};
+            skip();
+            return;
+        }
 
-        push_task([func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+        if(auto error{m_state->run(m_begin, m_end)}; error)
         {
-            return std::invoke(func, args...);
-        }, output.m_state);
+            report_error(std::move(error));
+        }
 
-        return output;
+        trigger_checkpoints();
     }
 
-    template<typename Func, typename... Args>
-    void dispatch(std::uint32_t x, std::uint32_t y, std::uint32_t z, Func&& func, Args&&... args)
+    void skip() override
     {
-        assert(x != 0 && "nes::task_builder::dispatch called with x == 0");
-        assert(y != 0 && "nes::task_builder::dispatch called with y == 0");
-        assert(z != 0 && "nes::task_builder::dispatch called with z == 0");
+        m_state->fail(list_error());
+        m_state->finish();
 
-        const std::uint64_t total_calls{static_cast<std::uint64_t>(x) * y * z};
+        trigger_checkpoints();
+    }
 
-        if(total_calls < m_thread_count)
+    void reset() override
+    {
+        if(m_chunk == 0)
         {
-            for(std::uint32_t current_z{}; current_z < z; ++current_z)
-            {
-                for(std::uint32_t current_y{}; current_y < y; ++current_y)
-                {
-                    for(std::uint32_t current_x{}; current_x < x; ++current_x)
-                    {
-                        push_task([current_x, current_y, current_z, func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
-                        {
-                            std::invoke(func, current_x, current_y, current_z, args...);
-                        });
-                    }
-                }
-            }
+            m_state->reset();
         }
-        else
-        {
-            const std::uint64_t calls_per_thread{total_calls / m_thread_count};
-
-            std::uint64_t remainder{total_calls % m_thread_count};
-            std::uint64_t calls{};
+    }
 
-            while(calls < total_calls)
-            {
-                std::uint64_t count{calls_per_thread};
+private:
+    std::shared_ptr<State> m_state;
+    std::size_t m_chunk{};
+    std::size_t m_begin{};
+    std::size_t m_end{};
+};
 
-                if(remainder > 0)
-                {
-                    ++count;
-                    --remainder;
-                }
+//Calls func(chunk, begin, end) for at most max_chunks contiguous slices covering [0, count)
+template<typename Func>
+void for_each_chunk(std::size_t count, std::size_t max_chunks, Func&& func)
+{
+    const std::size_t chunk_count{std::min(count, max_chunks)};
+    const std::size_t per_chunk{count / chunk_count};
+    const std::size_t remainder{count % chunk_count};
 
-                push_task([calls, count, x, y, z_factor = (x * y), func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
-                {
-                    for(std::uint64_t i{calls}; i < calls + count; ++i)
-                    {
-                        const auto current_x{static_cast<std::uint32_t>(i % x)};
-                        const auto current_y{static_cast<std::uint32_t>((i / x) % y)};
-                        const auto current_z{static_cast<std::uint32_t>(i / z_factor)};
+    std::size_t begin{};
+    for(std::size_t chunk{}; chunk < chunk_count; ++chunk)
+    {
+        const std::size_t end{begin + per_chunk + (chunk < remainder ? 1 : 0)};
 
-                        std::invoke(func, current_x, current_y, current_z, args...);
-                    }
-                });
+        func(chunk, begin, end);
 
-                calls += count;
-            }
-        }
+        begin = end;
     }
+}
 
-    task_checkpoint barrier()
+class task
+{
+public:
+    template<typename Func>
+    task(Func&& func)
+    :m_holder{std::make_unique<task_holder<Func>>(std::forward<Func>(func))}
     {
-        task_result<void> output{};
-        m_tasks.emplace_back(std::in_place_type<impl::checkpoint>, true, output.m_state);
 
-        return output;
     }
 
-    [[nodiscard]] task_checkpoint checkpoint()
+    template<typename Func, typename Ret>
+    task(Func&& func, std::future<Ret>*& user_reference)
+    :m_holder{std::make_unique<return_task_holder<Func, Ret>>(std::forward<Func>(func), user_reference)}
     {
-        task_result<void> output{};
-        m_tasks.emplace_back(std::in_place_type<impl::checkpoint>, false, output.m_state);
 
-        return output;
     }
 
-    [[nodiscard]] task_fence fence()
+    explicit task(std::unique_ptr<task_holder_base> holder) noexcept
+    :m_holder{std::move(holder)}
     {
-        task_fence output{};
-        output.m_holder = std::get<impl::fence>(m_tasks.emplace_back(std::in_place_type<impl::fence>)).holder();
 
-        return output;
     }
 
-    task_list build()
+    template<typename Func, typename Ret>
+    task(Func&& func, std::vector<const task_input*> inputs, std::future<Ret>*& user_reference, const task_input*& output)
+    :m_holder{std::make_unique<cached_task_holder<Func, Ret>>(std::forward<Func>(func), std::move(inputs), user_reference, output)}
     {
-        barrier(); //this barrier is used by the pool to know when all the tasks are done and the list can be returned to user
 
-        task_list output{};
-        output.m_tasks.reserve(std::size(m_tasks));
+    }
+
+    ~task() = default;
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    task(task&&) = default;
+    task& operator=(task&&) = default;
+
+    void set_checkpoint_range(checkpoint_range checkpoints)
+    {
+        m_holder->set_checkpoint_range(checkpoints);
+    }
+
+    void execute()
+    {
+        m_holder->execute();
+    }
+
+    void reset()
+    {
+        m_holder->reset();
+    }
+
+    task_holder_base* holder() const noexcept
+    {
+        return m_holder.get();
+    }
+
+private:
+    std::unique_ptr<task_holder_base> m_holder{};
+};
+
+class fence_holder
+{
+public:
+    fence_holder() = default;
+    ~fence_holder() = default;
+    fence_holder(const fence_holder&) = delete;
+    fence_holder& operator=(const fence_holder&) = delete;
+    fence_holder(fence_holder&&) = delete;
+    fence_holder& operator=(fence_holder&&) = delete;
+
+    void set_pool(thread_pool& pool) noexcept
+    {
+        m_pool = &pool;
+    }
+
+    void reset() noexcept
+    {
+        m_signaled.store(false, std::memory_order_release);
+    }
+
+    void signal() noexcept
+    {
+        m_signaled.store(true, std::memory_order_release);
+        notify_worker(*m_pool);
+    }
+
+    bool is_signaled() const noexcept
+    {
+        return m_signaled.load(std::memory_order_acquire);
+    }
+
+private:
+    thread_pool* m_pool{};
+    std::atomic<bool> m_signaled{};
+};
+
+class fence
+{
+public:
+    fence()
+    :m_holder{std::make_unique<fence_holder>()}
+    {
+
+    }
+
+    ~fence() = default;
+    fence(const fence&) = delete;
+    fence& operator=(const fence&) = delete;
+    fence(fence&&) = default;
+    fence& operator=(fence&&) = default;
+
+    void set_pool(thread_pool& pool) noexcept
+    {
+        m_holder->set_pool(pool);
+    }
+
+    void reset() noexcept
+    {
+        m_holder->reset();
+    }
+
+    void signal() noexcept
+    {
+        m_holder->signal();
+    }
+
+    bool is_signaled() const noexcept
+    {
+        return m_holder->is_signaled();
+    }
+
+    fence_holder* holder() const noexcept
+    {
+        return m_holder.get();
+    }
+
+private:
+    std::unique_ptr<fence_holder> m_holder{};
+};
+
+using task_type = std::variant<checkpoint, task, fence>;
+
+}
+
+template<typename T>
+class task_result
+{
+    friend class task_builder;
+
+public:
+    task_result() = default;
+    ~task_result() = default;
+    task_result(const task_result&) = delete;
+    task_result& operator=(const task_result&) = delete;
+
+    task_result(task_result&& other) noexcept
+    :m_state{std::exchange(other.m_state, nullptr)}
+    ,m_output{std::exchange(other.m_output, nullptr)}
+    {
+
+    }
+
+    task_result& operator=(task_result&& other) noexcept
+    {
+        m_state = std::exchange(other.m_state, nullptr);
+        m_output = std::exchange(other.m_output, nullptr);
+
+        return *this;
+    }
+
+    T get()
+    {
+        return m_state->get();
+    }
+
+    bool valid() const noexcept
+    {
+        return m_state->valid();
+    }
+
+    void wait() const
+    {
+        m_state->wait();
+    }
+
+    template<class Rep, class Period>
+    bool wait_for(const std::chrono::duration<Rep, Period>& timeout) const
+    {
+        return m_state->wait_for(timeout) == std::future_status::ready;
+    }
+
+    template<class Rep, class Period>
+    bool wait_until(const std::chrono::duration<Rep, Period>& timeout) const
+    {
+        return m_state->wait_until(timeout) == std::future_status::ready;
+    }
+
+    //Only for results of cached tasks: its version changes each time the task actually runs,
+    //so tasks using this result can list it in their own task_inputs.
+    const task_input& input() const noexcept
+    {
+        assert(m_output && "nes::task_result::input called on the result of a task that is not cached.");
+
+        return *m_output;
+    }
+
+private:
+    std::future<T>* m_state{};
+    const task_input* m_output{};
+};
+
+using task_checkpoint = task_result<void>;
+
+class task_fence
+{
+    friend class task_builder;
+
+public:
+    task_fence() = default;
+    ~task_fence() = default;
+    task_fence(const task_fence&) = delete;
+    task_fence& operator=(const task_fence&) = delete;
+
+    task_fence(task_fence&& other) noexcept
+    :m_holder{std::exchange(other.m_holder, nullptr)}
+    {
+
+    }
+
+    task_fence& operator=(task_fence&& other) noexcept
+    {
+        m_holder = std::exchange(other.m_holder, nullptr);
+
+        return *this;
+    }
+
+    void signal() noexcept
+    {
+        m_holder->signal();
+    }
+
+private:
+    impl::fence_holder* m_holder{};
+};
+
+class task_list
+{
+    friend class thread_pool;
+    friend class task_builder;
+
+public:
+    constexpr task_list() = default;
+    ~task_list() = default;
+    task_list(const task_list&) = delete;
+    task_list& operator=(const task_list&) = delete;
+    task_list(task_list&&) = default;
+    task_list& operator=(task_list&&) = default;
+
+private:
+    void reset(thread_pool& pool)
+    {
+        for(auto& task : m_tasks)
+        {
+            std::visit([&pool, state = m_state.get()](auto&& task)
+            {
+                using alternative_type = std::decay_t<decltype(task)>;
+
+                if constexpr(std::is_same_v<alternative_type, impl::fence>)
+                {
+                    task.set_pool(pool);
+                }
+                else if constexpr(std::is_same_v<alternative_type, impl::task>)
+                {
+                    task.holder()->set_list_state(state);
+                }
+
+                task.reset();
+
+            }, task);
+        }
+
+        if(m_state)
+        {
+            m_state->reset();
+        }
+
+        m_current = std::begin(m_tasks);
+    }
+
+    std::exception_ptr error() const
+    {
+        return m_state ? m_state->error() : nullptr;
+    }
+
+    template<typename OutputIt>
+    std::pair<bool, std::size_t> next(OutputIt output, std::size_t max_count = std::numeric_limits<std::size_t>::max())
+    {
+        std::size_t count{};
+
+        while(m_current != std::end(m_tasks))
+        {
+            if(std::holds_alternative<impl::checkpoint>(*m_current))
+            {
+                auto& checkpoint{std::get<impl::checkpoint>(*m_current)};
+
+                if(checkpoint.is_barrier() && !checkpoint.check_barrier())
+                {
+                    return std::make_pair(false, count);
+                }
+
+                checkpoint.count_down();
+            }
+            else if(std::holds_alternative<impl::task>(*m_current))
+            {
+                auto& task{std::get<impl::task>(*m_current)};
+                const bool skipping{m_state && m_state->is_skipping()};
+
+                if(count == max_count && !skipping && !task.holder()->is_clean())
+                {
+                    return std::make_pair(false, count);
+                }
+
+                //After a failure in fail fast mode, the remaining tasks are completed here instead of being queued
+                if(skipping)
+                {
+                    task.holder()->skip();
+                }
+                else if(task.holder()->is_clean())
+                {
+                    task.holder()->complete_clean();
+                }
+                else
+                {
+                    *output++ = task.holder();
+                    ++count;
+                }
+            }
+            else
+            {
+                auto& fence{std::get<impl::fence>(*m_current)};
+
+                if(!fence.is_signaled() && !(m_state && m_state->is_skipping()))
+                {
+                    return std::make_pair(false, count);
+                }
+            }
+
+            ++m_current;
+        }
+
+        return std::make_pair(true, count);
+    }
+
+private:
+    std::vector<impl::task_type> m_tasks{};
+    std::vector<impl::task_type>::iterator m_current{};
+    std::vector<impl::checkpoint_holder_base*> m_checkpoints{};
+    std::unique_ptr<impl::task_list_state> m_state{};
+};
+
+//Exception stored in the future returned by thread_pool::push when a task of the list threw.
+//It owns the list, so the results of the other tasks stay valid, and the list can be pushed again.
+class task_list_error : public std::exception
+{
+public:
+    task_list_error(task_list list, std::exception_ptr error)
+    :m_list{std::make_shared<task_list>(std::move(list))}
+    ,m_error{std::move(error)}
+    {
+
+    }
+
+    ~task_list_error() = default;
+    task_list_error(const task_list_error&) = default;
+    task_list_error& operator=(const task_list_error&) = default;
+    task_list_error(task_list_error&&) noexcept = default;
+    task_list_error& operator=(task_list_error&&) noexcept = default;
+
+    const char* what() const noexcept override
+    {
+        return "nes::task_list_error: a task of the list threw an exception";
+    }
+
+    //The first exception thrown by a task of the list
+    std::exception_ptr error() const noexcept
+    {
+        return m_error;
+    }
+
+    [[noreturn]] void rethrow() const
+    {
+        std::rethrow_exception(m_error);
+    }
+
+    task_list& list() const noexcept
+    {
+        return *m_list;
+    }
+
+private:
+    std::shared_ptr<task_list> m_list{};
+    std::exception_ptr m_error{};
+};
+
+class task_builder
+{
+public:
+    explicit task_builder(std::uint32_t thread_count = std::thread::hardware_concurrency())
+    :m_thread_count{thread_count != 0 ? thread_count : 8}
+    {
+        m_tasks.reserve(32);
+    }
+
+    ~task_builder() = default;
+    task_builder(const task_builder&) = delete;
+    task_builder& operator=(const task_builder&) = delete;
+    task_builder(task_builder&&) = default;
+    task_builder& operator=(task_builder&&) = default;
+
+    template<typename Func, typename... Args>
+    void execute(Func&& func, Args&&... args)
+    {
+        push_task([func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+        {
+            std::invoke(func, args...);
+        });
+    }
+
+    template<typename Func, typename... Args>
+    [[nodiscard]] auto invoke(Func&& func, Args&&... args)
+    {
+        using func_return_type = std::invoke_result_t<Func, Args...>;
+        using result_type = task_result<func_return_type>;
+
+        result_type output{};
+
+        push_task([func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+        {
+            return std::invoke(func, args...);
+        }, output.m_state);
+
+        return output;
+    }
+
+    //Cached variants: when the list is pushed again and no input changed version since the last run,
+    //the task is completed without being queued and invoke's result is a copy of the previous one.
+    //A task listing the input() of another task's result must be separated from it by a barrier.
+    template<typename Func, typename... Args>
+    void execute(task_inputs inputs, Func&& func, Args&&... args)
+    {
+        std::future<void>* state{};
+        const task_input* output{};
+
+        push_task([func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+        {
+            std::invoke(func, args...);
+        }, std::move(inputs.m_inputs), state, output);
+    }
+
+    template<typename Func, typename... Args>
+    [[nodiscard]] auto invoke(task_inputs inputs, Func&& func, Args&&... args)
+    {
+        using func_return_type = std::invoke_result_t<Func, Args...>;
+        using result_type = task_result<func_return_type>;
+
+        result_type output{};
+
+        push_task([func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+        {
+            return std::invoke(func, args...);
+        }, std::move(inputs.m_inputs), output.m_state, output.m_output);
+
+        return output;
+    }
+
+    template<typename Func, typename... Args>
+    void dispatch(std::uint32_t x, std::uint32_t y, std::uint32_t z, Func&& func, Args&&... args)
+    {
+        assert(x != 0 && "nes::task_builder::dispatch called with x == 0");
+        assert(y != 0 && "nes::task_builder::dispatch called with y == 0");
+        assert(z != 0 && "nes::task_builder::dispatch called with z == 0");
+
+        const std::uint64_t total_calls{static_cast<std::uint64_t>(x) * y * z};
+
+        if(total_calls < m_thread_count)
+        {
+            for(std::uint32_t current_z{}; current_z < z; ++current_z)
+            {
+                for(std::uint32_t current_y{}; current_y < y; ++current_y)
+                {
+                    for(std::uint32_t current_x{}; current_x < x; ++current_x)
+                    {
+                        push_task([current_x, current_y, current_z, func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+                        {
+                            std::invoke(func, current_x, current_y, current_z, args...);
+                        });
+                    }
+                }
+            }
+        }
+        else
+        {
+            const std::uint64_t calls_per_thread{total_calls / m_thread_count};
+
+            std::uint64_t remainder{total_calls % m_thread_count};
+            std::uint64_t calls{};
+
+            while(calls < total_calls)
+            {
+                std::uint64_t count{calls_per_thread};
+
+                if(remainder > 0)
+                {
+                    ++count;
+                    --remainder;
+                }
+
+                push_task([calls, count, x, y, z_factor = (x * y), func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+                {
+                    for(std::uint64_t i{calls}; i < calls + count; ++i)
+                    {
+                        const auto current_x{static_cast<std::uint32_t>(i % x)};
+                        const auto current_y{static_cast<std::uint32_t>((i / x) % y)};
+                        const auto current_z{static_cast<std::uint32_t>(i / z_factor)};
+
+                        std::invoke(func, current_x, current_y, current_z, args...);
+                    }
+                });
+
+                calls += count;
+            }
+        }
+    }
+
+    //Reduces map(x, y, z) over the grid with combine, starting each chunk from a copy of identity. combine must be associative.
+    //The grid is split in at most thread_count chunks, each one accumulating into its own cache line,
+    //then chunk partials are combined in a tree by the chunks themselves, so no barrier or serial pass is needed.
+    //Like invoke's, the result is ready once a following barrier or checkpoint is reached.
+    template<typename T, typename Map, typename Combine>
+    [[nodiscard]] task_result<T> dispatch_reduce(std::uint32_t x, std::uint32_t y, std::uint32_t z, T identity, Map&& map, Combine&& combine)
+    {
+        assert(x != 0 && "nes::task_builder::dispatch_reduce called with x == 0");
+        assert(y != 0 && "nes::task_builder::dispatch_reduce called with y == 0");
+        assert(z != 0 && "nes::task_builder::dispatch_reduce called with z == 0");
+
+        using state_type = impl::reduce_state<T, std::decay_t<Map>, std::decay_t<Combine>>;
+        using holder_type = impl::reduce_task_holder<state_type>;
+
+        const std::uint64_t total_calls{static_cast<std::uint64_t>(x) * y * z};
+        const auto chunk_count{static_cast<std::size_t>(std::min<std::uint64_t>(total_calls, m_thread_count))};
+
+        auto state{std::make_shared<state_type>(chunk_count, std::move(identity), std::forward<Map>(map), std::forward<Combine>(combine))};
+
+        task_result<T> output{};
+        output.m_state = &state->future;
+
+        const std::uint64_t calls_per_chunk{total_calls / chunk_count};
+        const std::uint64_t remainder{total_calls % chunk_count};
+        std::uint64_t calls{};
+
+        for(std::size_t chunk{}; chunk < chunk_count; ++chunk)
+        {
+            const std::uint64_t count{calls_per_chunk + (chunk < remainder ? 1 : 0)};
+
+            push_task(std::unique_ptr<impl::task_holder_base>{std::make_unique<holder_type>(state, chunk, calls, count, x, y)});
+
+            calls += count;
+        }
+
+        return output;
+    }
+
+    //Writes func(i) into output[i] for every index of output, using at most thread_count tasks and no per-item promise.
+    //The returned checkpoint is reached once the whole span is written. output must outlive every push of the list.
+    template<typename T, typename Func>
+    [[nodiscard]] task_checkpoint invoke_batch(std::span<T> output, Func&& func)
+    {
+        assert(!std::empty(output) && "nes::task_builder::invoke_batch called with an empty output");
+
+        using state_type = impl::batch_state<T, std::decay_t<Func>>;
+        using holder_type = impl::batch_task_holder<state_type>;
+
+        const std::size_t chunk_count{std::min<std::size_t>(std::size(output), m_thread_count)};
+        auto state{std::make_shared<state_type>(chunk_count, output, std::forward<Func>(func))};
+
+        task_checkpoint checkpoint{};
+        checkpoint.m_state = &state->future;
+
+        impl::for_each_chunk(std::size(output), chunk_count, [this, &state](std::size_t chunk, std::size_t begin, std::size_t end)
+        {
+            push_task(std::unique_ptr<impl::task_holder_base>{std::make_unique<holder_type>(state, chunk, begin, end)});
+        });
+
+        return checkpoint;
+    }
+
+    task_checkpoint barrier()
+    {
+        task_result<void> output{};
+        m_tasks.emplace_back(std::in_place_type<impl::checkpoint>, true, output.m_state);
+
+        return output;
+    }
+
+    [[nodiscard]] task_checkpoint checkpoint()
+    {
+        task_result<void> output{};
+        m_tasks.emplace_back(std::in_place_type<impl::checkpoint>, false, output.m_state);
+
+        return output;
+    }
+
+    [[nodiscard]] task_fence fence()
+    {
+        task_fence output{};
+        output.m_holder = std::get<impl::fence>(m_tasks.emplace_back(std::in_place_type<impl::fence>)).holder();
+
+        return output;
+    }
+
+    //A task throwing does not stop the other ones: invoke results carry the exception, checkpoints are still reached,
+    //and the future returned by thread_pool::push carries a task_list_error holding the list and its first exception.
+    //In fail fast mode, the tasks that did not start yet when the first exception is thrown are skipped, their results carry that exception.
+    void set_fail_fast(bool enabled) noexcept
+    {
+        m_fail_fast = enabled;
+    }
+
+    task_list build()
+    {
+        barrier(); //this barrier is used by the pool to know when all the tasks are done and the list can be returned to user
+
+        task_list output{};
+        output.m_state = std::make_unique<impl::task_list_state>();
+        output.m_state->set_fail_fast(m_fail_fast);
+        output.m_tasks.reserve(std::size(m_tasks));
         output.m_checkpoints.reserve(count_checkpoints());
 
-        auto begin  {std::begin(m_tasks)};
-        auto current{begin};
+        auto begin  {std::begin(m_tasks)};
+        auto current{begin};
+
+        std::size_t checkpoints_begin{};
+        std::size_t checkpoints_size{};
+
+        while(current != std::end(m_tasks))
+        {
+            if(std::holds_alternative<impl::checkpoint>(*current))
+            {
+                auto& checkpoint{std::get<impl::checkpoint>(*current)};
+
+                output.m_checkpoints.emplace_back(checkpoint.base());
+                ++checkpoints_size;
+
+                if(checkpoint.is_barrier())
+                {
+                    const auto checkpoints_it{std::begin(output.m_checkpoints) + checkpoints_begin};
+
+                    flush(output.m_tasks, checkpoints_it, checkpoints_it + checkpoints_size, begin, current + 1);
+
+                    checkpoints_begin += checkpoints_size;
+                    checkpoints_size = 0;
+
+                    begin = current + 1;
+                }
+            }
+
+            ++current;
+        }
+
+        m_tasks.clear();
+
+        return output;
+    }
+
+private:
+    template<typename... Args>
+    void push_task(Args&&... args)
+    {
+        m_tasks.emplace_back(std::in_place_type<impl::task>, std::forward<Args>(args)...);
+    }
+
+    template<typename InputIt, typename CheckpointIt>
+    void flush(std::vector<impl::task_type>& output, CheckpointIt checkpoints_begin, CheckpointIt checkpoints_end, InputIt begin, InputIt end)
+    {
+        std::size_t checkpoint_counter{};
+
+        while(begin != end)
+        {
+            if(std::holds_alternative<impl::checkpoint>(*begin))
+            {
+                auto checkpoint{std::get<impl::checkpoint>(std::move(*begin))};
+
+                checkpoint.set_reset_value(checkpoint_counter + 1); //+ 1 for the caller
+                output.emplace_back(std::in_place_type<impl::checkpoint>, std::move(checkpoint));
+
+                ++checkpoints_begin;
+            }
+            else if(std::holds_alternative<impl::task>(*begin))
+            {
+                auto task{std::get<impl::task>(std::move(*begin))};
+
+                task.set_checkpoint_range(impl::checkpoint_range{checkpoints_begin, checkpoints_end});
+                output.emplace_back(std::in_place_type<impl::task>, std::move(task));
+
+                ++checkpoint_counter;
+            }
+            else
+            {
+                auto fence{std::get<impl::fence>(std::move(*begin))};
+
+                output.emplace_back(std::in_place_type<impl::fence>, std::move(fence));
+            }
+
+            ++begin;
+        }
+    }
+
+    std::size_t count_checkpoints() const noexcept
+    {
+        return std::count_if(std::begin(m_tasks), std::end(m_tasks), [](auto&& task)
+        {
+            return std::holds_alternative<impl::checkpoint>(task);
+        });
+    }
+
+private:
+    std::uint32_t m_thread_count{};
+    std::vector<impl::task_type> m_tasks{};
+    bool m_fail_fast{};
+};
+
+enum class thread_pool_options : std::uint32_t
+{
+    lazy = 0x01,
+    caller_runs = 0x02
+};
+
+constexpr thread_pool_options operator&(thread_pool_options left, thread_pool_options right) noexcept
+{
+    return static_cast<thread_pool_options>(static_cast<std::uint32_t>(left) & static_cast<std::uint32_t>(right));
+}
+
+constexpr thread_pool_options& operator&=(thread_pool_options& left, thread_pool_options right) noexcept
+{
+    left = left & right;
+    return left;
+}
+
+constexpr thread_pool_options operator|(thread_pool_options left, thread_pool_options right) noexcept
+{
+    return static_cast<thread_pool_options>(static_cast<std::uint32_t>(left) | static_cast<std::uint32_t>(right));
+}
+
+constexpr thread_pool_options& operator|=(thread_pool_options& left, thread_pool_options right) noexcept
+{
+    left = left | right;
+    return left;
+}
+
+constexpr thread_pool_options operator^(thread_pool_options left, thread_pool_options right) noexcept
+{
+    return static_cast<thread_pool_options>(static_cast<std::uint32_t>(left) ^ static_cast<std::uint32_t>(right));
+}
+
+constexpr thread_pool_options& operator^=(thread_pool_options& left, thread_pool_options right) noexcept
+{
+    left = left ^ right;
+    return left;
+}
+
+constexpr thread_pool_options operator~(thread_pool_options value) noexcept
+{
+    return static_cast<thread_pool_options>(~static_cast<std::uint32_t>(value));
+}
+
+//Receives the counters of a thread_pool it is attached to with thread_pool::set_observer, e.g. thread_pool_telemetry_publisher.
+//Every call is made with the pool's lock held: implementations must be quick and must not call the pool back.
+//A pool without an observer only pays a null pointer check where the counters change.
+class thread_pool_observer
+{
+public:
+    thread_pool_observer() = default;
+    virtual ~thread_pool_observer() = default;
+    thread_pool_observer(const thread_pool_observer&) = delete;
+    thread_pool_observer& operator=(const thread_pool_observer&) = delete;
+    thread_pool_observer(thread_pool_observer&&) = delete;
+    thread_pool_observer& operator=(thread_pool_observer&&) = delete;
+
+    //Called by set_observer with the current state of the pool
+    virtual void on_attach(std::size_t thread_count, std::size_t started_thread_count, std::size_t queue_depth, std::size_t active_workers) noexcept = 0;
+    //Called when the observer is replaced, and by the pool's destructor once every worker is joined
+    virtual void on_detach() noexcept = 0;
+    virtual void on_thread_started(std::size_t started_thread_count) noexcept = 0;
+    //count tasks were queued, 0 when one was taken
+    virtual void on_queued(std::size_t count, std::size_t queue_depth) noexcept = 0;
+    virtual void on_active_workers(std::size_t active_workers) noexcept = 0;
+    virtual void on_task_completed(std::chrono::steady_clock::duration run_time) noexcept = 0;
+};
+
+//Tasks submitted with the same key prefer the same worker, which keeps the data they touch in that worker's cache.
+class affinity_key
+{
+public:
+    template<typename Key>
+    explicit affinity_key(const Key& key) noexcept
+    :m_value{static_cast<std::size_t>(hash<Key>{}(key)[0])}
+    {
+
+    }
+
+    std::size_t value() const noexcept
+    {
+        return m_value;
+    }
+
+private:
+    std::size_t m_value{};
+};
+
+//How worker threads are created. Hooks run on each worker, with its index, before it takes its first task and after its last one.
+//Exceptions thrown by the hooks are caught and ignored, the worker keeps running.
+//Names, stack size, nice value and scheduling are only applied on POSIX systems.
+struct worker_attributes
+{
+    std::string name_prefix{}; //Workers are named name_prefix + index, truncated to 15 characters on Linux
+    std::size_t stack_size{}; //0 keeps the system default
+    std::optional<int> nice{}; //Linux only, lowering it requires privileges and is ignored without them
+    std::optional<int> policy{}; //SCHED_FIFO, SCHED_RR, ..., creating the workers throws std::system_error if it is not permitted
+    int priority{}; //Used with policy
+    std::function<void(std::size_t)> on_start{};
+    std::function<void(std::size_t)> on_exit{};
+};
+
+namespace impl
+{
+
+inline bool run_pending_task(thread_pool& pool);
+
+#if defined(NES_POSIX_THREAD_POOL)
+
+class worker_thread
+{
+public:
+    worker_thread() = default;
+
+    template<typename Func>
+    worker_thread(const worker_attributes& attributes, Func&& func)
+    {
+        using func_type = std::decay_t<Func>;
+
+        pthread_attr_t attr{};
+        pthread_attr_init(&attr);
+
+        int result{};
+
+        if(attributes.stack_size != 0)
+        {
+            result = pthread_attr_setstacksize(&attr, std::max<std::size_t>(attributes.stack_size, PTHREAD_STACK_MIN));
+        }
+
+        if(result == 0 && attributes.policy)
+        {
+            sched_param param{};
+            param.sched_priority = attributes.priority;
+
+            result = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+
+            if(result == 0)
+            {
+                result = pthread_attr_setschedpolicy(&attr, *attributes.policy);
+            }
+
+            if(result == 0)
+            {
+                result = pthread_attr_setschedparam(&attr, &param);
+            }
+        }
+
+        auto data{std::make_unique<func_type>(std::forward<Func>(func))};
+
+        if(result == 0)
+        {
+            result = pthread_create(&m_handle, &attr, &entry<func_type>, data.get());
+        }
+
+        pthread_attr_destroy(&attr);
+
+        if(result != 0)
+            throw std::system_error{result, std::generic_category(), "Failed to create thread pool worker"};
+
+        data.release();
+        m_joinable = true;
+    }
+
+    //Like std::thread, destroying a thread that was not joined terminates, it would keep running unowned
+    ~worker_thread()
+    {
+        assert(!m_joinable && "nes::impl::worker_thread destroyed while joinable.");
+
+        if(m_joinable)
+        {
+            std::terminate();
+        }
+    }
+
+    worker_thread(const worker_thread&) = delete;
+    worker_thread& operator=(const worker_thread&) = delete;
+
+    worker_thread(worker_thread&& other) noexcept
+    :m_handle{other.m_handle}
+    ,m_joinable{std::exchange(other.m_joinable, false)}
+    {
+
+    }
+
+    //Like std::thread, assigning to a thread that was not joined terminates, its handle would be lost
+    worker_thread& operator=(worker_thread&& other) noexcept
+    {
+        assert(!m_joinable && "nes::impl::worker_thread assigned while joinable.");
+
+        if(m_joinable)
+        {
+            std::terminate();
+        }
+
+        m_handle = other.m_handle;
+        m_joinable = std::exchange(other.m_joinable, false);
+
+        return *this;
+    }
+
+    bool joinable() const noexcept
+    {
+        return m_joinable;
+    }
+
+    void join()
+    {
+        pthread_join(m_handle, nullptr);
+        m_joinable = false;
+    }
+
+    //Applies the attributes that can only be set from the worker itself. Does not allocate, the name is built in place.
+    static void setup(const worker_attributes& attributes, std::size_t index) noexcept
+    {
+        if(!std::empty(attributes.name_prefix))
+        {
+            //Thread names are limited to 15 characters on Linux and 63 on macOS, plus the null terminator
+    #if defined(__APPLE__)
+            std::array<char, 64> name{};
+    #else
+            std::array<char, 16> name{};
+    #endif
+            std::array<char, std::numeric_limits<std::size_t>::digits10 + 1> digits{};
+            const auto digits_end{std::to_chars(std::data(digits), std::data(digits) + std::size(digits), index).ptr};
+
+            auto* const name_end{std::data(name) + std::size(name) - 1};
+            auto* output{std::copy_n(std::data(attributes.name_prefix), std::min<std::size_t>(std::size(attributes.name_prefix), std::size(name) - 1), std::data(name))};
+            std::copy_n(std::data(digits), std::min<std::size_t>(digits_end - std::data(digits), name_end - output), output);
+
+    #if defined(__APPLE__)
+            pthread_setname_np(std::data(name));
+    #else
+            pthread_setname_np(pthread_self(), std::data(name));
+    #endif
+        }
+
+    #if defined(__linux__)
+        if(attributes.nice)
+        {
+            setpriority(PRIO_PROCESS, static_cast<::id_t>(syscall(SYS_gettid)), *attributes.nice);
+        }
+    #endif
+    }
+
+private:
+    template<typename Func>
+    static void* entry(void* data)
+    {
+        const std::unique_ptr<Func> func{static_cast<Func*>(data)};
+        (*func)();
+
+        return nullptr;
+    }
+
+private:
+    pthread_t m_handle{};
+    bool m_joinable{};
+};
+
+#else
+
+class worker_thread
+{
+public:
+    worker_thread() = default;
+
+    template<typename Func>
+    worker_thread(const worker_attributes&, Func&& func)
+    :m_thread{std::forward<Func>(func)}
+    {
+
+    }
+
+    ~worker_thread() = default;
+    worker_thread(const worker_thread&) = delete;
+    worker_thread& operator=(const worker_thread&) = delete;
+    worker_thread(worker_thread&&) noexcept = default;
+    worker_thread& operator=(worker_thread&&) noexcept = default;
+
+    bool joinable() const noexcept
+    {
+        return m_thread.joinable();
+    }
+
+    void join()
+    {
+        m_thread.join();
+    }
+
+    static void setup(const worker_attributes&, std::size_t) noexcept
+    {
+
+    }
+
+private:
+    std::thread m_thread{};
+};
+
+#endif
+
+}
+
+class thread_pool
+{
+    friend bool impl::run_pending_task(thread_pool& pool);
+    friend void impl::notify_worker(thread_pool& pool) noexcept;
+    friend class task_group;
+
+public:
+    static constexpr std::size_t unbounded{std::numeric_limits<std::size_t>::max()};
+
+public:
+    //When capacity is not unbounded, execute and invoke wait while capacity tasks are queued,
+    //or run the task on the calling thread if options has caller_runs.
+    //Workers of the pool never wait for room, they run the task themselves instead.
+    explicit thread_pool(std::size_t thread_count = std::thread::hardware_concurrency(), thread_pool_options options = thread_pool_options{}, std::size_t capacity = unbounded, worker_attributes attributes = worker_attributes{})
+    :m_thread_count{thread_count != 0 ? thread_count : 8}
+    ,m_options{options}
+    ,m_capacity{capacity}
+    ,m_attributes{std::move(attributes)}
+    ,m_max_active_count{m_thread_count}
+    {
+        assert(capacity != 0 && "nes::thread_pool created with capacity == 0");
+
+        std::unique_lock lock{m_mutex};
+
+        m_threads.reserve(m_thread_count);
+        m_worker_queues = std::make_unique<worker_queue[]>(m_thread_count);
+        m_task_lists.reserve(4 * m_thread_count);
+
+        if(!static_cast<bool>(m_options & thread_pool_options::lazy))
+        {
+            try
+            {
+                for(std::size_t i{}; i < m_thread_count; ++i)
+                {
+                    spawn_worker();
+                }
+            }
+            catch(...)
+            {
+                m_running = false;
+
+                lock.unlock();
+
+                notify_all_workers();
+
+                for(auto&& thread : m_threads)
+                {
+                    thread.join();
+                }
+
+                throw;
+            }
+        }
+    }
+
+    //A paused pool is resumed so the remaining tasks can run.
+    ~thread_pool()
+    {
+        std::unique_lock lock{m_mutex};
+
+        m_paused = false;
+        notify_all_workers();
+
+        m_wait_condition.wait(lock, [this]
+        {
+            return !has_tasks() && std::empty(m_task_lists) && m_active_count == 0;
+        });
+
+        m_running = false;
+
+        lock.unlock();
+
+        notify_all_workers();
+
+        for(auto&& thread : m_threads)
+        {
+            if(thread.joinable())
+            {
+                thread.join();
+            }
+        }
+
+        lock.lock();
+
+        if(auto* observer{std::exchange(m_observer, nullptr)}; observer)
+        {
+            observer->on_detach();
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+    thread_pool(thread_pool&&) = delete;
+    thread_pool& operator=(thread_pool&&) = delete;
+
+    template<typename Func, typename... Args>
+    void execute(Func&& func, Args&&... args)
+    {
+        push_impl(no_worker, make_task(std::forward<Func>(func), std::forward<Args>(args)...));
+    }
+
+    //The task is queued on the worker the key maps to. Other workers only take it when they are idle while that worker is busy.
+    template<typename Func, typename... Args>
+    void execute(affinity_key key, Func&& func, Args&&... args)
+    {
+        push_impl(key.value() % m_thread_count, make_task(std::forward<Func>(func), std::forward<Args>(args)...));
+    }
+
+    //Returns false, without touching func or args, if the queue is full.
+    template<typename Func, typename... Args>
+    bool try_execute(Func&& func, Args&&... args)
+    {
+        std::unique_lock lock{m_mutex};
+
+        if(is_full())
+        {
+            return false;
+        }
+
+        push_locked(lock, no_worker, make_task(std::forward<Func>(func), std::forward<Args>(args)...));
+
+        return true;
+    }
+
+    template<typename Rep, typename Period, typename Func, typename... Args>
+    bool try_execute_for(const std::chrono::duration<Rep, Period>& timeout, Func&& func, Args&&... args)
+    {
+        return try_execute_until(std::chrono::steady_clock::now() + timeout, std::forward<Func>(func), std::forward<Args>(args)...);
+    }
+
+    template<typename Clock, typename Duration, typename Func, typename... Args>
+    bool try_execute_until(const std::chrono::time_point<Clock, Duration>& time_point, Func&& func, Args&&... args)
+    {
+        std::unique_lock lock{m_mutex};
+
+        if(!m_space_condition.wait_until(lock, time_point, [this]{ return !is_full(); }))
+        {
+            return false;
+        }
+
+        push_locked(lock, no_worker, make_task(std::forward<Func>(func), std::forward<Args>(args)...));
+
+        return true;
+    }
+
+    template<typename Func, typename... Args>
+    auto invoke(Func&& func, Args&&... args)
+    {
+        return invoke_impl(no_worker, std::forward<Func>(func), std::forward<Args>(args)...);
+    }
+
+    template<typename Func, typename... Args>
+    auto invoke(affinity_key key, Func&& func, Args&&... args)
+    {
+        return invoke_impl(key.value() % m_thread_count, std::forward<Func>(func), std::forward<Args>(args)...);
+    }
+
+    //Writes func(i) into output[i] for every index of output, using at most thread_count() tasks and no per-item promise.
+    //The future is ready once the whole span is written, output must outlive it.
+    template<typename T, typename Func>
+    std::future<void> invoke_batch(std::span<T> output, Func&& func)
+    {
+        assert(!std::empty(output) && "nes::thread_pool::invoke_batch called with an empty output");
+
+        using state_type = impl::batch_state<T, std::decay_t<Func>>;
+
+        const std::size_t chunk_count{std::min(std::size(output), m_thread_count)};
+        auto state{std::make_shared<state_type>(chunk_count, output, std::forward<Func>(func))};
+        state->reset();
+
+        auto future{std::move(state->future)};
+
+        impl::for_each_chunk(std::size(output), chunk_count, [this, &state](std::size_t, std::size_t begin, std::size_t end)
+        {
+            execute([state, begin, end]()
+            {
+                state->run(begin, end);
+            });
+        });
+
+        return future;
+    }
+
+    //Lists pushed concurrently share the pool in proportion of their weight:
+    //each time the queue runs dry, every active list may enqueue up to weight * thread_count() of its ready tasks.
+    //A weight of 0 is treated as 1, a list that never gets a share would never complete.
+    std::future<task_list> push(task_list list, std::uint32_t weight = 1)
+    {
+        list.reset(*this);
+
+        std::lock_guard lock{m_mutex};
+
+        auto& data{m_task_lists.emplace_back()};
+        data.list = std::move(list);
+        data.weight = std::max<std::uint32_t>(weight, 1);
+
+        auto future{data.promise.get_future()};
+
+        notify_workers(update_task_lists());
+        grow();
+
+        return future;
+    }
+
+    //Workers finish the tasks they are running, then stop taking new ones until resume() is called. Tasks can still be pushed meanwhile.
+    //wait_idle() does not return while tasks are queued on a paused pool.
+    void pause()
+    {
+        std::lock_guard lock{m_mutex};
+
+        m_paused = true;
+    }
+
+    void resume()
+    {
+        std::unique_lock lock{m_mutex};
+
+        m_paused = false;
+
+        lock.unlock();
+
+        notify_all_workers();
+    }
+
+    bool paused() const
+    {
+        std::lock_guard lock{m_mutex};
+
+        return m_paused;
+    }
+
+    //Caps how many tasks the pool runs at once, between 1 and thread_count(). Running tasks are not interrupted when the cap is lowered.
+    //It is checked by workers under the lock they already take to dequeue a task, so it adds no synchronization to the hot path.
+    void set_max_active_workers(std::size_t count)
+    {
+        assert(count != 0 && "nes::thread_pool::set_max_active_workers called with count == 0, use pause() instead.");
+
+        std::unique_lock lock{m_mutex};
+
+        const bool raised{count > m_max_active_count};
+        m_max_active_count = std::min(count, m_thread_count);
+
+        lock.unlock();
+
+        if(raised)
+        {
+            notify_all_workers();
+        }
+    }
+
+    std::size_t max_active_workers() const
+    {
+        std::lock_guard lock{m_mutex};
+
+        return m_max_active_count;
+    }
+
+    void wait_idle()
+    {
+        std::unique_lock lock{m_mutex};
+        m_wait_condition.wait(lock, [this]
+        {
+            return !has_tasks() && std::empty(m_task_lists) && m_active_count == 0;
+        });
+    }
+
+    std::size_t thread_count() const noexcept
+    {
+        return m_thread_count;
+    }
+
+    std::size_t capacity() const noexcept
+    {
+        return m_capacity;
+    }
+
+    //Attaches observer to the pool, replacing the previous one, or detaches it when observer is nullptr.
+    //observer must stay alive until it is detached, by this function or by the pool's destructor.
+    void set_observer(thread_pool_observer* observer)
+    {
+        std::lock_guard lock{m_mutex};
+
+        if(m_observer)
+        {
+            m_observer->on_detach();
+        }
+
+        m_observer = observer;
+
+        if(m_observer)
+        {
+            m_observer->on_attach(m_thread_count, std::size(m_threads), queued_count(), m_active_count);
+        }
+    }
+
+    std::size_t started_thread_count() const
+    {
+        std::lock_guard lock{m_mutex};
 
-        std::size_t checkpoints_begin{};
-        std::size_t checkpoints_size{};
+        return std::size(m_threads);
+    }
 
-        while(current != std::end(m_tasks))
+private:
+    using task_type = std::variant<impl::task, impl::task_holder_base*>;
+
+    static constexpr std::size_t no_worker{std::numeric_limits<std::size_t>::max()};
+
+private:
+    //Runs one queued task on the calling thread and returns false if there was none, see impl::run_pending_task.
+    //Only the pool's own workers help, other threads get false: tasks may use this_worker::arena() or worker_local::local(),
+    //which need a worker context. The worker's scratch arena is not reset since the waiting task may still use it.
+    bool run_pending_task()
+    {
+        if(!impl::this_worker_context || impl::this_worker_context->pool != this)
         {
-            if(std::holds_alternative<impl::checkpoint>(*current))
+            return false;
+        }
+
+        std::unique_lock lock{m_mutex};
+
+        if(std::empty(m_tasks) && !std::empty(m_task_lists))
+        {
+            notify_workers(update_task_lists());
+            grow();
+        }
+
+        //A worker helping is already counted as active
+        if(m_paused)
+        {
+            return false;
+        }
+
+        auto* queue{find_tasks(impl::this_worker_context->index)};
+        if(!queue)
+        {
+            return false;
+        }
+
+        //Newest first: it is most likely a child of the waiting task, and it keeps nested helping as deep as the recursion instead of as wide
+        auto task{pop_task(*queue, true)};
+        const bool timed{m_observer != nullptr};
+
+        ++m_active_count;
+        publish_active_count();
+
+        lock.unlock();
+
+        notify_space();
+
+        const auto run_time{run_task(task, timed)};
+
+        lock.lock();
+
+        --m_active_count;
+        publish_completed(run_time);
+        notify_held_back(no_worker);
+
+        if(m_active_count == 0 && !has_tasks() && std::empty(m_task_lists))
+        {
+            m_wait_condition.notify_all();
+        }
+
+        return true;
+    }
+
+    void worker_main(std::size_t index)
+    {
+        scratch_arena arena{};
+
+        impl::worker_context context{this, index, &arena};
+        impl::this_worker_context = &context;
+
+        impl::worker_thread::setup(m_attributes, index);
+
+        run_hook(m_attributes.on_start, index);
+
+        bool executed{};
+        std::optional<std::chrono::steady_clock::duration> run_time{};
+
+        while(true)
+        {
+            std::unique_lock lock{m_mutex};
+
+            if(std::exchange(executed, false))
             {
-                auto& checkpoint{std::get<impl::checkpoint>(*current)};
+                --m_active_count;
+                publish_completed(run_time);
 
-                output.m_checkpoints.emplace_back(checkpoint.base());
-                ++checkpoints_size;
+                if(!has_work(index))
+                {
+                    notify_held_back(index);
+                }
+            }
 
-                if(checkpoint.is_barrier())
+            auto& own_queue{m_worker_queues[index]};
+
+            ++m_idle_count;
+            //Read by spawn without locking, see has_spawned for the other side
+            m_sleeping_count.fetch_add(1, std::memory_order_seq_cst);
+            own_queue.waiting = true;
+            own_queue.condition.wait(lock, [this, index, &own_queue]
+            {
+                own_queue.notified = false;
+
+                if(std::empty(m_tasks) && !std::empty(m_task_lists))
                 {
-                    const auto checkpoints_it{std::begin(output.m_checkpoints) + checkpoints_begin};
+                    notify_workers(update_task_lists(), index);
+                    grow();
+                }
 
-                    flush(output.m_tasks, checkpoints_it, checkpoints_it + checkpoints_size, begin, current + 1);
+                if(!has_tasks() && std::empty(m_task_lists) && m_active_count == 0)
+                {
+                    m_wait_condition.notify_all();
+                }
 
-                    checkpoints_begin += checkpoints_size;
-                    checkpoints_size = 0;
+                return !m_running || (!m_paused && m_active_count < m_max_active_count && has_work(index));
+            });
+            own_queue.waiting = false;
+            m_sleeping_count.fetch_sub(1, std::memory_order_relaxed);
+            --m_idle_count;
 
-                    begin = current + 1;
+            if(!m_running)
+            {
+                break;
+            }
+
+            //Queued tasks first, then the children of task groups running on other workers
+            std::optional<task_type> task{};
+            impl::spawned_task* spawned{};
+
+            if(auto* queue{find_tasks(index)}; queue)
+            {
+                task.emplace(pop_task(*queue, false));
+            }
+            else
+            {
+                spawned = take_spawned(index);
+
+                //Another worker took it first
+                if(!spawned)
+                {
+                    continue;
                 }
             }
 
-            ++current;
+            const bool timed{m_observer != nullptr};
+
+            ++m_active_count;
+            publish_active_count();
+            executed = true;
+
+            lock.unlock();
+
+            notify_space();
+
+            run_time = task ? run_task(*task, timed) : run_spawned(spawned, timed);
+
+            arena.reset();
         }
 
-        m_tasks.clear();
+        run_hook(m_attributes.on_exit, index);
 
-        return output;
+        impl::this_worker_context = nullptr;
     }
 
-private:
-    template<typename... Args>
-    void push_task(Args&&... args)
+    //Nothing can report an exception thrown on a worker outside of a task, and letting it escape would terminate the program
+    static void run_hook(const std::function<void(std::size_t)>& hook, std::size_t index) noexcept
     {
-        m_tasks.emplace_back(std::in_place_type<impl::task>, std::forward<Args>(args)...);
+        if(!hook)
+        {
+            return;
+        }
+
+        try
+        {
+            hook(index);
+        }
+        catch(...)
+        {
+
+        }
     }
 
-    template<typename InputIt, typename CheckpointIt>
-    void flush(std::vector<impl::task_type>& output, CheckpointIt checkpoints_begin, CheckpointIt checkpoints_end, InputIt begin, InputIt end)
+    //The clock is only read when an observer was attached as the task was taken
+    static std::optional<std::chrono::steady_clock::duration> run_task(task_type& task, bool timed)
     {
-        std::size_t checkpoint_counter{};
+        if(!timed)
+        {
+            execute_task(task);
 
-        while(begin != end)
+            return std::nullopt;
+        }
+
+        const auto begin{std::chrono::steady_clock::now()};
+
+        execute_task(task);
+
+        return std::chrono::steady_clock::now() - begin;
+    }
+
+    static std::optional<std::chrono::steady_clock::duration> run_spawned(impl::spawned_task* task, bool timed) noexcept
+    {
+        if(!timed)
         {
-            if(std::holds_alternative<impl::checkpoint>(*begin))
-            {
-                auto checkpoint{std::get<impl::checkpoint>(std::move(*begin))};
+            task->run();
 
-                checkpoint.set_reset_value(checkpoint_counter + 1); //+ 1 for the caller
-                output.emplace_back(std::in_place_type<impl::checkpoint>, std::move(checkpoint));
+            return std::nullopt;
+        }
 
-                ++checkpoints_begin;
-            }
-            else if(std::holds_alternative<impl::task>(*begin))
-            {
-                auto task{std::get<impl::task>(std::move(*begin))};
+        const auto begin{std::chrono::steady_clock::now()};
 
-                task.set_checkpoint_range(impl::checkpoint_range{checkpoints_begin, checkpoints_end});
-                output.emplace_back(std::in_place_type<impl::task>, std::move(task));
+        task->run();
 
-                ++checkpoint_counter;
-            }
-            else
-            {
-                auto fence{std::get<impl::fence>(std::move(*begin))};
+        return std::chrono::steady_clock::now() - begin;
+    }
 
-                output.emplace_back(std::in_place_type<impl::fence>, std::move(fence));
+    //Called by task_group::run on one of the pool's workers: the child goes in the worker's own deque without locking the pool,
+    //the lock is only taken to wake up a worker if one sleeps. Returns false if the deque is full.
+    bool spawn(impl::spawned_task* task) noexcept
+    {
+        if(!m_worker_queues[impl::this_worker_context->index].spawned.push(task))
+        {
+            return false;
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if(m_sleeping_count.load(std::memory_order_relaxed) != 0)
+        {
+            std::lock_guard lock{m_mutex};
+            notify_workers(1);
+        }
+
+        return true;
+    }
+
+    //Called by task_group::wait on one of the pool's workers: runs the newest child of its own deque, or steals one from another worker
+    bool run_spawned_task() noexcept
+    {
+        if(auto* task{take_spawned(impl::this_worker_context->index)}; task)
+        {
+            task->run();
+
+            return true;
+        }
+
+        return false;
+    }
+
+    //The worker's own children first, newest first, then the oldest child of another worker
+    impl::spawned_task* take_spawned(std::size_t worker) noexcept
+    {
+        if(auto* task{m_worker_queues[worker].spawned.pop()}; task)
+        {
+            return task;
+        }
+
+        for(std::size_t i{1}; i < m_thread_count; ++i)
+        {
+            if(auto* task{m_worker_queues[(worker + i) % m_thread_count].spawned.steal()}; task)
+            {
+                return task;
             }
+        }
 
-            ++begin;
+        return nullptr;
+    }
+
+    static void execute_task(task_type& task)
+    {
+        if(std::holds_alternative<impl::task>(task))
+        {
+            std::get<impl::task>(task).execute();
+        }
+        else
+        {
+            std::get<impl::task_holder_base*>(task)->execute();
         }
     }
 
-    std::size_t count_checkpoints() const noexcept
+    //Must be called with m_mutex locked
+    void spawn_worker()
     {
-        return std::count_if(std::begin(m_tasks), std::end(m_tasks), [](auto&& task)
+        m_threads.emplace_back(m_attributes, [this, index = std::size(m_threads)]()
         {
-            return std::holds_alternative<impl::checkpoint>(task);
+            worker_main(index);
         });
+
+        if(m_observer)
+        {
+            m_observer->on_thread_started(std::size(m_threads));
+        }
     }
 
-private:
-    std::uint32_t m_thread_count{};
-    std::vector<impl::task_type> m_tasks{};
-};
+    //Must be called with m_mutex locked. In lazy mode, starts one worker per queued task idle workers can not take, all at once.
+    //A worker that fails to start is not reported to the caller, whose task is already queued: the running workers take it, and the next call retries.
+    void grow() noexcept
+    {
+        const std::size_t queued{queued_count()};
+        if(queued <= m_idle_count || std::size(m_threads) == m_thread_count)
+        {
+            return;
+        }
 
-class thread_pool
-{
-public:
-    explicit thread_pool(std::size_t thread_count = std::thread::hardware_concurrency())
+        const std::size_t count{std::min(queued - m_idle_count, m_thread_count - std::size(m_threads))};
+
+        try
+        {
+            for(std::size_t i{}; i < count; ++i)
+            {
+                spawn_worker();
+            }
+        }
+        catch(...)
+        {
+
+        }
+    }
+
+    template<typename Func, typename... Args>
+    static auto make_task(Func&& func, Args&&... args)
+    {
+        return [func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+        {
+            std::invoke(std::forward<Func>(func), std::forward<Args>(args)...);
+        };
+    }
+
+    template<typename Func, typename... Args>
+    auto invoke_impl(std::size_t worker, Func&& func, Args&&... args)
     {
-        const auto worker_base = [this]()
+        using return_type  = std::invoke_result_t<Func, Args...>;
+        using promise_type = std::promise<return_type>;
+        using future_type  = std::future<return_type>;
+
+        promise_type promise{};
+        future_type  future {promise.get_future()};
+
+        if constexpr(std::is_same_v<return_type, void>)
         {
-            while(true)
+            push_impl(worker, [promise = std::move(promise), func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
             {
-                std::unique_lock lock{m_mutex};
-                m_worker_condition.wait(lock, [this]
+                try
                 {
-                    if(std::empty(m_tasks) && !std::empty(m_task_lists))
-                    {
-                        const auto notify_count{update_task_lists()};
+                    std::invoke(std::forward<Func>(func), std::forward<Args>(args)...);
+                    promise.set_value();
+                }
+                catch(...)
+                {
+                    promise.set_exception(std::current_exception());
+                }
+            });
+        }
+        else
+        {
+            push_impl(worker, [promise = std::move(promise), func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+            {
+                try
+                {
+                    promise.set_value(std::invoke(std::forward<Func>(func), std::forward<Args>(args)...));
+                }
+                catch(...)
+                {
+                    promise.set_exception(std::current_exception());
+                }
+            });
+        }
 
-                        for(std::size_t i{}; i < std::min(notify_count, std::size(m_threads)); ++i)
-                        {
-                            m_worker_condition.notify_one();
-                        }
-                    }
+        return future;
+    }
 
-                    if(std::empty(m_tasks) && std::empty(m_task_lists))
-                    {
-                        m_wait_condition.notify_all();
-                    }
+    template<typename Func>
+    void push_impl(std::size_t worker, Func&& func)
+    {
+        std::unique_lock lock{m_mutex};
 
-                    return !m_running || !std::empty(m_tasks);
-                });
+        if(is_full())
+        {
+            const bool is_own_worker{impl::this_worker_context && impl::this_worker_context->pool == this};
+
+            if(is_own_worker || static_cast<bool>(m_options & thread_pool_options::caller_runs))
+            {
+                lock.unlock();
+
+                std::invoke(func);
+
+                return;
+            }
+
+            m_space_condition.wait(lock, [this]{ return !is_full(); });
+        }
+
+        push_locked(lock, worker, std::forward<Func>(func));
+    }
+
+    //Unlocks the mutex. worker is no_worker for the shared queue.
+    template<typename Func>
+    void push_locked(std::unique_lock<std::mutex>& lock, std::size_t worker, Func&& func)
+    {
+        if(worker == no_worker)
+        {
+            m_tasks.emplace_back(std::in_place_type<impl::task>, std::forward<Func>(func));
+
+            notify_workers(1);
+        }
+        else
+        {
+            auto& queue{m_worker_queues[worker]};
+            queue.tasks.emplace_back(std::in_place_type<impl::task>, std::forward<Func>(func));
+            ++m_affine_count;
+
+            //Only the target worker is woken up if it is idle, other idle workers do not steal from an idle one.
+            //If it is busy, any idle worker may take the task.
+            if(queue.waiting)
+            {
+                notify_worker_locked(worker);
+            }
+            else
+            {
+                notify_workers(1);
+            }
+        }
+
+        publish_queued(1);
+        grow();
 
-                if(!m_running)
-                {
-                    break;
-                }
+        lock.unlock();
+    }
 
-                auto task{std::move(m_tasks.front())};
-                m_tasks.erase(std::begin(m_tasks));
+    //Must be called with m_mutex locked
+    void notify_worker_locked(std::size_t worker) noexcept
+    {
+        auto& queue{m_worker_queues[worker]};
 
-                lock.unlock();
+        if(queue.waiting && !queue.notified)
+        {
+            queue.notified = true;
+            queue.condition.notify_one();
+        }
+    }
 
-                if(std::holds_alternative<impl::task>(task))
-                {
-                    std::get<impl::task>(task).execute();
-                }
-                else
-                {
-                    std::get<impl::task_holder_base*>(task)->execute();
-                }
+    //Must be called with m_mutex locked. Wakes up to count idle workers that have not been woken up yet, except the given one.
+    //Each worker sleeps on its own condition variable, so no other worker is woken up for nothing.
+    void notify_workers(std::size_t count, std::size_t except = no_worker) noexcept
+    {
+        for(std::size_t i{}; i < m_thread_count && count != 0; ++i)
+        {
+            if(i != except && m_worker_queues[i].waiting && !m_worker_queues[i].notified)
+            {
+                notify_worker_locked(i);
+                --count;
             }
-        };
-
-        thread_count = thread_count != 0 ? thread_count : 8;
+        }
+    }
 
-        m_threads.reserve(thread_count);
-        for(std::size_t i{}; i < thread_count; ++i)
+    //Must be called with m_mutex locked, once a task completed. A worker woken up while the quota of set_max_active_workers was reached
+    //goes back to sleep, and its affine tasks are not stolen while it waits: when the task frees a slot, wake a worker that has one to run.
+    void notify_held_back(std::size_t except) noexcept
+    {
+        if(m_active_count + 1 != m_max_active_count || (!has_tasks() && !has_spawned()))
         {
-            m_threads.emplace_back(worker_base);
+            return;
         }
 
-        m_tasks.reserve(4 * thread_count);
-        m_task_lists.reserve(4 * thread_count);
+        for(std::size_t i{}; i < m_thread_count; ++i)
+        {
+            if(i != except && m_worker_queues[i].waiting && !m_worker_queues[i].notified && has_work(i))
+            {
+                notify_worker_locked(i);
+
+                return;
+            }
+        }
     }
 
-    ~thread_pool()
+    void notify_all_workers() noexcept
     {
-        std::unique_lock lock{m_mutex};
-        m_wait_condition.wait(lock, [this]
+        for(std::size_t i{}; i < m_thread_count; ++i)
         {
-            return std::empty(m_tasks) && std::empty(m_task_lists);
-        });
-
-        m_running = false;
+            m_worker_queues[i].condition.notify_one();
+        }
+    }
 
-        lock.unlock();
+    //Must be called with m_mutex locked
+    bool has_tasks() const noexcept
+    {
+        return !std::empty(m_tasks) || m_affine_count != 0;
+    }
 
-        m_worker_condition.notify_all();
+    //A worker about to sleep increments m_sleeping_count then checks the deques, spawn pushes then checks m_sleeping_count:
+    //with both sides sequentially consistent, either the worker sees the child or spawn sees the worker and wakes it up.
+    bool has_spawned() const noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
 
-        for(auto&& thread : m_threads)
+        for(std::size_t i{}; i < m_thread_count; ++i)
         {
-            if(thread.joinable())
+            if(!m_worker_queues[i].spawned.empty())
             {
-                thread.join();
+                return true;
             }
         }
-    }
 
-    thread_pool(const thread_pool&) = delete;
-    thread_pool& operator=(const thread_pool&) = delete;
-    thread_pool(thread_pool&&) = delete;
-    thread_pool& operator=(thread_pool&&) = delete;
+        return false;
+    }
 
-    template<typename Func, typename... Args>
-    void execute(Func&& func, Args&&... args)
+    //Must be called with m_mutex locked
+    bool has_work(std::size_t worker) noexcept
     {
-        push_impl([func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
-        {
-            std::invoke(std::forward<Func>(func), std::forward<Args>(args)...);
-        });
+        return find_tasks(worker) != nullptr || has_spawned();
+    }
 
-        m_worker_condition.notify_one();
+    //Must be called with m_mutex locked
+    std::size_t queued_count() const noexcept
+    {
+        return std::size(m_tasks) + m_affine_count;
     }
 
-    template<typename Func, typename... Args>
-    auto invoke(Func&& func, Args&&... args)
+    //Must be called with m_mutex locked. Tasks enqueued by task lists count too, but are never held back.
+    bool is_full() const noexcept
     {
-        using return_type  = std::invoke_result_t<Func, Args...>;
-        using promise_type = std::promise<return_type>;
-        using future_type  = std::future<return_type>;
+        return queued_count() >= m_capacity;
+    }
 
-        promise_type promise{};
-        future_type  future {promise.get_future()};
+    //Must be called with m_mutex locked. Returns the queue the given worker, or no_worker, should take its next task from:
+    //its own queue, then the shared one, then the queue of a worker that is busy. Workers that are not started yet count as busy.
+    std::deque<task_type>* find_tasks(std::size_t worker) noexcept
+    {
+        if(worker != no_worker && !std::empty(m_worker_queues[worker].tasks))
+        {
+            return &m_worker_queues[worker].tasks;
+        }
 
-        if constexpr(std::is_same_v<return_type, void>)
+        if(!std::empty(m_tasks))
         {
-            push_impl([promise = std::move(promise), func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
-            {
-                std::invoke(std::forward<Func>(func), std::forward<Args>(args)...);
-                promise.set_value();
-            });
+            return &m_tasks;
         }
-        else
+
+        if(m_affine_count != 0)
         {
-            push_impl([promise = std::move(promise), func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable
+            for(std::size_t i{}; i < m_thread_count; ++i)
             {
-                promise.set_value(std::invoke(std::forward<Func>(func), std::forward<Args>(args)...));
-            });
-        }
+                auto& queue{m_worker_queues[i]};
 
-        m_worker_condition.notify_one();
+                if(i != worker && !queue.waiting && !std::empty(queue.tasks))
+                {
+                    return &queue.tasks;
+                }
+            }
+        }
 
-        return future;
+        return nullptr;
     }
 
-    std::future<task_list> push(task_list list)
+    //Must be called with m_mutex locked
+    task_type pop_task(std::deque<task_type>& queue, bool newest)
     {
-        list.reset(m_worker_condition);
-
-        std::unique_lock lock{m_mutex};
+        task_type output{newest ? std::move(queue.back()) : std::move(queue.front())};
 
-        auto& data{m_task_lists.emplace_back()};
-        data.list = std::move(list);
+        if(newest)
+        {
+            queue.pop_back();
+        }
+        else
+        {
+            queue.pop_front();
+        }
 
-        auto future{data.promise.get_future()};
+        if(&queue != &m_tasks)
+        {
+            --m_affine_count;
+        }
 
-        const auto notify_count{update_task_lists()};
+        publish_queued(0);
 
-        lock.unlock();
+        return output;
+    }
 
-        for(std::size_t i{}; i < std::min(notify_count, std::size(m_threads)); ++i)
+    //Must be called with m_mutex locked
+    void publish_queued(std::size_t queued) noexcept
+    {
+        if(m_observer)
         {
-            m_worker_condition.notify_one();
+            m_observer->on_queued(queued, queued_count());
         }
-
-        return future;
     }
 
-    void wait_idle()
+    //Must be called with m_mutex locked
+    void publish_active_count() noexcept
     {
-        std::unique_lock lock{m_mutex};
-        m_wait_condition.wait(lock, [this]
+        if(m_observer)
         {
-            return std::empty(m_tasks) && std::empty(m_task_lists);
-        });
+            m_observer->on_active_workers(m_active_count);
+        }
     }
 
-    std::size_t thread_count() const noexcept
+    //Must be called with m_mutex locked, once the active count is decremented
+    void publish_completed(const std::optional<std::chrono::steady_clock::duration>& run_time) noexcept
     {
-        return std::size(m_threads);
+        if(m_observer)
+        {
+            if(run_time)
+            {
+                m_observer->on_task_completed(*run_time);
+            }
+
+            m_observer->on_active_workers(m_active_count);
+        }
     }
 
-private:
-    template<typename Func>
-    void push_impl(Func&& func)
+    void notify_space()
     {
-        std::lock_guard lock{m_mutex};
-
-        m_tasks.emplace_back(std::in_place_type<impl::task>, std::forward<Func>(func));
+        if(m_capacity != unbounded)
+        {
+            m_space_condition.notify_one();
+        }
     }
 
     std::size_t update_task_lists()
@@ -995,13 +3276,27 @@ private:
         std::size_t notify_count{};
         bool need_free{};
 
-        for(auto& list : m_task_lists)
+        //Rotate the first served list so the same tenant does not always end up at the front of the queue
+        const std::size_t list_count{std::size(m_task_lists)};
+        m_first_list = list_count != 0 ? (m_first_list + 1) % list_count : 0;
+
+        for(std::size_t i{}; i < list_count; ++i)
         {
-            const auto [end, count] = list.list.next(std::back_inserter(m_tasks));
+            auto& list{m_task_lists[(m_first_list + i) % list_count]};
+
+            const auto [end, count] = list.list.next(std::back_inserter(m_tasks), list.weight * m_thread_count);
 
             if(end && count == 0)
             {
-                list.promise.set_value(std::move(list.list));
+                if(auto error{list.list.error()}; error)
+                {
+                    list.promise.set_exception(std::make_exception_ptr(task_list_error{std::move(list.list), std::move(error)}));
+                }
+                else
+                {
+                    list.promise.set_value(std::move(list.list));
+                }
+
                 list.need_free = true;
 
                 need_free = true;
@@ -1020,28 +3315,277 @@ private:
             m_task_lists.erase(std::remove_if(std::begin(m_task_lists), std::end(m_task_lists), predicate), std::end(m_task_lists));
         }
 
+        publish_queued(notify_count);
+
         return notify_count;
     }
 
 private:
+    struct worker_queue
+    {
+        std::deque<task_type> tasks{};
+        impl::spawn_deque spawned{};
+        std::condition_variable condition{};
+        bool waiting{};
+        bool notified{};
+    };
+
     struct task_list_data
     {
         task_list list{};
         std::promise<task_list> promise{};
+        std::size_t weight{1};
         bool need_free{};
     };
 
 private:
-    std::vector<std::thread> m_threads{};
-
-    std::vector<std::variant<impl::task, impl::task_holder_base*>> m_tasks{};
+    std::size_t m_thread_count{};
+    thread_pool_options m_options{};
+    std::size_t m_capacity{};
+    worker_attributes m_attributes{};
+    std::vector<impl::worker_thread> m_threads{};
+
+    std::deque<task_type> m_tasks{};
+    std::unique_ptr<worker_queue[]> m_worker_queues{};
+    std::size_t m_affine_count{};
     std::vector<task_list_data> m_task_lists{};
+    std::size_t m_first_list{};
 
-    std::condition_variable m_worker_condition{};
     std::condition_variable m_wait_condition{};
-    std::mutex m_mutex{};
-
+    std::condition_variable m_space_condition{};
+    mutable std::mutex m_mutex{};
+
+    std::size_t m_idle_count{};
+    std::atomic<std::size_t> m_sleeping_count{};
+    std::size_t m_active_count{};
+    std::size_t m_max_active_count{};
+    bool m_paused{};
     bool m_running{true};
+
+    thread_pool_observer* m_observer{};
+};
+
+namespace impl
+{
+
+//Lets a thread waiting for pool tasks (task_group, strand, static_task_graph, ...) run one of the queued tasks meanwhile.
+//Returns false if there was none, or if the calling thread is not one of the pool's own workers.
+inline bool run_pending_task(thread_pool& pool)
+{
+    return pool.run_pending_task();
+}
+
+//Wakes one idle worker, so it enqueues the tasks a signaled fence was holding back
+inline void notify_worker(thread_pool& pool) noexcept
+{
+    std::lock_guard lock{pool.m_mutex};
+
+    pool.notify_workers(1);
+}
+
+}
+
+namespace this_worker
+{
+
+inline constexpr std::size_t npos{std::numeric_limits<std::size_t>::max()};
+
+inline bool is_worker() noexcept
+{
+    return impl::this_worker_context != nullptr;
+}
+
+inline std::size_t index() noexcept
+{
+    return impl::this_worker_context ? impl::this_worker_context->index : npos;
+}
+
+inline thread_pool* pool() noexcept
+{
+    return impl::this_worker_context ? impl::this_worker_context->pool : nullptr;
+}
+
+inline scratch_arena& arena() noexcept
+{
+    assert(impl::this_worker_context && "nes::this_worker::arena called outside of a thread pool worker.");
+
+    return *impl::this_worker_context->arena;
+}
+
+}
+
+template<typename T>
+class worker_local
+{
+public:
+    explicit worker_local(const thread_pool& pool, const T& value = T{})
+    :m_pool{&pool}
+    ,m_values(pool.thread_count(), impl::padded_value<T>{value})
+    {
+
+    }
+
+    ~worker_local() = default;
+    worker_local(const worker_local&) = delete;
+    worker_local& operator=(const worker_local&) = delete;
+    worker_local(worker_local&&) = default;
+    worker_local& operator=(worker_local&&) = default;
+
+    T& local() noexcept
+    {
+        assert(this_worker::pool() == m_pool && "nes::worker_local::local called outside of a worker of its thread pool.");
+
+        return m_values[this_worker::index()].value;
+    }
+
+    T& operator[](std::size_t index) noexcept
+    {
+        return m_values[index].value;
+    }
+
+    const T& operator[](std::size_t index) const noexcept
+    {
+        return m_values[index].value;
+    }
+
+    template<typename Func>
+    void for_each(Func&& func)
+    {
+        for(auto& value : m_values)
+        {
+            std::invoke(func, value.value);
+        }
+    }
+
+    template<typename BinaryOp>
+    T combine(T init, BinaryOp&& op) const
+    {
+        for(auto& value : m_values)
+        {
+            init = std::invoke(op, std::move(init), value.value);
+        }
+
+        return init;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return std::size(m_values);
+    }
+
+private:
+    const thread_pool* m_pool{};
+    std::vector<impl::padded_value<T>> m_values{};
+};
+
+//Fork-join helper: run() may be called from any thread, including from tasks of the group itself.
+//Called from one of the pool's workers, wait() executes queued pool tasks while children are pending instead of blocking the worker,
+//any other thread blocks until the children are done.
+//Called from one of the pool's workers, run() pushes the child to that worker's own work-stealing deque: one allocation and no lock,
+//other workers steal children when they run out of queued tasks. When the deque is full, the child runs inline.
+//From any other thread, run() is a regular thread_pool::execute.
+class task_group
+{
+public:
+    explicit task_group(thread_pool& pool) noexcept
+    :m_pool{&pool}
+    {
+
+    }
+
+    ~task_group()
+    {
+        wait_impl();
+    }
+
+    task_group(const task_group&) = delete;
+    task_group& operator=(const task_group&) = delete;
+    task_group(task_group&&) = delete;
+    task_group& operator=(task_group&&) = delete;
+
+    template<typename Func, typename... Args>
+    void run(Func&& func, Args&&... args)
+    {
+        auto child{[this, func = std::forward<Func>(func), ...args = std::forward<Args>(args)]() mutable noexcept
+        {
+            try
+            {
+                std::invoke(std::move(func), std::move(args)...);
+            }
+            catch(...)
+            {
+                std::lock_guard lock{m_mutex};
+
+                if(!m_error)
+                {
+                    m_error = std::current_exception();
+                }
+            }
+
+            m_pending.release();
+        }};
+
+        if(impl::this_worker_context && impl::this_worker_context->pool == m_pool)
+        {
+            auto task{std::make_unique<impl::spawned_task_holder<decltype(child)>>(std::move(child))};
+
+            m_pending.add();
+
+            if(m_pool->spawn(task.get()))
+            {
+                task.release();
+            }
+            else
+            {
+                task.release()->run();
+            }
+
+            return;
+        }
+
+        m_pending.add();
+
+        try
+        {
+            m_pool->execute(std::move(child));
+        }
+        catch(...)
+        {
+            m_pending.release();
+            throw;
+        }
+    }
+
+    //Rethrows the first exception thrown by a child task, if any.
+    void wait()
+    {
+        wait_impl();
+
+        std::lock_guard lock{m_mutex};
+
+        if(m_error)
+        {
+            std::rethrow_exception(std::exchange(m_error, nullptr));
+        }
+    }
+
+private:
+    //Own children are the most likely to be in the worker's deque, and they keep the helping as deep as the recursion
+    void wait_impl() noexcept
+    {
+        const bool own_worker{impl::this_worker_context && impl::this_worker_context->pool == m_pool};
+
+        m_pending.wait([this, own_worker]()
+        {
+            return (own_worker && m_pool->run_spawned_task()) || impl::run_pending_task(*m_pool);
+        });
+    }
+
+private:
+    thread_pool* m_pool{};
+    impl::pending_counter m_pending{};
+    std::mutex m_mutex{};
+    std::exception_ptr m_error{};
 };
 
 }
@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////
+/// Copyright 2020 Alexy Pellegrini
+///
+/// Permission is hereby granted, free of charge,
+/// to any person obtaining a copy of this software
+/// and associated documentation files (the "Software"),
+/// to deal in the Software without restriction,
+/// including without limitation the rights to use,
+/// copy, modify, merge, publish, distribute, sublicense,
+/// and/or sell copies of the Software, and to permit
+/// persons to whom the Software is furnished to do so,
+/// subject to the following conditions:
+///
+/// The above copyright notice and this permission notice
+/// shall be included in all copies or substantial portions
+/// of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF
+/// ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+/// TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+/// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT
+/// SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+/// ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+/// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+/// OR OTHER DEALINGS IN THE SOFTWARE.
+///////////////////////////////////////////////////////////
+
+#ifndef NOT_ENOUGH_STANDARDS_THREAD_POOL_TELEMETRY
+#define NOT_ENOUGH_STANDARDS_THREAD_POOL_TELEMETRY
+
+#include <atomic>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#include "shared_memory.hpp"
+#include "thread_pool.hpp"
+
+namespace nes
+{
+
+//Counters published by thread_pool_telemetry_publisher at offset 0 of a shared memory segment, read by external monitors like nes-top.
+//The layout is fixed: every field is a naturally aligned 64-bit unsigned integer in native endianness, written with relaxed atomic operations.
+//magic is written last, with release semantics, readers must check it and version before trusting the other fields.
+struct thread_pool_telemetry
+{
+    static constexpr std::uint64_t magic_value{0x4E45535F54504C31}; //"NES_TPL1"
+    static constexpr std::uint64_t current_version{1};
+    static constexpr std::size_t latency_bucket_count{16};
+
+    std::uint64_t magic;
+    std::uint64_t version;
+    std::uint64_t running; //1 while the pool is alive
+    std::uint64_t thread_count;
+    std::uint64_t started_thread_count;
+    std::uint64_t queue_depth;
+    std::uint64_t active_workers;
+    std::uint64_t tasks_queued;
+    std::uint64_t tasks_completed;
+    //Task run times: bucket 0 counts tasks under 1 microsecond, bucket i tasks in [2^(i-1), 2^i) microseconds, and the last one everything longer
+    std::uint64_t latency_buckets[latency_bucket_count];
+};
+
+static_assert(std::is_trivial_v<thread_pool_telemetry> && sizeof(thread_pool_telemetry) == 200, "nes::thread_pool_telemetry layout must not change");
+
+//Publishes the counters of a thread_pool in the shared memory segment name, see thread_pool_telemetry for its layout.
+//The segment lives as long as the publisher, which must be destroyed before the pool or detached with thread_pool::set_observer.
+//running is cleared once the publisher is detached, which the pool's destructor does after joining its workers.
+class thread_pool_telemetry_publisher final : public thread_pool_observer
+{
+public:
+    thread_pool_telemetry_publisher(thread_pool& pool, const std::string& name)
+    :m_memory{name, sizeof(thread_pool_telemetry)}
+    ,m_map{m_memory.map<thread_pool_telemetry>(0)}
+    {
+        pool.set_observer(this);
+        m_pool.store(&pool, std::memory_order_release);
+    }
+
+    ~thread_pool_telemetry_publisher()
+    {
+        if(auto* pool{m_pool.load(std::memory_order_acquire)}; pool)
+        {
+            pool->set_observer(nullptr);
+        }
+    }
+
+    thread_pool_telemetry_publisher(const thread_pool_telemetry_publisher&) = delete;
+    thread_pool_telemetry_publisher& operator=(const thread_pool_telemetry_publisher&) = delete;
+    thread_pool_telemetry_publisher(thread_pool_telemetry_publisher&&) = delete;
+    thread_pool_telemetry_publisher& operator=(thread_pool_telemetry_publisher&&) = delete;
+
+    void on_attach(std::size_t thread_count, std::size_t started_thread_count, std::size_t queue_depth, std::size_t active_workers) noexcept override
+    {
+        store(m_map->version, thread_pool_telemetry::current_version);
+        store(m_map->running, 1);
+        store(m_map->thread_count, thread_count);
+        store(m_map->started_thread_count, started_thread_count);
+        store(m_map->queue_depth, queue_depth);
+        store(m_map->active_workers, active_workers);
+        std::atomic_ref{m_map->magic}.store(thread_pool_telemetry::magic_value, std::memory_order_release);
+    }
+
+    void on_detach() noexcept override
+    {
+        std::atomic_ref{m_map->running}.store(0, std::memory_order_release);
+        m_pool.store(nullptr, std::memory_order_release);
+    }
+
+    void on_thread_started(std::size_t started_thread_count) noexcept override
+    {
+        store(m_map->started_thread_count, started_thread_count);
+    }
+
+    void on_queued(std::size_t count, std::size_t queue_depth) noexcept override
+    {
+        std::atomic_ref{m_map->tasks_queued}.fetch_add(count, std::memory_order_relaxed);
+        store(m_map->queue_depth, queue_depth);
+    }
+
+    void on_active_workers(std::size_t active_workers) noexcept override
+    {
+        store(m_map->active_workers, active_workers);
+    }
+
+    void on_task_completed(std::chrono::steady_clock::duration run_time) noexcept override
+    {
+        const auto elapsed{std::chrono::duration_cast<std::chrono::microseconds>(run_time).count()};
+        const auto bucket{std::min<std::size_t>(std::bit_width(static_cast<std::uint64_t>(elapsed)), thread_pool_telemetry::latency_bucket_count - 1)};
+
+        std::atomic_ref{m_map->latency_buckets[bucket]}.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_ref{m_map->tasks_completed}.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    static void store(std::uint64_t& field, std::uint64_t value) noexcept
+    {
+        std::atomic_ref{field}.store(value, std::memory_order_relaxed);
+    }
+
+private:
+    shared_memory m_memory;
+    unique_map_t<thread_pool_telemetry> m_map;
+    std::atomic<thread_pool*> m_pool{};
+};
+
+}
+
+#endif
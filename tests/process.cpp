@@ -8,8 +8,10 @@
 #include <cassert>
 #include <cstdlib>
 #include <random>
+#include <numeric>
 
 #include <nes/pipe.hpp>
+#include <nes/splice.hpp>
 #include <nes/shared_library.hpp>
 #include <nes/process.hpp>
 #include <nes/shared_memory.hpp>
@@ -17,6 +19,19 @@
 #include <nes/semaphore.hpp>
 #include <nes/named_semaphore.hpp>
 #include <nes/thread_pool.hpp>
+#include <nes/thread_pool_telemetry.hpp>
+#include <nes/parallel_algorithm.hpp>
+#include <nes/execution.hpp>
+#include <nes/pipeline.hpp>
+#include <nes/channel.hpp>
+#include <nes/static_task_graph.hpp>
+#include <nes/strand.hpp>
+#include <nes/memoize.hpp>
+#include <nes/shared_work_queue.hpp>
+#if !defined(_WIN32)
+    #include <nes/poller.hpp>
+    #include <sys/resource.h>
+#endif
 
 #include "common.hpp"
 
@@ -39,6 +54,367 @@ static void shared_library_test()
     CHECK(value == 42, "Function returned wrong value " << value);
 }
 
+static void pipe_buffer_test()
+{
+    auto [is, os] = nes::make_anonymous_pipe(nes::pipe_options{4096, 1 << 18});
+
+    CHECK(is.rdbuf()->buffer_size() == 4096 && os.rdbuf()->buffer_size() == 4096, "make_anonymous_pipe ignored the buffer size");
+#if defined(__linux__)
+    CHECK(is.rdbuf()->pipe_capacity() >= (1 << 18) || is.rdbuf()->pipe_capacity() == 0, "make_anonymous_pipe ignored the pipe capacity");
+#endif
+
+    std::vector<std::uint32_t> input(100000);
+    std::iota(std::begin(input), std::end(input), 0u);
+
+    std::thread thread{[&os = os, &input]()
+    {
+        //Small writes are gathered, large ones bypass the buffer, the order must be kept
+        for(std::size_t i{}; i < 1000; ++i)
+        {
+            os.write(reinterpret_cast<const char*>(&input[i]), sizeof(std::uint32_t));
+        }
+
+        os.write(reinterpret_cast<const char*>(std::data(input) + 1000), static_cast<std::streamsize>((std::size(input) - 1000) * sizeof(std::uint32_t)));
+        os.close();
+    }};
+
+    std::vector<std::uint32_t> output(std::size(input));
+    is.read(reinterpret_cast<char*>(std::data(output)), 100 * sizeof(std::uint32_t));
+
+    is.rdbuf()->set_buffer_size(1 << 16);
+    CHECK(is.rdbuf()->buffer_size() == (1 << 16), "basic_pipe_streambuf::set_buffer_size did not change the buffer size");
+
+    is.read(reinterpret_cast<char*>(std::data(output) + 100), static_cast<std::streamsize>((std::size(output) - 100) * sizeof(std::uint32_t)));
+    thread.join();
+
+    CHECK(is, "Failed to read the whole pipe");
+    CHECK(output == input, "Pipe data was reordered or lost");
+
+    nes::process other{other_path, std::vector<std::string>{"Hey!"}, {}, nes::process_options::grab_stdout, nes::pipe_options{1 << 16, 0}};
+    CHECK(other.stdout_stream().rdbuf()->buffer_size() == (1 << 16), "process ignored the pipe buffer size");
+    other.join();
+    CHECK(other.return_code() == 0, "Other process failed with code " << other.return_code());
+
+    auto [small_is, small_os] = nes::make_anonymous_pipe(nes::pipe_options{0, 0});
+    CHECK(small_is.rdbuf()->buffer_size() == 1 && small_os.rdbuf()->buffer_size() == 1, "make_anonymous_pipe accepted a buffer size of 0");
+
+    small_os << "abc" << std::flush;
+    CHECK(small_os.rdbuf()->set_buffer_size(0) && small_os.rdbuf()->buffer_size() == 1, "basic_pipe_streambuf::set_buffer_size accepted a size of 0");
+    small_os << "def";
+    small_os.close();
+
+    std::string text{};
+    small_is >> text;
+    CHECK(text == "abcdef", "Pipe with a 1 character buffer read " << text);
+}
+
+static void splice_test()
+{
+    std::vector<char> input(200000);
+    for(std::size_t i{}; i < std::size(input); ++i)
+    {
+        input[i] = static_cast<char>(i * 7 + i / 251);
+    }
+
+    auto [source_is, source_os] = nes::make_anonymous_pipe();
+    auto [sink_is, sink_os] = nes::make_anonymous_pipe();
+
+    std::thread writer{[&os = source_os, &input]()
+    {
+        os.write(std::data(input), static_cast<std::streamsize>(std::size(input)));
+        os.close();
+    }};
+
+    //Reading the first characters fills the input buffer, splice must forward them first
+    std::vector<char> output(std::size(input));
+    source_is.read(std::data(output), 10);
+
+    std::uint64_t moved{};
+    std::thread forwarder{[&moved, &is = source_is, &os = sink_os]()
+    {
+        moved = nes::splice(is, os);
+        os.close();
+    }};
+
+    sink_is.read(std::data(output) + 10, static_cast<std::streamsize>(std::size(output) - 10));
+    writer.join();
+    forwarder.join();
+
+    CHECK(moved == std::size(input) - 10, "nes::splice moved " << moved << " bytes instead of " << std::size(input) - 10);
+    CHECK(output == input, "nes::splice reordered or lost data");
+
+#if defined(NES_POSIX_SPLICE)
+    const int file{::open("/tmp/nes_test_splice", O_CREAT | O_RDWR | O_TRUNC, 0660)};
+    CHECK(file >= 0, "Failed to create the splice test file");
+
+    {
+        auto [is, os] = nes::make_anonymous_pipe();
+        os.write(std::data(input), 1000);
+        os.close();
+
+        CHECK(nes::splice(is, file) == 1000, "nes::splice to a file did not move everything");
+    }
+
+    {
+        auto [is, os] = nes::make_anonymous_pipe();
+        lseek(file, 0, SEEK_SET);
+
+        CHECK(nes::splice(file, os) == 1000, "nes::splice from a file did not move everything");
+        os.close();
+
+        std::vector<char> file_output(1000);
+        is.read(std::data(file_output), 1000);
+        CHECK(std::equal(std::begin(file_output), std::end(file_output), std::begin(input)), "nes::splice through a file changed the data");
+    }
+
+    ::close(file);
+    ::unlink("/tmp/nes_test_splice");
+#endif
+
+    {
+        auto [is, os] = nes::make_anonymous_pipe();
+
+        nes::vmsplice(os, std::span{std::data(input), 4096});
+        os.close();
+
+        std::vector<char> vmsplice_output(4096);
+        is.read(std::data(vmsplice_output), 4096);
+        CHECK(is && std::equal(std::begin(vmsplice_output), std::end(vmsplice_output), std::begin(input)), "nes::vmsplice changed the data");
+    }
+
+#if defined(NES_LINUX_SPLICE)
+    {
+        auto [is, os] = nes::make_anonymous_pipe();
+        auto [copy_is, copy_os] = nes::make_anonymous_pipe();
+
+        os.write("Hello", 5);
+        os.close();
+
+        CHECK(nes::tee(is, copy_os) == 5, "nes::tee did not copy the available data");
+        copy_os.close();
+
+        std::string original(5, '\0');
+        std::string copy(5, '\0');
+        is.read(std::data(original), 5);
+        copy_is.read(std::data(copy), 5);
+
+        CHECK(original == "Hello" && copy == "Hello", "nes::tee consumed or changed the data");
+    }
+#endif
+}
+
+#if defined(NES_POSIX_POLLER)
+//Raises the soft limit of open descriptors to at least count if needed, returns false if the hard limit is lower
+static bool reserve_descriptors(rlim_t count)
+{
+    rlimit limit{};
+    if(getrlimit(RLIMIT_NOFILE, &limit) != 0)
+        return false;
+
+    if(limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < count)
+    {
+        if(limit.rlim_max != RLIM_INFINITY && limit.rlim_max < count)
+            return false;
+
+        limit.rlim_cur = count;
+        if(setrlimit(RLIMIT_NOFILE, &limit) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+static void poller_test()
+{
+    {
+        auto [is, os] = nes::make_anonymous_pipe(nes::pipe_options{1024, 1 << 16});
+        is.rdbuf()->set_non_blocking(true);
+        os.rdbuf()->set_non_blocking(true);
+
+        std::array<char, 256> buffer{};
+        CHECK(is.rdbuf()->read_some(std::data(buffer), std::size(buffer)).status == nes::pipe_io_status::would_block, "read_some on an empty non-blocking pipe did not report would_block");
+
+        //Fill the pipe until the kernel refuses more data
+        std::size_t written{};
+        while(true)
+        {
+            const auto result{os.rdbuf()->write_some(std::data(buffer), std::size(buffer))};
+            if(result.status == nes::pipe_io_status::would_block)
+                break;
+
+            CHECK(result.status == nes::pipe_io_status::ok, "write_some failed on a non-blocking pipe");
+            written += result.count;
+        }
+
+        nes::poller poller{};
+        bool writable{};
+        poller.add(os, [&writable](nes::poll_events events)
+        {
+            writable = static_cast<bool>(events & nes::poll_events::writable);
+        });
+
+        CHECK(poller.poll(std::chrono::milliseconds{10}) == 0, "nes::poller reported a full pipe as writable");
+
+        std::size_t readed{};
+        while(readed < written)
+        {
+            const auto result{is.rdbuf()->read_some(std::data(buffer), std::size(buffer))};
+            CHECK(result.status == nes::pipe_io_status::ok, "read_some stopped before the end of the written data");
+            readed += result.count;
+        }
+
+        CHECK(poller.poll(std::chrono::seconds{5}) == 1 && writable, "nes::poller did not report an emptied pipe as writable");
+        poller.remove(os.rdbuf()->native_handle());
+        CHECK(poller.size() == 0, "nes::poller::remove did not unregister the handle");
+
+        os.close();
+        CHECK(is.rdbuf()->read_some(std::data(buffer), std::size(buffer)).status == nes::pipe_io_status::closed, "read_some did not report a closed pipe");
+    }
+
+    //A single thread services many pipes, callbacks run on a thread pool.
+    //Each pipe takes 2 descriptors, more than the default limit of macOS (256): it is raised, or the case is skipped.
+    constexpr std::size_t pipe_count{200};
+    if(reserve_descriptors(2 * pipe_count + 64))
+    {
+        const std::string message{"Hello from pipe "};
+
+        std::vector<nes::pipe_istream> inputs{};
+        std::vector<nes::pipe_ostream> outputs{};
+        std::vector<std::string> received(pipe_count);
+        std::atomic<std::size_t> closed{};
+
+        for(std::size_t i{}; i < pipe_count; ++i)
+        {
+            auto [is, os] = nes::make_anonymous_pipe();
+            is.rdbuf()->set_non_blocking(true);
+            inputs.emplace_back(std::move(is));
+            outputs.emplace_back(std::move(os));
+        }
+
+        nes::thread_pool pool{2};
+        nes::poller poller{pool};
+
+        for(std::size_t i{}; i < pipe_count; ++i)
+        {
+            poller.add(inputs[i], [&poller, &closed, &is = inputs[i], &output = received[i]](nes::poll_events)
+            {
+                std::array<char, 64> buffer{};
+
+                while(true)
+                {
+                    const auto result{is.rdbuf()->read_some(std::data(buffer), std::size(buffer))};
+                    if(result.status == nes::pipe_io_status::would_block)
+                        return;
+
+                    if(result.status == nes::pipe_io_status::closed)
+                    {
+                        poller.remove(is.rdbuf()->native_handle());
+                        if(closed.fetch_add(1) + 1 == pipe_count)
+                            poller.stop();
+
+                        return;
+                    }
+
+                    output.append(std::data(buffer), result.count);
+                }
+            });
+        }
+
+        CHECK(poller.size() == pipe_count, "nes::poller did not register every pipe");
+
+        std::thread writer{[&outputs, &message]()
+        {
+            for(std::size_t i{}; i < std::size(outputs); ++i)
+            {
+                outputs[i] << message << i;
+                outputs[i].close();
+            }
+        }};
+
+        poller.run();
+        writer.join();
+
+        for(std::size_t i{}; i < pipe_count; ++i)
+        {
+            CHECK(received[i] == message + std::to_string(i), "nes::poller lost data of pipe " << i << ", got \"" << received[i] << "\"");
+        }
+
+        CHECK(poller.size() == 0, "nes::poller still has registered pipes");
+    }
+
+    //Process standard streams
+    {
+        nes::process other{other_path, std::vector<std::string>{"poller output"}, nes::process_options::grab_stdout};
+        other.stdout_stream().rdbuf()->set_non_blocking(true);
+
+        nes::poller poller{};
+        std::string output{};
+        bool closed{};
+
+        poller.add(other.stdout_stream(), [&](nes::poll_events)
+        {
+            std::array<char, 64> buffer{};
+
+            while(true)
+            {
+                const auto result{other.stdout_stream().rdbuf()->read_some(std::data(buffer), std::size(buffer))};
+                if(result.status == nes::pipe_io_status::would_block)
+                    return;
+
+                if(result.status == nes::pipe_io_status::closed)
+                {
+                    poller.remove(other.stdout_stream().rdbuf()->native_handle());
+                    closed = true;
+                    return;
+                }
+
+                output.append(std::data(buffer), result.count);
+            }
+        });
+
+        while(!closed)
+        {
+            poller.poll();
+        }
+
+        other.join();
+        CHECK(other.return_code() == 0, "Other process failed with code " << other.return_code());
+
+        std::string expected{};
+        for(std::size_t i{}; i < 1000; ++i)
+        {
+            expected += "Line " + std::to_string(i) + '\n';
+        }
+
+        CHECK(output == expected, "nes::poller lost output of the process");
+    }
+
+    //Exceptions of callbacks are rethrown by poll
+    {
+        auto [is, os] = nes::make_anonymous_pipe();
+        os << "!" << std::flush;
+
+        nes::poller poller{};
+        poller.add(is, [](nes::poll_events)
+        {
+            throw std::runtime_error{"callback failed"};
+        });
+
+        bool caught{};
+        try
+        {
+            poller.poll();
+        }
+        catch(const std::runtime_error&)
+        {
+            caught = true;
+        }
+
+        CHECK(caught, "nes::poller::poll did not rethrow the exception of a callback");
+    }
+}
+#endif
+
 static void a_thread(nes::basic_pipe_istream<char>& is) noexcept
 {
     data_type     type{};
@@ -299,12 +675,1741 @@ static void thread_pool_test()
     CHECK(output == output_expected, "Wrong array values");
 }
 
-int main()
+static void worker_local_test()
+{
+    static constexpr std::size_t task_count{1024};
+
+    nes::thread_pool thread_pool{4};
+    nes::worker_local<std::uint64_t> counters{thread_pool};
+
+    CHECK(nes::this_worker::index() == nes::this_worker::npos, "Main thread must not be a worker");
+    CHECK(std::size(counters) == thread_pool.thread_count(), "Wrong worker_local size");
+
+    std::atomic<bool> failed{};
+
+    for(std::size_t i{}; i < task_count; ++i)
+    {
+        thread_pool.execute([&counters, &thread_pool, &failed, i]()
+        {
+            if(nes::this_worker::pool() != &thread_pool || nes::this_worker::index() >= thread_pool.thread_count())
+            {
+                failed = true;
+            }
+
+            auto buffer{nes::this_worker::arena().allocate_span<std::uint64_t>(64 + i % 64)};
+            for(auto& value : buffer)
+            {
+                value = 1;
+            }
+
+            counters.local() += buffer[0];
+        });
+    }
+
+    thread_pool.wait_idle();
+
+    CHECK(!failed, "Wrong worker context");
+
+    const auto total{counters.combine(std::uint64_t{}, std::plus<>{})};
+    CHECK(total == task_count, "Wrong worker_local total, expected " << task_count << " got " << total);
+}
+
+static void parallel_sort_test()
 {
+    static constexpr std::size_t size{1 << 18};
+
+    nes::thread_pool thread_pool{4};
+
+    std::mt19937 rng{42};
+    std::uniform_int_distribution<std::uint32_t> dist{};
+
+    std::vector<std::uint32_t> values(size);
+    std::generate(std::begin(values), std::end(values), [&rng, &dist]{ return dist(rng); });
+
+    auto expected{values};
+    std::sort(std::begin(expected), std::end(expected), std::greater<>{});
+
+    nes::parallel_sort(thread_pool, std::begin(values), std::end(values), std::greater<>{});
+    CHECK(values == expected, "parallel_sort produced a wrong result");
+
+    std::vector<std::uint32_t> left(size / 2);
+    std::vector<std::uint32_t> right(size / 3);
+    std::generate(std::begin(left), std::end(left), [&rng, &dist]{ return dist(rng); });
+    std::generate(std::begin(right), std::end(right), [&rng, &dist]{ return dist(rng); });
+    std::sort(std::begin(left), std::end(left));
+    std::sort(std::begin(right), std::end(right));
+
+    std::vector<std::uint32_t> merged(std::size(left) + std::size(right));
+    expected.resize(std::size(merged));
+
+    std::merge(std::begin(left), std::end(left), std::begin(right), std::end(right), std::begin(expected));
+    const auto end{nes::parallel_merge(thread_pool, std::begin(left), std::end(left), std::begin(right), std::end(right), std::begin(merged))};
+
+    CHECK(end == std::end(merged), "parallel_merge returned a wrong iterator");
+    CHECK(merged == expected, "parallel_merge produced a wrong result");
+
+    //A comparator throwing during the last merges must not leave tasks writing in the freed merge buffer
+    std::generate(std::begin(values), std::end(values), [&rng, &dist]{ return dist(rng); });
+
+    std::atomic<std::size_t> comparisons{};
+    auto copy{values};
+    nes::parallel_sort(thread_pool, std::begin(copy), std::end(copy), [&comparisons](std::uint32_t left, std::uint32_t right)
+    {
+        comparisons.fetch_add(1, std::memory_order_relaxed);
+        return left < right;
+    });
+
+    const std::size_t throw_at{comparisons.load() - 1000};
+    comparisons = 0;
+
+    bool caught{};
     try
     {
-        shared_library_test();
-        pipe_test();
+        nes::parallel_sort(thread_pool, std::begin(values), std::end(values), [&comparisons, throw_at](std::uint32_t left, std::uint32_t right)
+        {
+            if(comparisons.fetch_add(1, std::memory_order_relaxed) == throw_at)
+            {
+                throw std::runtime_error{"comparator failed"};
+            }
+
+            return left < right;
+        });
+    }
+    catch(const std::runtime_error&)
+    {
+        caught = true;
+    }
+
+    CHECK(caught, "parallel_sort did not rethrow the exception of its comparator");
+
+    //Like std::sort, parallel_sort must not need a default constructor
+    struct sort_record
+    {
+        explicit sort_record(std::uint32_t value)
+        :key{value}
+        ,text{std::to_string(value)}
+        {
+
+        }
+
+        std::uint32_t key;
+        std::string text;
+    };
+
+    std::vector<sort_record> records{};
+    records.reserve(1 << 16);
+    for(std::uint32_t i{}; i < (1 << 16); ++i)
+    {
+        records.emplace_back(dist(rng));
+    }
+
+    nes::parallel_sort(thread_pool, std::begin(records), std::end(records), [](const sort_record& left, const sort_record& right)
+    {
+        return left.key < right.key;
+    });
+
+    const bool sorted{std::is_sorted(std::begin(records), std::end(records), [](const sort_record& left, const sort_record& right)
+    {
+        return left.key < right.key;
+    })};
+
+    CHECK(sorted, "parallel_sort did not sort a type without default constructor");
+    CHECK(std::all_of(std::begin(records), std::end(records), [](const sort_record& record){ return record.text == std::to_string(record.key); }), "parallel_sort mixed up moved values");
+}
+
+struct promise_receiver
+{
+    std::promise<bool>* promise{};
+    nes::thread_pool* pool{};
+
+    void set_value() && noexcept
+    {
+        promise->set_value(nes::this_worker::pool() == pool);
+    }
+
+    void set_error(std::exception_ptr error) && noexcept
+    {
+        promise->set_exception(error);
+    }
+
+    void set_stopped() && noexcept
+    {
+        promise->set_value(false);
+    }
+};
+
+static void execution_test()
+{
+    static constexpr std::uint32_t shape{1000};
+
+    nes::thread_pool thread_pool{4};
+    nes::thread_pool_scheduler scheduler{thread_pool};
+
+    CHECK(scheduler == nes::thread_pool_scheduler{thread_pool}, "Schedulers of the same pool must compare equal");
+
+    std::promise<bool> schedule_promise{};
+    auto schedule_operation{scheduler.schedule().connect(promise_receiver{&schedule_promise, &thread_pool})};
+    schedule_operation.start();
+    CHECK(schedule_promise.get_future().get(), "schedule() sender did not complete on a pool worker");
+
+    std::array<std::atomic<std::uint32_t>, shape> calls{};
+
+    std::promise<bool> bulk_promise{};
+    auto bulk_operation{scheduler.schedule_bulk(shape, [&calls](std::uint32_t index)
+    {
+        ++calls[index];
+    }).connect(promise_receiver{&bulk_promise, &thread_pool})};
+
+    bulk_operation.start();
+    CHECK(bulk_promise.get_future().get(), "schedule_bulk() sender did not complete on a pool worker");
+
+    for(auto&& count : calls)
+    {
+        CHECK(count == 1, "schedule_bulk() called an index " << count << " times");
+    }
+
+    std::promise<bool> error_promise{};
+    auto error_operation{scheduler.schedule_bulk(shape, [](std::uint32_t index)
+    {
+        if(index == 42)
+        {
+            throw std::runtime_error{"42"};
+        }
+    }).connect(promise_receiver{&error_promise, &thread_pool})};
+
+    error_operation.start();
+
+    bool thrown{};
+    try
+    {
+        error_promise.get_future().get();
+    }
+    catch(const std::runtime_error&)
+    {
+        thrown = true;
+    }
+
+    CHECK(thrown, "schedule_bulk() sender did not forward the exception");
+}
+
+static void pipeline_test()
+{
+    static constexpr std::uint32_t item_count{1000};
+    static constexpr std::size_t max_in_flight{8};
+
+    nes::thread_pool thread_pool{4};
+
+    std::uint32_t next{};
+    std::atomic<std::size_t> in_flight{};
+    std::atomic<std::size_t> max_seen{};
+
+    std::vector<std::uint64_t> ordered{};
+    std::uint64_t sum{};
+
+    nes::pipeline pipeline
+    {
+        [&next, &in_flight, &max_seen]() -> std::optional<std::uint32_t>
+        {
+            if(next == item_count)
+            {
+                return std::nullopt;
+            }
+
+            const std::size_t current{++in_flight};
+            std::size_t expected{max_seen.load()};
+            while(current > expected && !max_seen.compare_exchange_weak(expected, current));
+
+            return next++;
+        },
+        nes::pipeline_stage{nes::pipeline_mode::parallel, [](std::uint32_t value)
+        {
+            return static_cast<std::uint64_t>(value) * 2;
+        }},
+        nes::pipeline_stage{nes::pipeline_mode::serial_in_order, [&ordered](std::uint64_t value)
+        {
+            ordered.emplace_back(value);
+            return value;
+        }},
+        nes::pipeline_stage{nes::pipeline_mode::serial_out_of_order, [&sum, &in_flight](std::uint64_t value)
+        {
+            sum += value;
+            --in_flight;
+        }}
+    };
+
+    pipeline.run(thread_pool, max_in_flight);
+
+    CHECK(std::size(ordered) == item_count, "Wrong item count, expected " << item_count << " got " << std::size(ordered));
+
+    for(std::uint32_t i{}; i < item_count; ++i)
+    {
+        CHECK(ordered[i] == i * 2u, "In-order stage received items out of order");
+    }
+
+    CHECK(sum == std::uint64_t{item_count} * (item_count - 1), "Wrong sum " << sum);
+    CHECK(max_seen <= max_in_flight, "Too many items in flight: " << max_seen);
+
+    std::uint32_t failing_next{};
+    nes::pipeline failing
+    {
+        [&failing_next]() -> std::optional<std::uint32_t>
+        {
+            return failing_next < item_count ? std::optional<std::uint32_t>{failing_next++} : std::nullopt;
+        },
+        nes::pipeline_stage{nes::pipeline_mode::parallel, [](std::uint32_t value)
+        {
+            if(value == 42)
+            {
+                throw std::runtime_error{"42"};
+            }
+
+            return value;
+        }},
+        nes::pipeline_stage{nes::pipeline_mode::serial_in_order, [](std::uint32_t)
+        {
+
+        }}
+    };
+
+    bool thrown{};
+    try
+    {
+        failing.run(thread_pool, max_in_flight);
+    }
+    catch(const std::runtime_error&)
+    {
+        thrown = true;
+    }
+
+    CHECK(thrown, "pipeline::run did not rethrow the stage exception");
+}
+
+static void channel_test()
+{
+    static constexpr std::uint64_t value_count{10000};
+    static constexpr std::size_t producer_count{4};
+
+    nes::channel<std::uint64_t> channel{16};
+    CHECK(channel.capacity() == 16, "Wrong channel capacity " << channel.capacity());
+
+    std::vector<std::thread> producers{};
+    for(std::size_t i{}; i < producer_count; ++i)
+    {
+        producers.emplace_back([&channel, i]()
+        {
+            if(i % 2 == 0)
+            {
+                for(std::uint64_t value{1}; value <= value_count; ++value)
+                {
+                    CHECK(channel.send(value), "Failed to send value");
+                }
+            }
+            else
+            {
+                std::vector<std::uint64_t> values(value_count);
+                std::iota(std::begin(values), std::end(values), std::uint64_t{1});
+
+                CHECK(channel.send_batch(std::begin(values), std::end(values)) == value_count, "Failed to send batch");
+            }
+        });
+    }
+
+    std::atomic<std::uint64_t> sum{};
+    std::thread consumer{[&channel, &sum]()
+    {
+        while(auto value{channel.recv()})
+        {
+            sum += *value;
+        }
+    }};
+
+    std::thread batch_consumer{[&channel, &sum]()
+    {
+        std::array<std::uint64_t, 8> batch{};
+        std::size_t count{};
+
+        while((count = channel.recv_batch(std::begin(batch), std::size(batch))) != 0)
+        {
+            sum += std::accumulate(std::begin(batch), std::begin(batch) + count, std::uint64_t{});
+        }
+    }};
+
+    for(auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    channel.close();
+
+    consumer.join();
+    batch_consumer.join();
+
+    CHECK(sum == producer_count * value_count * (value_count + 1) / 2, "Wrong channel sum " << sum);
+    CHECK(!channel.try_send(std::uint64_t{42}), "Closed channel must reject values");
+    CHECK(!channel.try_recv(), "Closed channel must be empty");
+
+    nes::thread_pool thread_pool{2};
+    nes::channel<std::uint32_t> async_channel{4};
+
+    std::promise<std::uint32_t> received{};
+    async_channel.async_recv(thread_pool, [&received](std::optional<std::uint32_t> value)
+    {
+        received.set_value(value.value_or(0));
+    });
+
+    CHECK(async_channel.try_send(42u), "Failed to send value");
+    CHECK(received.get_future().get() == 42, "Wrong value received by async_recv");
+
+    std::promise<bool> closed{};
+    async_channel.async_recv(thread_pool, [&closed](std::optional<std::uint32_t> value)
+    {
+        closed.set_value(!value.has_value());
+    });
+
+    async_channel.close();
+    CHECK(closed.get_future().get(), "async_recv must receive an empty value on close");
+
+    //A full caller-runs pool runs the handlers on the sender, which must not hold the channel's lock meanwhile
+    {
+        nes::thread_pool full_pool{1, nes::thread_pool_options::caller_runs, 1};
+        nes::channel<std::uint32_t> full_channel{4};
+
+        std::promise<void> gate{};
+        std::shared_future<void> gate_future{gate.get_future().share()};
+        std::atomic<bool> blocked{};
+
+        full_pool.execute([gate_future, &blocked]()
+        {
+            blocked = true;
+            gate_future.wait();
+        });
+
+        while(!blocked)
+        {
+            std::this_thread::yield();
+        }
+
+        full_pool.execute([](){});
+
+        std::uint32_t sum{};
+        std::function<void(std::optional<std::uint32_t>)> handler{};
+        handler = [&full_channel, &full_pool, &sum, &handler](std::optional<std::uint32_t> value)
+        {
+            if(value)
+            {
+                sum += *value;
+                full_channel.async_recv(full_pool, handler);
+            }
+        };
+
+        full_channel.async_recv(full_pool, handler);
+
+        CHECK(full_channel.send(1u) && full_channel.send(2u) && full_channel.send(3u), "Failed to send to a channel with async receivers");
+        CHECK(sum == 6, "Wrong sum received by async_recv handlers run inline " << sum);
+
+        full_channel.close();
+        gate.set_value();
+        full_pool.wait_idle();
+    }
+}
+
+static void task_list_weight_test()
+{
+    static constexpr std::uint32_t light_count{100};
+    static constexpr std::uint32_t heavy_count{300};
+
+    nes::thread_pool thread_pool{1};
+
+    std::vector<char> order{};
+
+    const auto make_list = [&order](std::uint32_t count, char tag)
+    {
+        nes::task_builder builder{1};
+        for(std::uint32_t i{}; i < count; ++i)
+        {
+            builder.execute([&order, tag]()
+            {
+                order.emplace_back(tag);
+            });
+        }
+
+        return builder.build();
+    };
+
+    std::promise<void> gate{};
+    thread_pool.execute([future = gate.get_future()]() mutable
+    {
+        future.wait();
+    });
+
+    auto light{thread_pool.push(make_list(light_count, 'l'), 1)};
+    auto heavy{thread_pool.push(make_list(heavy_count, 'h'), 3)};
+
+    gate.set_value();
+    light.wait();
+    heavy.wait();
+
+    CHECK(std::size(order) == light_count + heavy_count, "Wrong task count " << std::size(order));
+
+    //With weights 1:3 both lists must progress together and finish at about the same time.
+    const auto last_light{std::distance(std::begin(order), std::find(std::rbegin(order), std::rend(order), 'l').base())};
+    const auto last_heavy{std::distance(std::begin(order), std::find(std::rbegin(order), std::rend(order), 'h').base())};
+
+    CHECK(last_light > (light_count + heavy_count) * 9 / 10, "Light list finished too early at " << last_light);
+    CHECK(last_heavy > (light_count + heavy_count) * 9 / 10, "Heavy list finished too early at " << last_heavy);
+
+    //A weight of 0 still gets a share
+    order.clear();
+    auto zero{thread_pool.push(make_list(10, 'z'), 0)};
+    CHECK(zero.wait_for(std::chrono::seconds{5}) == std::future_status::ready, "A task list pushed with weight 0 never completed");
+    CHECK(std::size(order) == 10, "Wrong task count " << std::size(order));
+}
+
+static void lazy_thread_pool_test()
+{
+    nes::thread_pool thread_pool{64, nes::thread_pool_options::lazy};
+
+    CHECK(thread_pool.thread_count() == 64, "Wrong maximum thread count " << thread_pool.thread_count());
+    CHECK(thread_pool.started_thread_count() == 0, "Lazy pool started threads on construction");
+
+    auto future{thread_pool.invoke([]()
+    {
+        return 42;
+    })};
+
+    CHECK(future.get() == 42, "Wrong value returned by lazy pool");
+    CHECK(thread_pool.started_thread_count() >= 1, "Lazy pool did not start any thread");
+    CHECK(thread_pool.started_thread_count() < 64, "Lazy pool started too many threads for a single task");
+
+    nes::task_builder builder{};
+    std::atomic<std::uint32_t> counter{};
+    builder.dispatch(1000, 1, 1, [&counter](std::uint32_t, std::uint32_t, std::uint32_t)
+    {
+        ++counter;
+    });
+
+    thread_pool.push(builder.build()).wait();
+    CHECK(counter == 1000, "Wrong dispatch count on lazy pool " << counter);
+
+    //The tasks of a pushed list start as many workers as they need at once
+    {
+        using namespace std::chrono_literals;
+
+        nes::thread_pool lazy_pool{8, nes::thread_pool_options::lazy};
+
+        nes::task_builder sleep_builder{8};
+        sleep_builder.dispatch(8, 1, 1, [](std::uint32_t, std::uint32_t, std::uint32_t)
+        {
+            std::this_thread::sleep_for(100ms);
+        });
+
+        const auto begin{std::chrono::steady_clock::now()};
+        lazy_pool.push(sleep_builder.build()).wait();
+        const auto elapsed{std::chrono::steady_clock::now() - begin};
+
+        CHECK(lazy_pool.started_thread_count() == 8, "Lazy pool started " << lazy_pool.started_thread_count() << " threads for 8 queued tasks");
+        CHECK(elapsed < 400ms, "Lazy pool ran a task list serially, it took " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << "ms");
+    }
+}
+
+static std::uint64_t task_group_fibonacci(nes::thread_pool& thread_pool, std::uint32_t n)
+{
+    if(n < 2)
+    {
+        return n;
+    }
+
+    std::uint64_t left{};
+    std::uint64_t right{};
+
+    nes::task_group group{thread_pool};
+    group.run([&thread_pool, &left, n]()
+    {
+        left = task_group_fibonacci(thread_pool, n - 1);
+    });
+    group.run([&thread_pool, &right, n]()
+    {
+        right = task_group_fibonacci(thread_pool, n - 2);
+    });
+    group.wait();
+
+    return left + right;
+}
+
+static void task_group_test()
+{
+    for(std::size_t thread_count : {1, 4})
+    {
+        nes::thread_pool thread_pool{thread_count};
+
+        auto future{thread_pool.invoke([&thread_pool]()
+        {
+            return task_group_fibonacci(thread_pool, 20);
+        })};
+
+        const auto value{future.get()};
+        CHECK(value == 6765, "Wrong fibonacci value " << value << " with " << thread_count << " threads");
+    }
+
+    //Children spawned from a worker go to its own deque, sleeping workers must be woken up to steal them
+    {
+        using namespace std::chrono_literals;
+
+        nes::thread_pool spawn_pool{4};
+
+        auto elapsed{spawn_pool.invoke([&spawn_pool]()
+        {
+            const auto begin{std::chrono::steady_clock::now()};
+
+            nes::task_group group{spawn_pool};
+            for(std::uint32_t i{}; i < 4; ++i)
+            {
+                group.run([]()
+                {
+                    std::this_thread::sleep_for(50ms);
+                });
+            }
+
+            group.wait();
+
+            return std::chrono::steady_clock::now() - begin;
+        }).get()};
+
+        CHECK(elapsed < 150ms, "task_group children spawned from a worker were not stolen, they took " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << "ms");
+    }
+
+    nes::thread_pool thread_pool{2};
+    nes::task_group group{thread_pool};
+
+    for(std::uint32_t i{}; i < 100; ++i)
+    {
+        group.run([i]()
+        {
+            if(i == 42)
+            {
+                throw std::runtime_error{"42"};
+            }
+        });
+    }
+
+    bool thrown{};
+    try
+    {
+        group.wait();
+    }
+    catch(const std::runtime_error&)
+    {
+        thrown = true;
+    }
+
+    CHECK(thrown, "task_group::wait did not rethrow the child exception");
+
+    //Waiting from a thread that is not a worker must not run children there, they rely on the worker context
+    nes::worker_local<std::uint32_t> counts{thread_pool};
+    std::atomic<bool> outside{};
+
+    for(std::uint32_t i{}; i < 1000; ++i)
+    {
+        group.run([&counts, &outside]()
+        {
+            if(!nes::this_worker::is_worker())
+            {
+                outside = true;
+                return;
+            }
+
+            nes::this_worker::arena().allocate_span<std::uint32_t>(4)[0] = 1;
+            ++counts.local();
+        });
+    }
+
+    group.wait();
+    CHECK(!outside, "task_group::wait ran a child outside of the pool's workers");
+    CHECK(counts.combine(std::uint32_t{}, std::plus<>{}) == 1000, "task_group lost children");
+}
+
+template<std::size_t... Indices>
+static auto make_chain_graph(std::vector<std::uintptr_t>& depths, std::index_sequence<Indices...>)
+{
+    const auto node = [&depths]()
+    {
+        const char marker{};
+        depths.emplace_back(reinterpret_cast<std::uintptr_t>(&marker));
+    };
+
+    return nes::static_task_graph{nes::static_node{node}, nes::static_node{node, nes::depends_on<Indices>{}}...};
+}
+
+static void static_task_graph_test()
+{
+    nes::thread_pool thread_pool{4};
+
+    std::array<std::uint32_t, 5> values{};
+    std::atomic<std::uint32_t> order_errors{};
+
+    //0 -> 1 -> 3 -> 4
+    //0 -> 2 -> 3
+    nes::static_task_graph graph
+    {
+        nes::static_node{[&](){ values[0] = 1; }},
+        nes::static_node{[&](){ values[1] = values[0] + 1; }, nes::depends_on<0>{}},
+        nes::static_node{[&](){ values[2] = values[0] + 2; }, nes::depends_on<0>{}},
+        nes::static_node{[&](){ values[3] = values[1] * values[2]; }, nes::depends_on<1, 2>{}},
+        nes::static_node{[&]()
+        {
+            if(values[3] != 6)
+            {
+                ++order_errors;
+            }
+
+            values[4] = values[3] + 1;
+        }, nes::depends_on<3>{}},
+    };
+
+    static_assert(decltype(graph)::size() == 5);
+
+    for(std::uint32_t i{}; i < 100; ++i)
+    {
+        values = {};
+        graph.run(thread_pool);
+
+        CHECK(values[4] == 7, "Wrong static_task_graph result " << values[4]);
+    }
+
+    CHECK(order_errors == 0, "static_task_graph ran a node before its dependencies");
+
+    bool ran_after_failure{};
+    nes::static_task_graph failing_graph
+    {
+        nes::static_node{[](){ throw std::runtime_error{"static_task_graph"}; }},
+        nes::static_node{[&](){ ran_after_failure = true; }, nes::depends_on<0>{}},
+    };
+
+    bool thrown{};
+    try
+    {
+        failing_graph.run(thread_pool);
+    }
+    catch(const std::runtime_error&)
+    {
+        thrown = true;
+    }
+
+    CHECK(thrown, "static_task_graph::run did not rethrow the node exception");
+    CHECK(!ran_after_failure, "static_task_graph ran a node after a failure");
+
+    //Every node of a chain runs inline on the same thread, at the same stack depth
+    std::vector<std::uintptr_t> depths{};
+    auto chain{make_chain_graph(depths, std::make_index_sequence<63>{})};
+    chain.run(thread_pool);
+
+    CHECK(std::size(depths) == 64, "static_task_graph chain ran " << std::size(depths) << " nodes");
+
+    const auto [lowest, highest] = std::minmax_element(std::begin(depths) + 1, std::end(depths));
+    CHECK(*highest - *lowest < 1024, "static_task_graph chain grew the stack by " << *highest - *lowest << " bytes");
+}
+
+static void bounded_thread_pool_test()
+{
+    using namespace std::chrono_literals;
+
+    {
+        nes::thread_pool thread_pool{1, nes::thread_pool_options{}, 2};
+        CHECK(thread_pool.capacity() == 2, "Wrong thread_pool capacity");
+
+        std::promise<void> started{};
+        std::promise<void> gate{};
+        std::shared_future<void> gate_future{gate.get_future()};
+
+        thread_pool.execute([&started, gate_future]()
+        {
+            started.set_value();
+            gate_future.wait();
+        });
+        started.get_future().wait();
+
+        std::atomic<std::uint32_t> counter{};
+        const auto increment = [&counter]()
+        {
+            ++counter;
+        };
+
+        CHECK(thread_pool.try_execute(increment), "try_execute failed on a non-full thread_pool");
+        CHECK(thread_pool.try_execute(increment), "try_execute failed on a non-full thread_pool");
+        CHECK(!thread_pool.try_execute(increment), "try_execute succeeded on a full thread_pool");
+        CHECK(!thread_pool.try_execute_for(10ms, increment), "try_execute_for succeeded on a full thread_pool");
+
+        std::thread producer{[&]()
+        {
+            thread_pool.execute(increment);
+        }};
+
+        gate.set_value();
+        producer.join();
+
+        thread_pool.wait_idle();
+        CHECK(counter == 3, "Wrong bounded thread_pool task count " << counter);
+    }
+
+    {
+        nes::thread_pool thread_pool{1, nes::thread_pool_options::caller_runs, 1};
+
+        std::promise<void> started{};
+        std::promise<void> gate{};
+        std::shared_future<void> gate_future{gate.get_future()};
+
+        thread_pool.execute([&started, gate_future]()
+        {
+            started.set_value();
+            gate_future.wait();
+        });
+        started.get_future().wait();
+
+        thread_pool.execute([](){});
+
+        std::thread::id runner{};
+        auto future{thread_pool.invoke([&runner]()
+        {
+            runner = std::this_thread::get_id();
+        })};
+
+        future.get();
+        CHECK(runner == std::this_thread::get_id(), "caller_runs thread_pool did not run the overflowing task on the caller");
+
+        gate.set_value();
+        thread_pool.wait_idle();
+    }
+}
+
+static void affinity_test()
+{
+    nes::thread_pool thread_pool{4};
+
+    std::uint32_t preferred_count{};
+    for(std::uint32_t i{}; i < 32; ++i)
+    {
+        const nes::affinity_key key{i};
+
+        auto future{thread_pool.invoke(key, []()
+        {
+            return nes::this_worker::index();
+        })};
+
+        if(future.get() == key.value() % thread_pool.thread_count())
+        {
+            ++preferred_count;
+        }
+    }
+
+    CHECK(preferred_count >= 16, "Only " << preferred_count << " affine tasks ran on their preferred worker");
+
+    std::atomic<std::uint32_t> counter{};
+    for(std::uint32_t i{}; i < 1000; ++i)
+    {
+        thread_pool.execute(nes::affinity_key{std::string{"shard"} + std::to_string(i % 3)}, [&counter](std::uint32_t value)
+        {
+            counter += value;
+        }, 1u);
+    }
+
+    thread_pool.wait_idle();
+    CHECK(counter == 1000, "Wrong affine task count " << counter);
+}
+
+static void strand_test()
+{
+    nes::thread_pool thread_pool{4};
+
+    std::vector<std::unique_ptr<nes::strand>> strands{};
+    std::vector<std::vector<std::uint32_t>> outputs(1000);
+    std::atomic<std::uint32_t> concurrent_runs{};
+
+    for(std::size_t i{}; i < std::size(outputs); ++i)
+    {
+        strands.emplace_back(std::make_unique<nes::strand>(thread_pool));
+    }
+
+    std::vector<std::thread> producers{};
+    for(std::uint32_t producer{}; producer < 2; ++producer)
+    {
+        producers.emplace_back([&, producer]()
+        {
+            for(std::uint32_t value{}; value < 100; ++value)
+            {
+                for(std::size_t i{}; i < std::size(strands); ++i)
+                {
+                    strands[i]->execute([&, i, producer, value, strand = strands[i].get()]()
+                    {
+                        if(!strand->running_in_this_thread())
+                        {
+                            ++concurrent_runs;
+                        }
+
+                        //Plain push_back: any concurrent run on the same strand would be a data race
+                        outputs[i].push_back(producer * 1000 + value);
+                    });
+                }
+            }
+        });
+    }
+
+    for(auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    auto future{strands[0]->invoke([&outputs]()
+    {
+        return std::size(outputs[0]);
+    })};
+
+    CHECK(future.get() == 200, "strand::invoke did not run after the previously posted tasks");
+
+    strands.clear();
+
+    CHECK(concurrent_runs == 0, "strand task ran outside of its strand");
+
+    for(const auto& output : outputs)
+    {
+        CHECK(std::size(output) == 200, "Wrong strand task count " << std::size(output));
+
+        std::uint32_t expected[2]{0, 1000};
+        for(const auto value : output)
+        {
+            CHECK(value == expected[value / 1000]++, "strand tasks ran out of order");
+        }
+    }
+
+    {
+        nes::strand strand{thread_pool};
+
+        auto failed{strand.invoke([]() -> int
+        {
+            throw std::runtime_error{"strand"};
+        })};
+
+        bool thrown{};
+        try
+        {
+            failed.get();
+        }
+        catch(const std::runtime_error&)
+        {
+            thrown = true;
+        }
+
+        CHECK(thrown, "strand::invoke did not carry the exception of its task");
+        CHECK(strand.invoke([](){ return 42; }).get() == 42, "strand stopped after a task threw");
+    }
+
+    //With caller_runs and a full queue, the strand drains on the posting thread and a throwing task reaches the caller
+    {
+        nes::thread_pool full_pool{1, nes::thread_pool_options::caller_runs, 1};
+
+        std::promise<void> started{};
+        std::promise<void> gate{};
+        full_pool.execute([&started, future = gate.get_future()]() mutable
+        {
+            started.set_value();
+            future.wait();
+        });
+
+        started.get_future().wait();
+        full_pool.execute([](){});
+
+        nes::strand strand{full_pool};
+
+        bool thrown{};
+        try
+        {
+            strand.execute([]()
+            {
+                throw std::runtime_error{"strand"};
+            });
+        }
+        catch(const std::runtime_error&)
+        {
+            thrown = true;
+        }
+
+        bool ran{};
+        strand.execute([&ran]()
+        {
+            ran = true;
+        });
+
+        gate.set_value();
+
+        CHECK(thrown, "strand task exception did not reach the caller running it");
+        CHECK(ran, "strand got stuck after a task threw");
+    }
+
+    //When the requeued strand would run inline, the draining thread keeps going instead of recursing into drain
+    {
+        nes::thread_pool full_pool{1, nes::thread_pool_options::caller_runs, 1};
+
+        std::promise<void> started{};
+        std::promise<void> gate{};
+        full_pool.execute([&started, future = gate.get_future()]() mutable
+        {
+            started.set_value();
+            future.wait();
+        });
+
+        started.get_future().wait();
+        full_pool.execute([](){});
+
+        nes::strand strand{full_pool};
+
+        const char* first_frame{};
+        std::ptrdiff_t max_spread{};
+        std::size_t count{};
+
+        strand.execute([&]()
+        {
+            const char marker{};
+            first_frame = &marker;
+
+            for(std::size_t i{}; i < 100 * nes::strand::batch_size; ++i)
+            {
+                strand.execute([&]()
+                {
+                    const char marker{};
+                    max_spread = std::max(max_spread, std::abs(&marker - first_frame));
+                    ++count;
+                });
+            }
+        });
+
+        gate.set_value();
+
+        CHECK(count == 100 * nes::strand::batch_size, "Wrong strand task count " << count);
+        CHECK(max_spread < 1024, "strand requeue recursed on the draining thread, stack grew by " << max_spread);
+    }
+}
+
+static void cached_task_list_test()
+{
+    nes::thread_pool thread_pool{2};
+
+    nes::task_input input_a{};
+    nes::task_input input_b{};
+    std::uint32_t value_a{1};
+    std::uint32_t value_b{10};
+
+    std::atomic<std::uint32_t> runs_a{};
+    std::atomic<std::uint32_t> runs_b{};
+    std::atomic<std::uint32_t> runs_sum{};
+
+    nes::task_builder builder{2};
+
+    auto result_a{builder.invoke(nes::task_inputs{input_a}, [&]()
+    {
+        ++runs_a;
+        return value_a * 2;
+    })};
+
+    auto result_b{builder.invoke(nes::task_inputs{input_b}, [&]()
+    {
+        ++runs_b;
+        return value_b * 2;
+    })};
+
+    builder.barrier();
+
+    auto sum{builder.invoke(nes::task_inputs{result_a.input(), result_b.input()}, [&]()
+    {
+        ++runs_sum;
+        return result_a.get() + result_b.get();
+    })};
+
+    auto list{thread_pool.push(builder.build()).get()};
+    CHECK(sum.get() == 22, "Wrong cached task result");
+    CHECK(runs_a == 1 && runs_b == 1 && runs_sum == 1, "Cached tasks did not run on first push");
+
+    list = thread_pool.push(std::move(list)).get();
+    CHECK(sum.get() == 22, "Wrong clean cached task result");
+    CHECK(runs_a == 1 && runs_b == 1 && runs_sum == 1, "Clean cached tasks ran again");
+
+    value_b = 20;
+    input_b.invalidate();
+
+    list = thread_pool.push(std::move(list)).get();
+    CHECK(sum.get() == 42, "Wrong dirty cached task result");
+    CHECK(runs_a == 1 && runs_b == 2 && runs_sum == 2, "Only dirty cached tasks and their successors must run again");
+}
+
+static void memoize_test()
+{
+    nes::thread_pool thread_pool{2};
+
+    std::atomic<std::uint32_t> calls{};
+    nes::memo_cache<std::uint64_t, std::uint32_t, std::string> cache{2, [&calls](std::uint32_t value, const std::string& text)
+    {
+        ++calls;
+        return static_cast<std::uint64_t>(value) * std::size(text);
+    }};
+
+    std::promise<void> gate{};
+    std::shared_future<void> gate_future{gate.get_future()};
+    for(std::uint32_t i{}; i < 2; ++i)
+    {
+        thread_pool.execute([gate_future]()
+        {
+            gate_future.wait();
+        });
+    }
+
+    //Both calls are queued behind the gate, the second one must be coalesced into the first one
+    auto first{nes::invoke_memoized(thread_pool, cache, 3u, std::string{"abcd"})};
+    auto second{nes::invoke_memoized(thread_pool, cache, 3u, std::string{"abcd"})};
+    gate.set_value();
+
+    CHECK(first.get() == 12 && second.get() == 12, "Wrong memoized result");
+
+    auto third{nes::invoke_memoized(thread_pool, cache, 3u, std::string{"abcd"})};
+    CHECK(third.get() == 12, "Wrong cached memoized result");
+    CHECK(calls == 1, "Memoized function called " << calls << " times");
+
+    auto statistics{cache.statistics()};
+    CHECK(statistics.misses == 1 && statistics.coalesced == 1 && statistics.hits == 1, "Wrong memo_cache statistics");
+
+    nes::invoke_memoized(thread_pool, cache, 1u, std::string{"a"}).wait();
+    nes::invoke_memoized(thread_pool, cache, 2u, std::string{"a"}).wait();
+    thread_pool.wait_idle();
+    CHECK(cache.size() == 2, "memo_cache holds " << cache.size() << " results");
+
+    //{3, "abcd"} was the least recently used result, it must have been evicted
+    nes::invoke_memoized(thread_pool, cache, 3u, std::string{"abcd"}).wait();
+    CHECK(calls == 4, "Evicted memoized result was not recomputed");
+
+    bool thrown{};
+    nes::memo_cache<std::uint32_t, std::uint32_t> failing_cache{4, [](std::uint32_t value) -> std::uint32_t
+    {
+        throw std::runtime_error{std::to_string(value)};
+    }};
+
+    try
+    {
+        nes::invoke_memoized(thread_pool, failing_cache, 1u).get();
+    }
+    catch(const std::runtime_error&)
+    {
+        thrown = true;
+    }
+
+    thread_pool.wait_idle();
+    CHECK(thrown, "invoke_memoized did not forward the exception");
+    CHECK(failing_cache.size() == 0, "memo_cache kept a failed result");
+}
+
+static void thread_pool_telemetry_test()
+{
+    {
+        nes::thread_pool thread_pool{2};
+        nes::thread_pool_telemetry_publisher publisher{thread_pool, "nes_test_thread_pool_telemetry"};
+
+        for(std::uint32_t i{}; i < 100; ++i)
+        {
+            thread_pool.execute([](){});
+        }
+
+        thread_pool.wait_idle();
+
+        nes::shared_memory memory{"nes_test_thread_pool_telemetry", nes::shared_memory_options::constant};
+        auto telemetry{memory.map<nes::thread_pool_telemetry>(0, nes::shared_memory_options::constant)};
+
+        CHECK(telemetry->magic == nes::thread_pool_telemetry::magic_value, "Wrong thread_pool_telemetry magic");
+        CHECK(telemetry->version == nes::thread_pool_telemetry::current_version, "Wrong thread_pool_telemetry version");
+        CHECK(telemetry->running == 1 && telemetry->thread_count == 2, "Wrong thread_pool_telemetry state");
+        CHECK(telemetry->tasks_queued == 100 && telemetry->tasks_completed == 100, "Wrong thread_pool_telemetry task count " << telemetry->tasks_completed);
+        CHECK(telemetry->queue_depth == 0 && telemetry->active_workers == 0, "Idle thread_pool telemetry shows pending work");
+
+        std::uint64_t bucket_sum{};
+        for(auto bucket : telemetry->latency_buckets)
+        {
+            bucket_sum += bucket;
+        }
+
+        CHECK(bucket_sum == 100, "Wrong thread_pool_telemetry latency bucket sum " << bucket_sum);
+    }
+
+    nes::shared_memory memory{"nes_test_thread_pool_telemetry", nes::shared_memory_options::constant};
+    auto telemetry{memory.map<nes::thread_pool_telemetry>(0, nes::shared_memory_options::constant)};
+    CHECK(telemetry->running == 0, "Destroyed thread_pool still marked as running");
+}
+
+static void dispatch_reduce_test()
+{
+    nes::thread_pool thread_pool{4};
+
+    for(std::uint32_t thread_count : {1u, 3u, 4u, 64u})
+    {
+        nes::task_builder builder{thread_count};
+
+        auto sum{builder.dispatch_reduce(100, 10, 3, std::uint64_t{}, [](std::uint32_t x, std::uint32_t y, std::uint32_t z)
+        {
+            return static_cast<std::uint64_t>(x) + y * 100 + z * 1000;
+        }, std::plus<>{})};
+
+        //Concatenation is associative but not commutative: chunks must be combined in grid order
+        auto text{builder.dispatch_reduce(37, 1, 1, std::string{}, [](std::uint32_t x, std::uint32_t, std::uint32_t)
+        {
+            return std::string(1, static_cast<char>('A' + x));
+        }, [](std::string left, const std::string& right)
+        {
+            return left + right;
+        })};
+
+        builder.barrier();
+
+        auto doubled{builder.invoke([&sum]()
+        {
+            return sum.get() * 2;
+        })};
+
+        auto list{thread_pool.push(builder.build()).get()};
+
+        std::string expected_text{};
+        for(std::uint32_t x{}; x < 37; ++x)
+        {
+            expected_text += static_cast<char>('A' + x);
+        }
+
+        //sum of x over [0, 100) * 30 + sum of y * 100 over [0, 10) * 300 + sum of z * 1000 over [0, 3) * 1000
+        const std::uint64_t expected_sum{4950 * 30 + 4500 * 300 + 3000 * 1000};
+
+        CHECK(doubled.get() == expected_sum * 2, "Wrong dispatch_reduce sum with " << thread_count << " chunks");
+        CHECK(text.get() == expected_text, "Wrong dispatch_reduce order with " << thread_count << " chunks");
+
+        list = thread_pool.push(std::move(list)).get();
+        CHECK(doubled.get() == expected_sum * 2, "Wrong dispatch_reduce sum after a second push");
+    }
+}
+
+static void invoke_batch_test()
+{
+    nes::thread_pool thread_pool{4};
+
+    std::vector<std::uint64_t> pool_output(10000);
+    auto future{thread_pool.invoke_batch(std::span{pool_output}, [](std::size_t i)
+    {
+        return static_cast<std::uint64_t>(i) * i;
+    })};
+
+    future.get();
+
+    for(std::size_t i{}; i < std::size(pool_output); ++i)
+    {
+        CHECK(pool_output[i] == i * i, "Wrong thread_pool::invoke_batch output at " << i);
+    }
+
+    for(std::uint32_t thread_count : {1u, 4u, 16u})
+    {
+        std::vector<std::uint32_t> output(7, 0);
+        std::uint32_t offset{1};
+
+        nes::task_builder builder{thread_count};
+        auto checkpoint{builder.invoke_batch(std::span{output}, [&offset](std::size_t i)
+        {
+            return static_cast<std::uint32_t>(i) + offset;
+        })};
+
+        auto list{thread_pool.push(builder.build()).get()};
+        checkpoint.wait();
+        CHECK(output == (std::vector<std::uint32_t>{1, 2, 3, 4, 5, 6, 7}), "Wrong task_builder::invoke_batch output");
+
+        offset = 10;
+        list = thread_pool.push(std::move(list)).get();
+        checkpoint.wait();
+        CHECK(output == (std::vector<std::uint32_t>{10, 11, 12, 13, 14, 15, 16}), "Wrong task_builder::invoke_batch output after a second push");
+    }
+}
+
+static void pause_quota_test()
+{
+    using namespace std::chrono_literals;
+
+    nes::thread_pool thread_pool{4};
+
+    thread_pool.pause();
+    CHECK(thread_pool.paused(), "thread_pool not paused");
+
+    std::atomic<std::uint32_t> counter{};
+    for(std::uint32_t i{}; i < 10; ++i)
+    {
+        thread_pool.execute([&counter]()
+        {
+            ++counter;
+        });
+    }
+
+    std::this_thread::sleep_for(50ms);
+    CHECK(counter == 0, "Paused thread_pool ran " << counter << " tasks");
+
+    thread_pool.resume();
+    thread_pool.wait_idle();
+    CHECK(counter == 10, "Resumed thread_pool ran " << counter << " tasks");
+
+    thread_pool.set_max_active_workers(2);
+    CHECK(thread_pool.max_active_workers() == 2, "Wrong thread_pool quota");
+
+    std::atomic<std::uint32_t> active{};
+    std::atomic<std::uint32_t> max_active{};
+    for(std::uint32_t i{}; i < 32; ++i)
+    {
+        thread_pool.execute([&active, &max_active]()
+        {
+            const auto current{++active};
+
+            auto previous{max_active.load()};
+            while(previous < current && !max_active.compare_exchange_weak(previous, current))
+            {
+
+            }
+
+            std::this_thread::sleep_for(1ms);
+            --active;
+        });
+    }
+
+    thread_pool.wait_idle();
+    CHECK(max_active <= 2, "thread_pool ran " << max_active << " tasks at once with a quota of 2");
+
+    thread_pool.set_max_active_workers(100);
+    CHECK(thread_pool.max_active_workers() == 4, "thread_pool quota not clamped to its thread count");
+
+    //A worker held back by the quota must be woken up once the running task completes, even if only it can take the next task
+    {
+        nes::thread_pool quota_pool{2};
+        quota_pool.set_max_active_workers(1);
+
+        std::uint32_t first_key{};
+        while(nes::affinity_key{first_key}.value() % 2 != 0)
+        {
+            ++first_key;
+        }
+
+        std::uint32_t second_key{};
+        while(nes::affinity_key{second_key}.value() % 2 != 1)
+        {
+            ++second_key;
+        }
+
+        std::atomic<bool> started{};
+        quota_pool.execute(nes::affinity_key{first_key}, [&started]()
+        {
+            started = true;
+            std::this_thread::sleep_for(50ms);
+        });
+
+        while(!started)
+        {
+            std::this_thread::yield();
+        }
+
+        auto future{quota_pool.invoke(nes::affinity_key{second_key}, []()
+        {
+            return nes::this_worker::index();
+        })};
+
+        CHECK(future.wait_for(5s) == std::future_status::ready, "Affine task held back by the thread_pool quota never ran");
+    }
+
+    //Destroying a paused pool must still run its queued tasks
+    {
+        nes::thread_pool paused_pool{2};
+        paused_pool.pause();
+
+        for(std::uint32_t i{}; i < 10; ++i)
+        {
+            paused_pool.execute([&counter]()
+            {
+                ++counter;
+            });
+        }
+    }
+
+    CHECK(counter == 20, "Destroyed paused thread_pool dropped tasks");
+}
+
+static void worker_attributes_test()
+{
+    std::atomic<std::uint32_t> started{};
+    std::atomic<std::uint32_t> exited{};
+
+    nes::worker_attributes attributes{};
+    attributes.name_prefix = "nes-test-";
+    attributes.stack_size = 256 * 1024;
+    attributes.on_start = [&started](std::size_t)
+    {
+        ++started;
+    };
+    attributes.on_exit = [&exited](std::size_t)
+    {
+        ++exited;
+    };
+
+    {
+        nes::thread_pool thread_pool{3, nes::thread_pool_options{}, nes::thread_pool::unbounded, std::move(attributes)};
+
+        auto future{thread_pool.invoke([]()
+        {
+            std::array<char, 16> name{};
+#if defined(__linux__)
+            pthread_getname_np(pthread_self(), std::data(name), std::size(name));
+#endif
+            return std::string{std::data(name)};
+        })};
+
+        const auto name{future.get()};
+#if defined(__linux__)
+        CHECK(name.rfind("nes-test-", 0) == 0, "Wrong worker name " << name);
+        CHECK(std::size(name) == 10 && name[9] >= '0' && name[9] <= '2', "Wrong worker index in name " << name);
+#endif
+    }
+
+    CHECK(started == 3, "on_start called " << started << " times");
+    CHECK(exited == 3, "on_exit called " << exited << " times");
+
+    nes::worker_attributes throwing_attributes{};
+    throwing_attributes.on_start = [](std::size_t)
+    {
+        throw std::runtime_error{"on_start"};
+    };
+    throwing_attributes.on_exit = [](std::size_t)
+    {
+        throw std::runtime_error{"on_exit"};
+    };
+
+    {
+        nes::thread_pool thread_pool{2, nes::thread_pool_options{}, nes::thread_pool::unbounded, std::move(throwing_attributes)};
+
+        auto future{thread_pool.invoke([]()
+        {
+            return 42;
+        })};
+
+        CHECK(future.get() == 42, "thread_pool with a throwing on_start hook did not run its task");
+    }
+}
+
+static void exception_task_list_test()
+{
+    nes::thread_pool thread_pool{2};
+
+    auto failing{thread_pool.invoke([]() -> int
+    {
+        throw std::runtime_error{"invoke"};
+    })};
+
+    bool caught{};
+    try
+    {
+        failing.get();
+    }
+    catch(const std::runtime_error&)
+    {
+        caught = true;
+    }
+
+    CHECK(caught, "thread_pool::invoke did not carry the exception");
+
+    for(bool fail_fast : {false, true})
+    {
+        std::atomic<std::uint32_t> runs{};
+
+        nes::task_builder builder{2};
+        auto first{builder.invoke([]() -> int
+        {
+            throw std::runtime_error{"first"};
+        })};
+        auto second{builder.invoke([&runs]()
+        {
+            ++runs;
+            return 42;
+        })};
+        builder.barrier();
+        auto after{builder.invoke([&runs]()
+        {
+            ++runs;
+            return 12;
+        })};
+        builder.set_fail_fast(fail_fast);
+
+        auto list_future{thread_pool.push(builder.build())};
+
+        nes::task_list list{};
+        std::string message{};
+        try
+        {
+            list_future.get();
+        }
+        catch(const nes::task_list_error& e)
+        {
+            list = std::move(e.list());
+
+            try
+            {
+                e.rethrow();
+            }
+            catch(const std::runtime_error& error)
+            {
+                message = error.what();
+            }
+        }
+
+        CHECK(message == "first", "task_list did not carry its first exception");
+
+        caught = false;
+        try
+        {
+            first.get();
+        }
+        catch(const std::runtime_error&)
+        {
+            caught = true;
+        }
+
+        CHECK(caught, "task_result did not carry the exception of its task");
+
+        if(fail_fast)
+        {
+            //The barrier makes sure the last task is not started before the first one failed
+            caught = false;
+            try
+            {
+                after.get();
+            }
+            catch(const std::runtime_error& e)
+            {
+                caught = std::string{e.what()} == "first";
+            }
+
+            CHECK(caught, "Skipped task_result did not carry the list exception");
+            CHECK(runs.load() <= 1, "Fail fast task_list ran a task after the barrier");
+        }
+        else
+        {
+            CHECK(second.get() == 42 && after.get() == 12, "task_list stopped after an exception without fail fast");
+            CHECK(runs.load() == 2, "task_list did not run every task");
+        }
+    }
+
+    std::vector<std::uint32_t> output(16);
+    nes::task_builder builder{4};
+    auto checkpoint{builder.invoke_batch(std::span{output}, [](std::size_t i) -> std::uint32_t
+    {
+        if(i == 3)
+        {
+            throw std::runtime_error{"batch"};
+        }
+
+        return static_cast<std::uint32_t>(i);
+    })};
+    auto reduced{builder.dispatch_reduce(8, 1, 1, 0u, [](std::uint32_t x, std::uint32_t, std::uint32_t) -> std::uint32_t
+    {
+        if(x == 5)
+        {
+            throw std::runtime_error{"reduce"};
+        }
+
+        return x;
+    }, std::plus<>{})};
+
+    auto list_future{thread_pool.push(builder.build())};
+
+    nes::task_list list{};
+    try
+    {
+        list_future.get();
+    }
+    catch(const nes::task_list_error& e)
+    {
+        list = std::move(e.list());
+    }
+
+    checkpoint.wait();
+
+    caught = false;
+    try
+    {
+        reduced.get();
+    }
+    catch(const std::runtime_error& e)
+    {
+        caught = std::string{e.what()} == "reduce";
+    }
+
+    CHECK(caught, "dispatch_reduce did not carry the exception");
+
+    caught = false;
+    try
+    {
+        checkpoint.get();
+    }
+    catch(const std::runtime_error& e)
+    {
+        caught = std::string{e.what()} == "batch";
+    }
+
+    CHECK(caught, "invoke_batch did not carry the exception");
+}
+
+static void shared_work_queue_test()
+{
+    using namespace std::chrono_literals;
+
+    {
+        nes::shared_work_queue<std::uint64_t> queue{"nes_test_work_queue_lease", 4, 20ms};
+        CHECK(queue.try_push(42), "Failed to push in an empty shared_work_queue");
+
+        const auto first{queue.try_pop()};
+        CHECK(first && first->value() == 42, "Wrong shared_work_queue descriptor");
+        CHECK(!queue.try_pop(), "Leased descriptor was given twice");
+
+        std::this_thread::sleep_for(40ms);
+
+        const auto second{queue.pop_for(1s)};
+        CHECK(second && second->value() == 42, "Expired lease was not given back to the queue");
+        CHECK(!queue.complete(*first), "Expired lease was completed");
+        CHECK(queue.complete(*second), "Failed to complete a lease");
+        CHECK(!queue.try_pop(), "Completed descriptor was given again");
+    }
+
+    //A queue created with the name of a previous one does not inherit the announcements of its descriptors
+    {
+        {
+            nes::shared_work_queue<std::uint64_t> stale{"nes_test_work_queue_stale", 4, 200ms};
+            stale.push(1);
+            stale.push(2);
+        }
+
+        nes::shared_work_queue<std::uint64_t> fresh{"nes_test_work_queue_stale", 4, 200ms};
+        nes::timed_named_semaphore ready{"nes_test_work_queue_stale_ready"};
+        CHECK(!ready.try_acquire(), "Recreated shared_work_queue kept the count of the previous one");
+    }
+
+    nes::shared_work_queue<std::uint64_t> queue{"nes_test_work_queue", 16, 200ms};
+
+    for(std::uint64_t i{1}; i <= 8; ++i)
+    {
+        queue.push(i);
+    }
+
+    nes::process crash{other_path, std::vector<std::string>{"work queue crash"}, nes::process_options::grab_stdout};
+    crash.join();
+    CHECK(crash.return_code() == 0, "Other process failed with code " << crash.return_code() << ":\n" << crash.stdout_stream().rdbuf());
+
+    nes::process other{other_path, std::vector<std::string>{"work queue"}, nes::process_options::grab_stdout};
+    other.join();
+    CHECK(other.return_code() == 0, "Other process failed with code " << other.return_code() << ":\n" << other.stdout_stream().rdbuf());
+
+    std::uint64_t other_sum{};
+    other.stdout_stream() >> other_sum;
+
+    nes::thread_pool pool{2};
+    std::atomic<std::uint64_t> sum{};
+    std::uint64_t completed{};
+
+    {
+        nes::shared_work_consumer consumer{pool, queue, [&sum](std::uint64_t value)
+        {
+            sum += value;
+        }};
+
+        const auto limit{std::chrono::steady_clock::now() + 10s};
+        while(consumer.completed_count() < 5 && std::chrono::steady_clock::now() < limit)
+        {
+            std::this_thread::sleep_for(1ms);
+        }
+
+        completed = consumer.completed_count();
+    }
+
+    CHECK(completed == 5, "shared_work_queue lost descriptors, " << completed << " completed");
+    CHECK(other_sum + sum.load() == 36, "Wrong shared_work_queue sum " << other_sum << " + " << sum.load());
+}
+
+static void par_on_test()
+{
+    nes::thread_pool thread_pool{4};
+    const auto policy{nes::par_on(thread_pool, 16)};
+
+    std::vector<std::uint32_t> values(10000);
+    std::iota(std::begin(values), std::end(values), 0u);
+
+    nes::for_each(policy, values, [](std::uint32_t& value)
+    {
+        value *= 2;
+    });
+
+    CHECK(values[9999] == 19998 && values[1] == 2, "nes::for_each produced a wrong result");
+
+    std::vector<std::uint64_t> squares(std::size(values));
+    const auto transform_end{nes::transform(policy, values, std::begin(squares), [](std::uint32_t value)
+    {
+        return static_cast<std::uint64_t>(value) * value;
+    })};
+
+    CHECK(transform_end == std::end(squares) && squares[5000] == 100000000, "nes::transform produced a wrong result");
+
+    const auto is_multiple_of_3 = [](std::uint32_t value)
+    {
+        return value % 3 == 0;
+    };
+
+    CHECK(nes::count_if(policy, values, is_multiple_of_3) == std::count_if(std::begin(values), std::end(values), is_multiple_of_3), "nes::count_if produced a wrong result");
+
+    std::vector<std::uint32_t> copied(std::size(values));
+    std::vector<std::uint32_t> expected{};
+    std::copy_if(std::begin(values), std::end(values), std::back_inserter(expected), is_multiple_of_3);
+
+    const auto copy_end{nes::copy_if(policy, values, std::begin(copied), is_multiple_of_3)};
+    copied.erase(copy_end, std::end(copied));
+    CHECK(copied == expected, "nes::copy_if produced a wrong result");
+
+    const auto found{nes::find_if(policy, values, [](std::uint32_t value)
+    {
+        return value == 200 || value == 19000;
+    })};
+
+    CHECK(found == std::begin(values) + 100, "nes::find_if did not return the first match");
+    CHECK(nes::find_if(policy, values, [](std::uint32_t value){ return value == 1; }) == std::end(values), "nes::find_if found a missing value");
+
+    const std::vector<std::uint32_t> empty{};
+    CHECK(nes::find_if(policy, empty, [](std::uint32_t){ return true; }) == std::end(empty), "nes::find_if found a value in an empty range");
+
+    bool caught{};
+    try
+    {
+        nes::for_each(policy, values, [](std::uint32_t value)
+        {
+            if(value == 4242)
+            {
+                throw std::runtime_error{"for_each"};
+            }
+        });
+    }
+    catch(const std::runtime_error&)
+    {
+        caught = true;
+    }
+
+    CHECK(caught, "nes::for_each did not rethrow the exception of an element");
+}
+
+int main()
+{
+    try
+    {
+        shared_library_test();
+        pipe_test();
+        pipe_buffer_test();
+        splice_test();
+#if defined(NES_POSIX_POLLER)
+        poller_test();
+#endif
         semaphore_test();
         process_test();
         process_kill_test();
@@ -314,6 +2419,28 @@ int main()
         timed_named_mutex_test();
         named_semaphore_test();
         thread_pool_test();
+        worker_local_test();
+        parallel_sort_test();
+        execution_test();
+        pipeline_test();
+        channel_test();
+        task_list_weight_test();
+        lazy_thread_pool_test();
+        task_group_test();
+        static_task_graph_test();
+        bounded_thread_pool_test();
+        affinity_test();
+        strand_test();
+        cached_task_list_test();
+        memoize_test();
+        thread_pool_telemetry_test();
+        dispatch_reduce_test();
+        invoke_batch_test();
+        pause_quota_test();
+        worker_attributes_test();
+        exception_task_list_test();
+        shared_work_queue_test();
+        par_on_test();
 
         std::cout << "All tests passed!" << std::endl;
     }
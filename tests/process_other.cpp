@@ -6,6 +6,7 @@
 #include <nes/shared_memory.hpp>
 #include <nes/named_mutex.hpp>
 #include <nes/named_semaphore.hpp>
+#include <nes/shared_work_queue.hpp>
 
 #include "common.hpp"
 
@@ -96,6 +97,42 @@ static void named_semaphore()
     }
 }
 
+static void work_queue_crash()
+{
+    nes::shared_work_queue<std::uint64_t> queue{"nes_test_work_queue"};
+
+    const auto lease{queue.try_pop()};
+    CHECK(lease, "Failed to lease a descriptor");
+    //exits without completing the lease, as if the process crashed
+}
+
+static void work_queue()
+{
+    nes::shared_work_queue<std::uint64_t> queue{"nes_test_work_queue"};
+    std::uint64_t sum{};
+
+    for(std::size_t i{}; i < 3; ++i)
+    {
+        const auto lease{queue.pop_for(std::chrono::seconds{1})};
+        CHECK(lease, "Failed to lease a descriptor");
+
+        sum += lease->value();
+        CHECK(queue.complete(*lease), "Failed to complete a lease");
+    }
+
+    std::cout << sum << std::endl;
+}
+
+static void poller_output()
+{
+    for(std::size_t i{}; i < 1000; ++i)
+    {
+        std::cout << "Line " << i << '\n';
+    }
+
+    std::cout << std::flush;
+}
+
 int main(int argc, char** argv)
 {
     for(int i{}; i < argc; ++i)
@@ -132,6 +169,18 @@ int main(int argc, char** argv)
             {
                 named_semaphore();
             }
+            else if(argv[i] == "work queue crash"sv)
+            {
+                work_queue_crash();
+            }
+            else if(argv[i] == "work queue"sv)
+            {
+                work_queue();
+            }
+            else if(argv[i] == "poller output"sv)
+            {
+                poller_output();
+            }
         }
         catch(const std::exception& e)
         {
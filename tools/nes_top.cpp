@@ -0,0 +1,124 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <array>
+#include <cstdint>
+
+#include <nes/shared_memory.hpp>
+#include <nes/thread_pool_telemetry.hpp>
+
+//Reads the counters a thread_pool_telemetry_publisher publishes for a thread_pool.
+//Usage: nes-top <segment name> [--once] [--interval <milliseconds>]
+
+static std::uint64_t load(std::uint64_t& field) noexcept
+{
+    return std::atomic_ref{field}.load(std::memory_order_relaxed);
+}
+
+static void print(nes::thread_pool_telemetry& telemetry, std::uint64_t completed_per_second)
+{
+    std::cout << "running: " << (load(telemetry.running) != 0 ? "yes" : "no")
+              << "  threads: " << load(telemetry.started_thread_count) << "/" << load(telemetry.thread_count)
+              << "  active: " << load(telemetry.active_workers)
+              << "  queued: " << load(telemetry.queue_depth) << "\n";
+
+    std::cout << "tasks queued: " << load(telemetry.tasks_queued)
+              << "  completed: " << load(telemetry.tasks_completed)
+              << "  (" << completed_per_second << "/s)\n";
+
+    std::cout << "task run time:\n";
+    for(std::size_t i{}; i < nes::thread_pool_telemetry::latency_bucket_count; ++i)
+    {
+        const std::uint64_t upper{std::uint64_t{1} << i};
+
+        if(i + 1 == nes::thread_pool_telemetry::latency_bucket_count)
+        {
+            std::cout << "  >= " << std::setw(8) << (upper / 2) << "us";
+        }
+        else
+        {
+            std::cout << "   < " << std::setw(8) << upper << "us";
+        }
+
+        std::cout << "  " << load(telemetry.latency_buckets[i]) << "\n";
+    }
+
+    std::cout << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <segment name> [--once] [--interval <milliseconds>]" << std::endl;
+        return 1;
+    }
+
+    const std::string name{argv[1]};
+    bool once{};
+    std::chrono::milliseconds interval{1000};
+
+    for(int i{2}; i < argc; ++i)
+    {
+        const std::string_view argument{argv[i]};
+
+        if(argument == "--once")
+        {
+            once = true;
+        }
+        else if(argument == "--interval" && i + 1 < argc)
+        {
+            interval = std::chrono::milliseconds{std::stoll(argv[++i])};
+        }
+        else
+        {
+            std::cerr << "Unknown argument " << argument << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        nes::shared_memory memory{name, nes::shared_memory_options::constant};
+        auto telemetry{memory.map<nes::thread_pool_telemetry>(0, nes::shared_memory_options::constant)};
+
+        if(std::atomic_ref{telemetry->magic}.load(std::memory_order_acquire) != nes::thread_pool_telemetry::magic_value)
+        {
+            std::cerr << name << " does not contain thread pool telemetry" << std::endl;
+            return 1;
+        }
+
+        if(load(telemetry->version) != nes::thread_pool_telemetry::current_version)
+        {
+            std::cerr << name << " uses telemetry version " << load(telemetry->version) << ", expected " << nes::thread_pool_telemetry::current_version << std::endl;
+            return 1;
+        }
+
+        std::uint64_t last_completed{load(telemetry->tasks_completed)};
+
+        while(true)
+        {
+            const std::uint64_t completed{load(telemetry->tasks_completed)};
+            const auto per_second{static_cast<std::uint64_t>((completed - last_completed) * 1000 / static_cast<std::uint64_t>(std::max<std::int64_t>(interval.count(), 1)))};
+            last_completed = completed;
+
+            print(*telemetry, per_second);
+
+            if(once || load(telemetry->running) == 0)
+            {
+                break;
+            }
+
+            std::this_thread::sleep_for(interval);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}